@@ -0,0 +1,117 @@
+#include <vector>
+#include <algorithm>
+#include <boost/bind.hpp>
+
+#include "AsyncExecutor.h"
+
+AsyncExecutor::AsyncExecutor(std::size_t threadCount) : state(new State)
+{
+	for(std::size_t i = 0; i < threadCount; i++)
+		workers.create_thread(boost::bind(&AsyncExecutor::work, this));
+}
+
+AsyncExecutor::~AsyncExecutor()
+{
+	{
+		boost::unique_lock<boost::mutex> guard(state->mutex);
+		while(state->pending != 0)
+			state->finished.wait(guard);
+		state->stopping = true;
+	}
+	
+	state->queued.notify_all();
+	workers.join_all();
+}
+
+std::size_t AsyncExecutor::getPendingCount() const
+{
+	boost::lock_guard<boost::mutex> guard(state->mutex);
+	return state->pending;
+}
+
+void AsyncExecutor::enqueue(const TaskPtr& task)
+{
+	{
+		boost::lock_guard<boost::mutex> guard(state->mutex);
+		state->pending++;
+		state->queues[task->priority].push_back(task);
+	}
+	state->queued.notify_one();
+}
+
+void AsyncExecutor::requeue(const StatePtr& state, const TaskPtr& task)
+{
+	{
+		boost::lock_guard<boost::mutex> guard(state->mutex);
+		state->queues[task->priority].push_back(task);
+	}
+	state->queued.notify_one();
+}
+
+// called by the thread releasing a lock the task was parked on, the callbacks of the other locks it was parked on
+// find it no longer parked, even once the executor is gone
+void AsyncExecutor::resume(const StatePtr& state, const TaskPtr& task)
+{
+	if(task->parked.exchange(false))
+		requeue(state, task);
+}
+
+void AsyncExecutor::work()
+{
+	while(true)
+	{
+		TaskPtr task;
+		{
+			boost::unique_lock<boost::mutex> guard(state->mutex);
+			while(!task)
+			{
+				for(unsigned int i = 0; i < Priorities::Count && !task; i++)
+				{
+					if(state->queues[i].empty())
+						continue;
+					task = state->queues[i].front();
+					state->queues[i].pop_front();
+				}
+				
+				if(task)
+					break;
+				if(state->stopping)
+					return;
+				state->queued.wait(guard);
+			}
+		}
+		
+		execute(task);
+	}
+}
+
+void AsyncExecutor::execute(const TaskPtr& task)
+{
+	{
+		const Lockable* missed = NULL;
+		TransactionPtr transaction = Transaction::tryStartTransaction(task->site, missed, TransactionModes::Pessimistic, task->priority);
+		if(!transaction)
+		{
+			// try again once parked, a release in between would otherwise go unnoticed, and park on every lock missed
+			// by trying again too, the one missed first may have been released before the task was parked on it
+			task->parked = true;
+			std::vector<const Lockable*> parkedOn;
+			while(!transaction && task->parked && std::find(parkedOn.begin(), parkedOn.end(), missed) == parkedOn.end())
+			{
+				parkedOn.push_back(missed);
+				missed->notifyOnRelease(boost::bind(&AsyncExecutor::resume, state, task));
+				transaction = Transaction::tryStartTransaction(task->site, missed, TransactionModes::Pessimistic, task->priority);
+			}
+			
+			// still parked or already queued again by a release
+			if(!transaction || !task->parked.exchange(false))
+				return;
+		}
+		
+		task->run();
+	}
+	
+	boost::lock_guard<boost::mutex> guard(state->mutex);
+	if(--state->pending == 0)
+		state->finished.notify_all();
+}
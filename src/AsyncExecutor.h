@@ -0,0 +1,122 @@
+#ifndef ASYNC_EXECUTOR_H
+#define ASYNC_EXECUTOR_H
+
+#include <deque>
+#include <boost/smart_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/atomic.hpp>
+#include <boost/utility/result_of.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/future.hpp>
+
+#include "Transaction.h"
+
+// runs db operations on a few worker threads without tying a thread up while an operation waits for its locks,
+// every operation runs in a transaction of its own that takes the locks learned for its call site up front without waiting,
+// if one of them is not free the operation is parked on that lock and queued again by the thread that releases it,
+// locks an operation needs beyond what its call site has learned are still waited for, the next run takes them up front
+class AsyncExecutor
+{
+	public:
+		
+		typedef Priorities::Priority Priority;
+		
+		explicit AsyncExecutor(std::size_t threadCount);
+		// waits for everything submitted to finish
+		~AsyncExecutor();
+		
+		// runs operation and fulfils the future with its result or exception, the site names the call site for the lock history
+		// like the site given to Transaction::startTransaction(), so it should be the same every time the same operation is submitted,
+		// higher priority operations leave the queue first
+		template<typename Operation>
+		boost::unique_future<typename boost::result_of<Operation()>::type> submit(const void* site, Operation operation, Priority priority = Priorities::Normal)
+		{
+			typedef typename boost::result_of<Operation()>::type Result;
+			
+			boost::shared_ptr< boost::promise<Result> > promise(new boost::promise<Result>);
+			boost::unique_future<Result> future(promise->get_future());
+			enqueue(TaskPtr(new Task(site, priority, Fulfil<Result>(promise, operation))));
+			return future;
+		}
+		
+		// operations that are waiting in the queue or for a lock
+		std::size_t getPendingCount() const;
+	
+	private:
+		
+		struct Task
+		{
+			Task(const void* s, Priority p, const boost::function<void()>& r) : site(s), priority(p), run(r), parked(false) { }
+			
+			const void* site;
+			Priority priority;
+			boost::function<void()> run;
+			// set while the task waits for a lock to be released, whoever clears it queues the task again
+			boost::atomic<bool> parked;
+		};
+		typedef boost::shared_ptr<Task> TaskPtr;
+		
+		template<typename Result>
+		struct Fulfil
+		{
+			Fulfil(const boost::shared_ptr< boost::promise<Result> >& p, const boost::function<Result()>& o) : promise(p), operation(o) { }
+			
+			void operator()() const
+			{
+				try
+				{
+					promise->set_value(operation());
+				}
+				catch(...)
+				{
+					promise->set_exception(boost::current_exception());
+				}
+			}
+			
+			boost::shared_ptr< boost::promise<Result> > promise;
+			boost::function<Result()> operation;
+		};
+		
+		// shared with the release callbacks of the locks tasks are parked on, which may stay registered after the executor is gone
+		struct State
+		{
+			State() : pending(0), stopping(false) { }
+			
+			boost::mutex mutex;
+			boost::condition_variable queued;
+			boost::condition_variable finished;
+			// one queue per priority class
+			std::deque<TaskPtr> queues[Priorities::Count];
+			// submitted and not finished yet
+			std::size_t pending;
+			bool stopping;
+		};
+		typedef boost::shared_ptr<State> StatePtr;
+		
+		void enqueue(const TaskPtr& task);
+		static void requeue(const StatePtr& state, const TaskPtr& task);
+		static void resume(const StatePtr& state, const TaskPtr& task);
+		void work();
+		void execute(const TaskPtr& task);
+		
+		const StatePtr state;
+		boost::thread_group workers;
+};
+
+template<>
+inline void AsyncExecutor::Fulfil<void>::operator()() const
+{
+	try
+	{
+		operation();
+		promise->set_value();
+	}
+	catch(...)
+	{
+		promise->set_exception(boost::current_exception());
+	}
+}
+
+#endif /* ASYNC_EXECUTOR_H */
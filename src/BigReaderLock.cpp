@@ -0,0 +1,228 @@
+#include <limits>
+#include <boost/foreach.hpp>
+
+#include "BigReaderLock.h"
+#include "Lockable.h"
+
+using namespace LockModes;
+
+namespace
+{
+	boost::atomic<unsigned int> nextSlot(0);
+}
+
+BigReaderLock::BigReaderLock()
+{
+	for(unsigned int i = 0; i < ReadModeCount; i++)
+		blockers[i] = 0;
+	for(unsigned int i = 0; i < Count; i++)
+		granted[i] = 0;
+}
+
+bool BigReaderLock::tryLock(LockMode held, LockMode mode)
+{
+	if(held == None && isRead(mode))
+		return tryRead(mode);
+	
+	boost::lock_guard<boost::mutex> guard(mutex);
+	
+	block(mode, 1);
+	if(!grantable(held, mode, std::numeric_limits<Ticket>::max()))
+	{
+		block(mode, -1);
+		if(!waiters.empty())
+			changed.notify_all();
+		return false;
+	}
+	grant(held, mode);
+	return true;
+}
+
+bool BigReaderLock::lock(LockMode held, LockMode mode, Ticket ticket, const boost::chrono::milliseconds& timeout)
+{
+	if(held == None && isRead(mode) && tryRead(mode))
+		return true;
+	
+	boost::chrono::steady_clock::time_point deadline = boost::chrono::steady_clock::now() + timeout;
+	boost::unique_lock<boost::mutex> guard(mutex);
+	
+	block(mode, 1);
+	waiters.push_back(Waiter(ticket, mode));
+	
+	bool acquired = true;
+	while(!grantable(held, mode, ticket))
+	{
+		if(changed.wait_until(guard, deadline) == boost::cv_status::timeout && !grantable(held, mode, ticket))
+		{
+			acquired = false;
+			break;
+		}
+	}
+	
+	for(std::vector<Waiter>::iterator it = waiters.begin(); it != waiters.end(); ++it)
+	{
+		if(it->ticket == ticket)
+		{
+			waiters.erase(it);
+			break;
+		}
+	}
+	
+	if(acquired)
+		grant(held, mode);
+	else
+	{
+		block(mode, -1);
+		if(!waiters.empty())
+			changed.notify_all();
+	}
+	
+	return acquired;
+}
+
+void BigReaderLock::unlock(LockMode held, LockMode mode)
+{
+	if(isRead(held) && mode == None)
+	{
+		leaveRead(held);
+		return;
+	}
+	
+	boost::lock_guard<boost::mutex> guard(mutex);
+	block(mode, 1);
+	grant(held, mode);
+	if(!waiters.empty())
+		changed.notify_all();
+}
+
+bool BigReaderLock::queuesBehind(LockMode mode, Ticket ticket, LockMode waitingMode, Ticket waitingTicket) const
+{
+	if(waitingTicket >= ticket)
+		return false;
+	if(isRead(mode))
+		return !isRead(waitingMode) && !Lockable::compatible(mode, waitingMode);
+	if(waitingMode == Exclusive && mode != Exclusive)
+		return true;
+	return queuesAcrossClasses(ticket, waitingTicket) && !Lockable::compatible(mode, waitingMode);
+}
+
+bool BigReaderLock::isLocked() const
+{
+	boost::lock_guard<boost::mutex> guard(mutex);
+	
+	for(unsigned int i = IntentionShared; i < Count; i++)
+		if(granted[i] != 0)
+			return true;
+	return !waiters.empty() || countReaders(IntentionShared) != 0 || countReaders(Shared) != 0;
+}
+
+unsigned int BigReaderLock::readIndex(LockMode mode)
+{
+	return mode == IntentionShared ? 0 : 1;
+}
+
+unsigned int BigReaderLock::threadSlot()
+{
+	// threads get slots round robin, with more threads than slots some of them share one
+	static thread_local unsigned int slot = nextSlot++ % SlotCount;
+	return slot;
+}
+
+bool BigReaderLock::tryRead(LockMode mode)
+{
+	unsigned int i = readIndex(mode);
+	slots[threadSlot()].readers[i]++;
+	
+	// writers raise blockers before they count the readers, so either the writer sees this reader or this reader sees the writer
+	if(blockers[i] == 0)
+		return true;
+	
+	leaveRead(mode);
+	return false;
+}
+
+void BigReaderLock::leaveRead(LockMode mode)
+{
+	unsigned int i = readIndex(mode);
+	slots[threadSlot()].readers[i]--;
+	
+	if(blockers[i] != 0)
+	{
+		// a writer may be waiting for the last reader to leave
+		boost::lock_guard<boost::mutex> guard(mutex);
+		changed.notify_all();
+	}
+}
+
+int BigReaderLock::countReaders(LockMode mode) const
+{
+	unsigned int i = readIndex(mode);
+	
+	// a thread may leave on another slot than it entered on, only the sum counts
+	int readers = 0;
+	BOOST_FOREACH(const Slot& slot, slots)
+		readers += slot.readers[i];
+	return readers;
+}
+
+bool BigReaderLock::grantable(LockMode held, LockMode mode, Ticket ticket) const
+{
+	for(unsigned int i = IntentionShared; i < Count; i++)
+	{
+		LockMode granting = static_cast<LockMode>(i);
+		if(Lockable::compatible(mode, granting))
+			continue;
+		
+		int others = isRead(granting) ? countReaders(granting) : granted[i];
+		if(i == held)
+			others--;
+		if(others != 0)
+			return false;
+	}
+	
+	// a conversion cannot queue behind requests that wait for the mode it already holds
+	if(held != None)
+		return true;
+	
+	// new readers wait as long as anything incompatible waits or is granted
+	if(isRead(mode))
+		return blockers[readIndex(mode)] == 0;
+	
+	BOOST_FOREACH(const Waiter& i, waiters)
+		if(queuesBehind(mode, ticket, i.mode, i.ticket))
+			return false;
+	
+	return true;
+}
+
+void BigReaderLock::grant(LockMode held, LockMode mode)
+{
+	release(held);
+	
+	if(isRead(mode))
+		slots[threadSlot()].readers[readIndex(mode)]++;
+	else if(mode != None)
+		granted[mode]++;
+}
+
+void BigReaderLock::release(LockMode held)
+{
+	if(isRead(held))
+		slots[threadSlot()].readers[readIndex(held)]--;
+	else if(held != None)
+	{
+		granted[held]--;
+		block(held, -1);
+	}
+}
+
+void BigReaderLock::block(LockMode mode, int change)
+{
+	if(mode == None || isRead(mode))
+		return;
+	
+	if(!Lockable::compatible(IntentionShared, mode))
+		blockers[readIndex(IntentionShared)] += change;
+	if(!Lockable::compatible(Shared, mode))
+		blockers[readIndex(Shared)] += change;
+}
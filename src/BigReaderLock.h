@@ -0,0 +1,78 @@
+#ifndef BIG_READER_LOCK_H
+#define BIG_READER_LOCK_H
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "ModeLock.h"
+
+// readers (IntentionShared and Shared) count themselves in a slot picked per thread and never touch the mutex
+// as long as nothing incompatible is granted or waiting, so reading threads do not fight over one cache line,
+// everything else takes the mutex and has to look at every slot, so writers pay for it
+class BigReaderLock : public ModeLock
+{
+	public:
+		
+		BigReaderLock();
+		virtual ~BigReaderLock() { };
+		
+		virtual bool tryLock(LockMode held, LockMode mode);
+		virtual bool lock(LockMode held, LockMode mode, Ticket ticket, const boost::chrono::milliseconds& timeout);
+		virtual void unlock(LockMode held, LockMode mode);
+		
+		// new readers wait behind writers that are waiting already, writers only behind a waiting exclusive request
+		// or an incompatible one of another priority class with an earlier ticket
+		virtual bool queuesBehind(LockMode mode, Ticket ticket, LockMode waitingMode, Ticket waitingTicket) const;
+		
+		virtual bool isLocked() const;
+		
+	private:
+		
+		static const unsigned int SlotCount = 16;
+		static const unsigned int ReadModeCount = 2;
+		
+		// one cache line each
+		struct Slot
+		{
+			Slot() { readers[0] = 0; readers[1] = 0; }
+			
+			boost::atomic<int> readers[ReadModeCount];
+			char padding[64 - ReadModeCount * sizeof(boost::atomic<int>)];
+		};
+		
+		struct Waiter
+		{
+			Waiter(Ticket t, LockMode m) : ticket(t), mode(m) { }
+			
+			Ticket ticket;
+			LockMode mode;
+		};
+		
+		static unsigned int readIndex(LockMode mode);
+		static unsigned int threadSlot();
+		
+		bool tryRead(LockMode mode);
+		void leaveRead(LockMode mode);
+		int countReaders(LockMode mode) const;
+		
+		// all of these must be called with mutex held
+		bool grantable(LockMode held, LockMode mode, Ticket ticket) const;
+		void grant(LockMode held, LockMode mode);
+		void release(LockMode held);
+		// marks the read modes a non-read mode is incompatible with as blocked while it waits or is granted
+		void block(LockMode mode, int change);
+		
+		Slot slots[SlotCount];
+		// number of requests incompatible with each read mode that are waiting or granted
+		boost::atomic<int> blockers[ReadModeCount];
+		
+		mutable boost::mutex mutex;
+		boost::condition_variable changed;
+		// non-read modes only, readers are in the slots
+		unsigned int granted[LockModes::Count];
+		std::vector<Waiter> waiters;
+};
+
+#endif /* BIG_READER_LOCK_H */
@@ -0,0 +1,421 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <boost/cstdint.hpp>
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+// Compressed set of ids in the style of Roaring bitmaps. Ids are split by their high bits into chunks of 65536,
+// each chunk keeps its low bits either in a sorted array while it has at most 4096 of them or in a bitset of 1024 words,
+// so sparse chunks stay small and dense ones are combined a word at a time (two with SSE2 where there is SSE2).
+class Bitmap
+{
+	public:
+		
+		typedef std::size_t ID;
+		
+		bool insert(ID id)
+		{
+			Chunks::iterator chunk = std::lower_bound(chunks.begin(), chunks.end(), high(id), lowerHigh);
+			if(chunk == chunks.end() || chunk->key != high(id))
+				chunk = chunks.insert(chunk, Chunk(high(id)));
+			return chunk->insert(low(id));
+		}
+		
+		bool erase(ID id)
+		{
+			Chunks::iterator chunk = std::lower_bound(chunks.begin(), chunks.end(), high(id), lowerHigh);
+			if(chunk == chunks.end() || chunk->key != high(id) || !chunk->erase(low(id)))
+				return false;
+			if(chunk->count == 0)
+				chunks.erase(chunk);
+			return true;
+		}
+		
+		bool contains(ID id) const
+		{
+			Chunks::const_iterator chunk = std::lower_bound(chunks.begin(), chunks.end(), high(id), lowerHigh);
+			return chunk != chunks.end() && chunk->key == high(id) && chunk->contains(low(id));
+		}
+		
+		// the number of ids, without visiting them
+		std::size_t size() const
+		{
+			std::size_t count = 0;
+			for(std::size_t i = 0; i < chunks.size(); i++)
+				count += chunks[i].count;
+			return count;
+		}
+		
+		bool empty() const
+		{
+			return chunks.empty();
+		}
+		
+		void clear()
+		{
+			Chunks().swap(chunks);
+		}
+		
+		// calls visitor with the ids from first on in increasing order until it returns false, returns false if it stopped
+		template<typename Visitor>
+		bool forEach(Visitor visitor, ID first = 0) const
+		{
+			Chunks::const_iterator chunk = std::lower_bound(chunks.begin(), chunks.end(), high(first), lowerHigh);
+			for(; chunk != chunks.end(); ++chunk)
+			{
+				ID base = static_cast<ID>(chunk->key) << lowBits;
+				boost::uint32_t start = chunk->key == high(first) ? low(first) : 0;
+				if(chunk->words.empty())
+				{
+					for(std::vector<boost::uint16_t>::const_iterator i = std::lower_bound(chunk->values.begin(), chunk->values.end(), start); i != chunk->values.end(); ++i)
+						if(!visitor(base + *i))
+							return false;
+					continue;
+				}
+				
+				for(std::size_t word = start / 64; word < wordCount; word++)
+				{
+					boost::uint64_t bits = chunk->words[word];
+					if(word == start / 64)
+						bits &= ~boost::uint64_t(0) << (start % 64);
+					for(; bits != 0; bits &= bits - 1)
+						if(!visitor(base + word * 64 + lowestBit(bits)))
+							return false;
+				}
+			}
+			return true;
+		}
+		
+		// the ids in both
+		Bitmap& operator&=(const Bitmap& other)
+		{
+			Chunks result;
+			Chunks::const_iterator a = chunks.begin(), b = other.chunks.begin();
+			while(a != chunks.end() && b != other.chunks.end())
+			{
+				if(a->key < b->key)
+					++a;
+				else if(b->key < a->key)
+					++b;
+				else
+				{
+					Chunk chunk(intersect(*a, *b));
+					if(chunk.count != 0)
+						result.push_back(chunk);
+					++a;
+					++b;
+				}
+			}
+			chunks.swap(result);
+			return *this;
+		}
+		
+		// the ids in either
+		Bitmap& operator|=(const Bitmap& other)
+		{
+			Chunks result;
+			Chunks::const_iterator a = chunks.begin(), b = other.chunks.begin();
+			while(a != chunks.end() || b != other.chunks.end())
+			{
+				if(b == other.chunks.end() || (a != chunks.end() && a->key < b->key))
+					result.push_back(*a++);
+				else if(a == chunks.end() || b->key < a->key)
+					result.push_back(*b++);
+				else
+					result.push_back(unite(*a++, *b++));
+			}
+			chunks.swap(result);
+			return *this;
+		}
+		
+		// the ids not in other, with all the ids of a store this is how a predicate is negated
+		Bitmap& operator-=(const Bitmap& other)
+		{
+			Chunks result;
+			Chunks::const_iterator b = other.chunks.begin();
+			for(Chunks::const_iterator a = chunks.begin(); a != chunks.end(); ++a)
+			{
+				while(b != other.chunks.end() && b->key < a->key)
+					++b;
+				if(b == other.chunks.end() || b->key != a->key)
+				{
+					result.push_back(*a);
+					continue;
+				}
+				Chunk chunk(subtract(*a, *b));
+				if(chunk.count != 0)
+					result.push_back(chunk);
+			}
+			chunks.swap(result);
+			return *this;
+		}
+		
+		friend Bitmap operator&(Bitmap a, const Bitmap& b) { return a &= b; }
+		friend Bitmap operator|(Bitmap a, const Bitmap& b) { return a |= b; }
+		friend Bitmap operator-(Bitmap a, const Bitmap& b) { return a -= b; }
+		
+	private:
+		
+		enum
+		{
+			lowBits = 16,
+			wordCount = (1 << lowBits) / 64,
+			// an array of more values would take more space than the bitset
+			maxValues = 4096
+		};
+		
+		typedef std::vector<boost::uint64_t> Words;
+		
+		// the ids whose high bits are key, in values or in words but never both, chunks without ids are dropped
+		struct Chunk
+		{
+			explicit Chunk(ID k = 0) : key(k), count(0) { }
+			
+			bool contains(boost::uint16_t value) const
+			{
+				if(!words.empty())
+					return (words[value / 64] >> (value % 64)) & 1;
+				return std::binary_search(values.begin(), values.end(), value);
+			}
+			
+			bool insert(boost::uint16_t value)
+			{
+				if(!words.empty())
+				{
+					boost::uint64_t bit = boost::uint64_t(1) << (value % 64);
+					if(words[value / 64] & bit)
+						return false;
+					words[value / 64] |= bit;
+				}
+				else
+				{
+					std::vector<boost::uint16_t>::iterator it = std::lower_bound(values.begin(), values.end(), value);
+					if(it != values.end() && *it == value)
+						return false;
+					values.insert(it, value);
+				}
+				count++;
+				fit();
+				return true;
+			}
+			
+			bool erase(boost::uint16_t value)
+			{
+				if(!words.empty())
+				{
+					boost::uint64_t bit = boost::uint64_t(1) << (value % 64);
+					if(!(words[value / 64] & bit))
+						return false;
+					words[value / 64] &= ~bit;
+				}
+				else
+				{
+					std::vector<boost::uint16_t>::iterator it = std::lower_bound(values.begin(), values.end(), value);
+					if(it == values.end() || *it != value)
+						return false;
+					values.erase(it);
+				}
+				count--;
+				fit();
+				return true;
+			}
+			
+			// switches between values and words when count crosses maxValues
+			void fit()
+			{
+				if(words.empty() && count > maxValues)
+				{
+					words.assign(std::size_t(wordCount), 0);
+					for(std::size_t i = 0; i < values.size(); i++)
+						words[values[i] / 64] |= boost::uint64_t(1) << (values[i] % 64);
+					std::vector<boost::uint16_t>().swap(values);
+				}
+				else if(!words.empty() && count <= maxValues)
+				{
+					values.reserve(count);
+					for(std::size_t word = 0; word < wordCount; word++)
+						for(boost::uint64_t bits = words[word]; bits != 0; bits &= bits - 1)
+							values.push_back(static_cast<boost::uint16_t>(word * 64 + lowestBit(bits)));
+					Words().swap(words);
+				}
+			}
+			
+			ID key;
+			boost::uint32_t count;
+			std::vector<boost::uint16_t> values;
+			Words words;
+		};
+		typedef std::vector<Chunk> Chunks;
+		
+		static ID high(ID id) { return id >> lowBits; }
+		static boost::uint16_t low(ID id) { return static_cast<boost::uint16_t>(id); }
+		
+		static bool lowerHigh(const Chunk& chunk, ID h)
+		{
+			return chunk.key < h;
+		}
+		
+		static unsigned int lowestBit(boost::uint64_t bits)
+		{
+			#ifdef __GNUC__
+				return __builtin_ctzll(bits);
+			#else
+				unsigned int bit = 0;
+				while(!(bits & 1))
+				{
+					bits >>= 1;
+					bit++;
+				}
+				return bit;
+			#endif
+		}
+		
+		static unsigned int bitCount(boost::uint64_t bits)
+		{
+			#ifdef __GNUC__
+				return __builtin_popcountll(bits);
+			#else
+				unsigned int count = 0;
+				for(; bits != 0; bits &= bits - 1)
+					count++;
+				return count;
+			#endif
+		}
+		
+		struct And
+		{
+			static boost::uint64_t word(boost::uint64_t a, boost::uint64_t b) { return a & b; }
+			#ifdef __SSE2__
+				static __m128i vector(__m128i a, __m128i b) { return _mm_and_si128(a, b); }
+			#endif
+		};
+		struct Or
+		{
+			static boost::uint64_t word(boost::uint64_t a, boost::uint64_t b) { return a | b; }
+			#ifdef __SSE2__
+				static __m128i vector(__m128i a, __m128i b) { return _mm_or_si128(a, b); }
+			#endif
+		};
+		struct AndNot
+		{
+			static boost::uint64_t word(boost::uint64_t a, boost::uint64_t b) { return a & ~b; }
+			#ifdef __SSE2__
+				static __m128i vector(__m128i a, __m128i b) { return _mm_andnot_si128(b, a); }
+			#endif
+		};
+		
+		// the words of a and b combined by Operation into result, which gets the count of their bits
+		template<typename Operation>
+		static void combine(const Chunk& a, const Chunk& b, Chunk& result)
+		{
+			result.words.resize(std::size_t(wordCount));
+			#ifdef __SSE2__
+				for(std::size_t i = 0; i < wordCount; i += 2)
+				{
+					__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&a.words[i]));
+					__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&b.words[i]));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(&result.words[i]), Operation::vector(x, y));
+				}
+			#else
+				for(std::size_t i = 0; i < wordCount; i++)
+					result.words[i] = Operation::word(a.words[i], b.words[i]);
+			#endif
+			result.count = 0;
+			for(std::size_t i = 0; i < wordCount; i++)
+				result.count += bitCount(result.words[i]);
+		}
+		
+		static Chunk intersect(const Chunk& a, const Chunk& b)
+		{
+			Chunk result(a.key);
+			if(!a.words.empty() && !b.words.empty())
+				combine<And>(a, b, result);
+			else if(a.words.empty() && b.words.empty())
+			{
+				std::set_intersection(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), std::back_inserter(result.values));
+				result.count = result.values.size();
+			}
+			else
+			{
+				// the values that are in the words
+				const Chunk& array(a.words.empty() ? a : b);
+				const Chunk& bitset(a.words.empty() ? b : a);
+				for(std::size_t i = 0; i < array.values.size(); i++)
+					if(bitset.contains(array.values[i]))
+						result.values.push_back(array.values[i]);
+				result.count = result.values.size();
+			}
+			result.fit();
+			return result;
+		}
+		
+		static Chunk unite(const Chunk& a, const Chunk& b)
+		{
+			Chunk result(a.key);
+			if(!a.words.empty() && !b.words.empty())
+				combine<Or>(a, b, result);
+			else if(a.words.empty() && b.words.empty())
+			{
+				std::set_union(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), std::back_inserter(result.values));
+				result.count = result.values.size();
+			}
+			else
+			{
+				// the words with the values added
+				const Chunk& array(a.words.empty() ? a : b);
+				result = a.words.empty() ? b : a;
+				for(std::size_t i = 0; i < array.values.size(); i++)
+				{
+					boost::uint64_t bit = boost::uint64_t(1) << (array.values[i] % 64);
+					if(!(result.words[array.values[i] / 64] & bit))
+					{
+						result.words[array.values[i] / 64] |= bit;
+						result.count++;
+					}
+				}
+			}
+			result.fit();
+			return result;
+		}
+		
+		static Chunk subtract(const Chunk& a, const Chunk& b)
+		{
+			Chunk result(a.key);
+			if(!a.words.empty() && !b.words.empty())
+				combine<AndNot>(a, b, result);
+			else if(a.words.empty())
+			{
+				// the values of a that b lacks, whatever b keeps them in
+				for(std::size_t i = 0; i < a.values.size(); i++)
+					if(!b.contains(a.values[i]))
+						result.values.push_back(a.values[i]);
+				result.count = result.values.size();
+			}
+			else
+			{
+				result = a;
+				for(std::size_t i = 0; i < b.values.size(); i++)
+				{
+					boost::uint64_t bit = boost::uint64_t(1) << (b.values[i] % 64);
+					if(result.words[b.values[i] / 64] & bit)
+					{
+						result.words[b.values[i] / 64] &= ~bit;
+						result.count--;
+					}
+				}
+			}
+			result.fit();
+			return result;
+		}
+		
+		// in increasing order of key
+		Chunks chunks;
+};
+
+#endif /* BITMAP_H */
@@ -0,0 +1,35 @@
+#ifndef BITMAP_INDEX_H
+#define BITMAP_INDEX_H
+
+#include <boost/functional/hash.hpp>
+
+template<
+	typename ModelClassPtr,
+	typename KeyType,
+	class KeyHashFunctor = boost::hash<KeyType>,
+	class EqualKey = std::equal_to<KeyType>
+>
+class BitmapIndex;
+
+#include "HashIndex.h"
+
+// hash index for fields with few values and many instances each, whose bitmaps are combined with bit operations
+// and turned into instances in the order of their ids: it is not split into shards so the ids of all shards share
+// one bitmap per key and getBitmap() hands it out without ORing the shards
+template<
+	typename ModelClassPtr,
+	typename KeyType,
+	class KeyHashFunctor,
+	class EqualKey
+>
+class BitmapIndex : public HashIndex<ModelClassPtr, KeyType, KeyHashFunctor, EqualKey>
+{
+	public:
+		
+		typedef HashIndex<ModelClassPtr, KeyType, KeyHashFunctor, EqualKey> ParentClass;
+		
+		BitmapIndex() { };
+		virtual ~BitmapIndex() { };
+};
+
+#endif /* BITMAP_INDEX_H */
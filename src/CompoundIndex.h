@@ -3,76 +3,71 @@
 #define COMPOUND_INDEX_H
 
 #include <typeinfo>
-#include <boost/unordered_map.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <boost/tuple/tuple_comparison.hpp>
 #include <boost/tuple/tuple_io.hpp>
 
+template<typename ParentClass, typename... FieldTypes>
+class CompoundKeyIndex;
 template<typename ModelClassPtr, typename... FieldTypes>
 class CompoundIndex;
+template<typename ModelClassPtr, typename... FieldTypes>
+class UniqueCompoundIndex;
 
 #include "HashIndex.h"
+#include "UniqueIndex.h"
 #include "KeyOperators.h"
 #include "Field.h"
 
-template<typename ModelClassPtr, typename... FieldTypes>
-class CompoundIndex : public HashIndex< ModelClassPtr, boost::tuple< typename FieldTypes::type... > >
+// index of ParentClass, a StorageIndex, on the tuples of the values of FieldTypes
+template<typename ParentClass, typename... FieldTypes>
+class CompoundKeyIndex : public ParentClass
 {
 public:
 		
 		typedef boost::tuple< typename FieldTypes::type... > TupleType;
-		typedef HashIndex< ModelClassPtr, TupleType > ParentClass;
-		
-		template<typename KeyType, std::size_t counter, typename... OtherFieldIds>
-		inline bool updateTupleSubkeyHelper(FieldId updatingFieldId, TupleType& key, const boost::any& subkey, FieldId fieldId)
-		{
-			if(updatingFieldId == fieldId)
-			{
-				boost::tuples::get<counter>(key) = boost::any_cast<typename KeyType::head_type>(subkey);
-				return true;
-			}
-			else
-				return false;
-		}
+		typedef typename ParentClass::ValueType ModelClassPtr;
 		
-		template<typename KeyType, std::size_t counter, typename... OtherFieldIds>
-		inline bool updateTupleSubkeyHelper(FieldId updatingFieldId, TupleType& key, const boost::any& subkey, FieldId fieldId, OtherFieldIds... otherFieldIds)
-		{
-			if(updateTupleSubkeyHelper<KeyType, counter>(updatingFieldId, key, subkey, fieldId))
-				return true;
-			else
-				return updateTupleSubkeyHelper<typename KeyType::tail_type, counter+1, OtherFieldIds...>(updatingFieldId, key, subkey, otherFieldIds...);
-		}
-		
-		template<typename... OtherFieldIds>
-		inline void updateTupleSubkey(FieldId updatingFieldId, TupleType& key, const boost::any& subkey, FieldId fieldId, OtherFieldIds... otherFieldIds)
-		{
-			updateTupleSubkeyHelper<TupleType, 0, OtherFieldIds...>(updatingFieldId, key, subkey, fieldId, otherFieldIds...);
-		}
+		CompoundKeyIndex() { };
+		CompoundKeyIndex(std::size_t position, std::size_t count) : ParentClass(position, count) { };
 		
+		// the key is read from the current values of all the fields of instance, not put together from the keys stored before,
+		// so it is right whichever field changed and assigning an old value back after a failed store restores it
 		virtual void store(FieldId fieldId, const boost::any& subkey, ModelClassPtr instance)
 		{
-			// if trying to store full tuple key, do that
 			if(subkey.type() == typeid(TupleType))
 				return ParentClass::store(fieldId, subkey, instance);
 			
-			// otherwise, do partial key update
-			
-			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getExclusiveLock(this);
-			
-			TupleType key;
-			
-			typename ParentClass::Multimap::right_iterator it = this->index.right.find(instance);
-			if(it != this->index.right.end())
-				key = it->second;
-			
-			updateTupleSubkey(fieldId, key, subkey, FieldTypes::field_id...);
-			
-			return ParentClass::store(fieldId, key, instance);
+			return ParentClass::store(fieldId, TupleType(fieldValue<FieldTypes>(instance)...), instance);
 		}
 		
 		virtual bool isCompoundIndex() const { return true; }
+		
+	private:
+		
+		// the default value for instances of a class without the field, like the fields of a subclass
+		template<typename FieldType>
+		static typename FieldType::type fieldValue(const ModelClassPtr& instance)
+		{
+			const FieldBase* field = ModelStoreGetter<ModelClassPtr>()().findField(instance, FieldType::field_id);
+			return field ? static_cast<const FieldType*>(field)->get() : typename FieldType::type();
+		}
+};
+
+template<typename ModelClassPtr, typename... FieldTypes>
+class CompoundIndex : public CompoundKeyIndex< HashIndex< ModelClassPtr, boost::tuple< typename FieldTypes::type... > >, FieldTypes... >
+{
+	public:
+		
+		typedef CompoundKeyIndex< HashIndex< ModelClassPtr, boost::tuple< typename FieldTypes::type... > >, FieldTypes... > ParentClass;
+		
+		CompoundIndex(std::size_t position = 0, std::size_t count = 1) : ParentClass(position, count) { };
+};
+
+// compound index with at most one instance per tuple, see UniqueIndex
+template<typename ModelClassPtr, typename... FieldTypes>
+class UniqueCompoundIndex : public CompoundKeyIndex< UniqueIndex< ModelClassPtr, boost::tuple< typename FieldTypes::type... > >, FieldTypes... >
+{
 };
 
 namespace boost
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "DatabaseException.h"
+
+class ConflictException : public DatabaseException
+{
+	public:
+		ConflictException() : DatabaseException("Conflicting write detected") { };
+	private:
+};
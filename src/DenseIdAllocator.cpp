@@ -0,0 +1,78 @@
+#include "DenseIdAllocator.h"
+
+DenseIdAllocator::DenseIdAllocator(std::size_t p, std::size_t c) : position(p), count(c), next(p)
+{
+}
+
+IdAllocator::ID DenseIdAllocator::allocate()
+{
+	if(!released.empty())
+	{
+		ID id = *released.begin();
+		released.erase(released.begin());
+		return id;
+	}
+	
+	// reserved ids reached by next are in use already
+	while(!distant.empty() && *distant.begin() == next)
+	{
+		distant.erase(distant.begin());
+		next += count;
+	}
+	
+	ID id = next;
+	next += count;
+	return id;
+}
+
+void DenseIdAllocator::release(ID id)
+{
+	if(distant.erase(id))
+		return;
+	
+	if(id + count != next)
+	{
+		released.insert(id);
+		return;
+	}
+	
+	// the highest ids go back to never handed out, so the released ones do not pile up after erasing the newest instances
+	next = id;
+	while(!released.empty() && *released.rbegin() + count == next)
+	{
+		next = *released.rbegin();
+		released.erase(--released.end());
+	}
+}
+
+void DenseIdAllocator::reserve(ID id)
+{
+	if(id < next)
+	{
+		released.erase(id);
+		return;
+	}
+	
+	if((id - next) / count > maxReusedGap)
+	{
+		distant.insert(id);
+		return;
+	}
+	
+	for(ID skipped = next; skipped < id; skipped += count)
+		if(!distant.erase(skipped))
+			released.insert(skipped);
+	next = id + count;
+}
+
+void DenseIdAllocator::clear()
+{
+	next = position;
+	released.clear();
+	distant.clear();
+}
+
+IdAllocator* DenseIdAllocator::create(std::size_t p, std::size_t c) const
+{
+	return new DenseIdAllocator(p, c);
+}
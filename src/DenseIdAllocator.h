@@ -0,0 +1,39 @@
+#ifndef DENSE_ID_ALLOCATOR_H
+#define DENSE_ID_ALLOCATOR_H
+
+#include <set>
+
+#include "IdAllocator.h"
+
+// hands out the ids of a shard in increasing order and reuses released ones lowest first,
+// so the ids stay small and dense and are the same in every run that stores the same instances in the same order
+class DenseIdAllocator : public IdAllocator
+{
+	public:
+		
+		DenseIdAllocator(std::size_t position = 0, std::size_t count = 1);
+		virtual ~DenseIdAllocator() { };
+		
+		virtual ID allocate();
+		virtual void release(ID id);
+		virtual void reserve(ID id);
+		virtual void clear();
+		
+		virtual IdAllocator* create(std::size_t position, std::size_t count) const;
+		
+	private:
+		
+		// ids skipped by a reserved id are kept for reuse unless there are more of them than this,
+		// like when importing ids from a different allocator, then the reserved id is kept aside and next stays where it is
+		static const std::size_t maxReusedGap = 65536;
+		
+		const std::size_t position;
+		const std::size_t count;
+		// lowest id never handed out
+		ID next;
+		std::set<ID> released;
+		// reserved ids too far above next to count the ones in between as released
+		std::set<ID> distant;
+};
+
+#endif /* DENSE_ID_ALLOCATOR_H */
@@ -3,6 +3,7 @@
 #define FIELD_H
 
 #include <list>
+#include <vector>
 #include <typeinfo>
 #include <stddef.h>
 #include <boost/functional/hash.hpp>
@@ -10,6 +11,7 @@
 #include <boost/smart_ptr.hpp>
 #include <boost/type_traits/has_dereference.hpp>
 #include <boost/mpl/if.hpp>
+#include <boost/iterator/iterator_adaptor.hpp>
 #include <gmpxx.h>
 
 typedef std::size_t FieldId;
@@ -193,9 +195,13 @@ class FieldBase
 		virtual Json::Value toJson() const = 0;
 		virtual void fromJson(const Json::Value& value) = 0;
 		virtual bool policyExists(FieldPolicies::FieldPolicy p) const = 0;
+		virtual FieldPolicies::FieldPolicy getPolicies() const = 0;
 		
 		// used by IndexedFields
-		virtual void registerField() const { };
+		virtual bool isIndexed() const { return false; }
+		// what registering the model of the field sets up for it, the same for every instance so it is kept with the FieldDescriptor
+		typedef void (*Registration)();
+		virtual Registration getRegistration() const { return NULL; }
 		virtual void updateIndex() const { };
 		
 		// used by RelationFields
@@ -203,6 +209,70 @@ class FieldBase
 		virtual void modelDeleteHandler() { };
 };
 
+// where a field lives in its model and what it is, collected once per model class
+// so going through the fields of an instance allocates nothing and calls nothing on the instance
+struct FieldDescriptor
+{
+	FieldDescriptor(const FieldBase* field, const void* model)
+		: id(field->getFieldId())
+		, name(field->getFieldName())
+		, offset(reinterpret_cast<const char*>(field) - static_cast<const char*>(model))
+		, policies(field->getPolicies())
+		, indexed(field->isIndexed())
+		, registration(field->getRegistration())
+	{ }
+	
+	// the field in model, which has to be of the class the descriptor was collected from
+	FieldBase* get(const void* model) const
+	{
+		return reinterpret_cast<FieldBase*>(const_cast<char*>(static_cast<const char*>(model)) + offset);
+	}
+	
+	FieldId id;
+	std::string name;
+	std::ptrdiff_t offset;
+	FieldPolicies::FieldPolicy policies;
+	bool indexed;
+	FieldBase::Registration registration;
+};
+typedef std::vector<FieldDescriptor> FieldDescriptors;
+
+// the fields of one instance in the order of the descriptors of its class
+class ModelFields
+{
+	public:
+		
+		class const_iterator : public boost::iterator_adaptor<const_iterator, FieldDescriptors::const_iterator, FieldBase*, boost::use_default, FieldBase*>
+		{
+			public:
+				
+				const_iterator() : model(NULL) { }
+				const_iterator(FieldDescriptors::const_iterator it, const void* m) : const_iterator::iterator_adaptor_(it), model(m) { }
+				
+			private:
+				
+				friend class boost::iterator_core_access;
+				
+				FieldBase* dereference() const
+				{
+					return this->base()->get(model);
+				}
+				
+				const void* model;
+		};
+		typedef const_iterator iterator;
+		
+		ModelFields(const FieldDescriptors& d, const void* m) : descriptors(&d), model(m) { }
+		
+		const_iterator begin() const { return const_iterator(descriptors->begin(), model); }
+		const_iterator end() const { return const_iterator(descriptors->end(), model); }
+		
+	private:
+		
+		const FieldDescriptors* descriptors;
+		const void* model;
+};
+
 #include "Transaction.h"
 
 template<typename T>
@@ -239,27 +309,41 @@ class Field : public FieldBase
 		
 		virtual bool operator==(const Field<FieldType, fieldId, ModelClassPtr, fieldPolicies>& rhs) const
 		{
+			if(Transaction::isReadingOptimistically())
+				return read() == rhs.read();
 			return var == rhs.var;
 		}
 		
 		virtual bool operator==(const FieldType& rhs) const
 		{
+			if(Transaction::isReadingOptimistically())
+				return read() == rhs;
 			return var == rhs;
 		}
 		
 		//virtual const FieldType& operator*() const { return var; };
 		//virtual const FieldType* operator->() const { return &var; };
 		
-		const auto& operator*() const { return *var; };
-		const auto* operator->() const { return &(*var); };
+		// the pointer is copied for optimistic transactions, what it points to is not part of the instance
+		const auto& operator*() const { return Transaction::isReadingOptimistically() ? *read() : *var; };
+		const auto* operator->() const { return &(**this); };
 		
 		virtual const FieldType& get() const { return var; };
 		
+		// a copy, which optimistic transactions take consistently and check on commit, see Transaction::read(),
+		// get() and the conversion hand out the field itself and optimistic transactions do not see those reads
+		FieldType read() const
+		{
+			if(Transaction::isReadingOptimistically())
+				return ModelStoreGetter<ModelClassPtr>()().readInstance(this->getModel(), var);
+			return var;
+		}
+		
 		virtual const FieldType& operator=(const FieldType& rhs)
 		{
-			// TODO: it may be a bit too expensive to lock on assignment, is it really necessary?
+			// only this instance is locked, writers of other instances are not blocked
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getExclusiveLock(static_cast<Lockable*>(&ModelStoreGetter<ModelClassPtr>()()));
+			ModelStoreGetter<ModelClassPtr>()().lockInstance(this->getModel());
 			
 			var = rhs;
 			return var;
@@ -269,6 +353,8 @@ class Field : public FieldBase
 		
 		virtual Json::Value toJson() const
 		{
+			if(Transaction::isReadingOptimistically())
+				return FieldToJsonValue<FieldType>()(read());
 			return FieldToJsonValue<FieldType>()(var);
 		}
 		
@@ -282,8 +368,14 @@ class Field : public FieldBase
 			return (p & fieldPolicies) != 0;
 		}
 		
+		virtual FieldPolicies::FieldPolicy getPolicies() const
+		{
+			return fieldPolicies;
+		}
+		
 	protected:
 		
+		// fields are read without locks, optimistic transactions go through read() to note the version of the instance lock
 		FieldType var;
 };
 
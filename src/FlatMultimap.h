@@ -0,0 +1,176 @@
+#ifndef FLAT_MULTIMAP_H
+#define FLAT_MULTIMAP_H
+
+#include <cstddef>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "FlatTable.h"
+#include "InstanceSlots.h"
+#include "Bitmap.h"
+
+// Keys to the ids of their values and ids back to their value and key, the storage of hash indexes. The ids of a key
+// are kept together in a bitmap of their own that one flat table finds by key, and the values sit in slots by id,
+// so a lookup is a probe and a walk over the ids of the key in order, and finding the value and the key of an id
+// or erasing it is an array access.
+template<typename Key, typename ID, typename Value, class KeyHash, class KeyEqual>
+class FlatMultimap
+{
+	public:
+		
+		// the ids of a store shard are congruent to position modulo count, see InstanceSlots
+		FlatMultimap(std::size_t position, std::size_t count) : locations(position, count) { }
+		
+		// NULL if key has no values
+		const Bitmap* find(const Key& key) const
+		{
+			const typename Keys::Entry* entry = keys.find(key);
+			return entry ? &postings[entry->second].ids : NULL;
+		}
+		
+		// NULL if id is not there
+		const Value* at(ID id) const
+		{
+			const Location* location = locations.at(id);
+			return location ? &location->value : NULL;
+		}
+		
+		std::size_t count(const Key& key) const
+		{
+			const Bitmap* ids = find(key);
+			return ids ? ids->size() : 0;
+		}
+		
+		bool contains(const Key& key, ID id) const
+		{
+			const Bitmap* ids = find(key);
+			return ids && ids->contains(id);
+		}
+		
+		// calls visitor with the ids of key from first on and their values in id order, see Bitmap::forEach()
+		template<typename Visitor>
+		bool forEach(const Key& key, Visitor visitor, ID first = 0) const
+		{
+			const Bitmap* ids = find(key);
+			return !ids || forEach(*ids, visitor, first);
+		}
+		
+		// the same for ids from anywhere, ids that are not here are left out
+		template<typename Visitor>
+		bool forEach(const Bitmap& ids, Visitor visitor, ID first = 0) const
+		{
+			return ids.forEach(VisitValue<Visitor>(*this, visitor), first);
+		}
+		
+		// takes the place of what id had before
+		void insert(const Key& key, ID id, const Value& value)
+		{
+			erase(id);
+			
+			std::pair<typename Keys::Entry*, bool> entry = keys.insert(key, 0);
+			if(entry.second)
+				entry.first->second = newPostings(key);
+			
+			postings[entry.first->second].ids.insert(id);
+			Location location;
+			location.value = value;
+			location.postings = entry.first->second;
+			locations.insert(id, location);
+		}
+		
+		bool erase(ID id)
+		{
+			const Location* location = locations.at(id);
+			if(!location)
+				return false;
+			
+			boost::uint32_t position = location->postings;
+			Postings& idPostings(postings[position]);
+			idPostings.ids.erase(id);
+			locations.erase(id);
+			
+			if(idPostings.ids.empty())
+			{
+				keys.erase(idPostings.key);
+				idPostings.key = Key();
+				freePostings.push_back(position);
+			}
+			return true;
+		}
+		
+		void clear()
+		{
+			keys.clear();
+			locations.clear();
+			std::vector<Postings>().swap(postings);
+			std::vector<boost::uint32_t>().swap(freePostings);
+		}
+		
+		// the number of values
+		std::size_t size() const
+		{
+			return locations.size();
+		}
+		
+	private:
+		
+		struct Postings
+		{
+			Key key;
+			Bitmap ids;
+		};
+		
+		// an empty value marks a free slot, see InstanceSlots
+		struct Location
+		{
+			Location() : postings(0) { }
+			
+			explicit operator bool() const { return bool(value); }
+			
+			Value value;
+			boost::uint32_t postings;
+		};
+		
+		typedef FlatTable<Key, boost::uint32_t, KeyHash, KeyEqual> Keys;
+		typedef InstanceSlots<ID, Location> Locations;
+		
+		template<typename Visitor>
+		struct VisitValue
+		{
+			VisitValue(const FlatMultimap& m, Visitor& v) : multimap(m), visitor(v) { }
+			
+			bool operator()(ID id) const
+			{
+				const Value* value = multimap.at(id);
+				return !value || visitor(id, *value);
+			}
+			
+			const FlatMultimap& multimap;
+			Visitor& visitor;
+		};
+		
+		// the postings of keys that lost all their values are used again
+		boost::uint32_t newPostings(const Key& key)
+		{
+			boost::uint32_t position;
+			if(freePostings.empty())
+			{
+				position = postings.size();
+				postings.push_back(Postings());
+			}
+			else
+			{
+				position = freePostings.back();
+				freePostings.pop_back();
+			}
+			postings[position].key = key;
+			return position;
+		}
+		
+		std::vector<Postings> postings;
+		std::vector<boost::uint32_t> freePostings;
+		Keys keys;
+		Locations locations;
+};
+
+#endif /* FLAT_MULTIMAP_H */
@@ -0,0 +1,204 @@
+#ifndef FLAT_TABLE_H
+#define FLAT_TABLE_H
+
+#include <cstddef>
+#include <vector>
+#include <utility>
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+// Open addressing hash map in the style of Swiss tables. Entries sit in one array of slots that come in groups of 16,
+// each slot with a control byte holding 7 bits of the hash of its key or marking it empty or deleted.
+// A probe compares the control bytes of a whole group at once (with SSE2 where there is SSE2) and only looks at
+// the keys whose bits match, so most lookups touch one group of control bytes and one entry.
+template<typename Key, typename Mapped, class Hash, class Equal>
+class FlatTable
+{
+	public:
+		
+		typedef std::pair<Key, Mapped> Entry;
+		
+		FlatTable() : used(0), deleted(0) { }
+		
+		// NULL if key is not there
+		const Entry* find(const Key& key) const
+		{
+			if(used == 0)
+				return NULL;
+			
+			std::size_t hash = mix(Hash()(key));
+			std::size_t mask = slots.size() / width - 1;
+			std::size_t group = (hash >> 7) & mask;
+			for(std::size_t step = 1; ; step++)
+			{
+				for(unsigned int matches = match(group, tag(hash)); matches != 0; matches &= matches - 1)
+				{
+					const Entry& entry(slots[group * width + lowestBit(matches)]);
+					if(Equal()(entry.first, key))
+						return &entry;
+				}
+				// an insert would have used the empty slot, so key is not further on
+				if(match(group, empty) != 0)
+					return NULL;
+				group = (group + step) & mask;
+			}
+		}
+		
+		Entry* find(const Key& key)
+		{
+			return const_cast<Entry*>(static_cast<const FlatTable*>(this)->find(key));
+		}
+		
+		// the entry of key and true if it is new, the entry that is there already and false otherwise
+		std::pair<Entry*, bool> insert(const Key& key, const Mapped& mapped)
+		{
+			Entry* existing = find(key);
+			if(existing)
+				return std::make_pair(existing, false);
+			
+			// at most 7/8 of the slots are taken, grow when half of them hold entries and otherwise only drop the deleted ones
+			if((used + deleted + 1) * 8 > slots.size() * 7)
+				resize(slots.empty() ? width : (used + 1) * 2 > slots.size() ? slots.size() * 2 : slots.size());
+			
+			return std::make_pair(&insertNew(Entry(key, mapped)), true);
+		}
+		
+		bool erase(const Key& key)
+		{
+			const Entry* entry = find(key);
+			if(!entry)
+				return false;
+			
+			std::size_t slot = entry - &slots[0];
+			// searches stop at an empty slot, which only keeps finding everything if the group had one already
+			if(match(slot / width, empty) != 0)
+				controls[slot] = empty;
+			else
+			{
+				controls[slot] = removed;
+				deleted++;
+			}
+			slots[slot] = Entry();
+			used--;
+			return true;
+		}
+		
+		void clear()
+		{
+			std::vector<signed char>().swap(controls);
+			std::vector<Entry>().swap(slots);
+			used = 0;
+			deleted = 0;
+		}
+		
+		std::size_t size() const
+		{
+			return used;
+		}
+		
+	private:
+		
+		static const std::size_t width = 16;
+		static const signed char empty = -128;
+		static const signed char removed = -2;
+		
+		// pointer hashes have their low bits zeroed by alignment, and the bits of the hash are split into the group and the tag
+		static std::size_t mix(std::size_t hash)
+		{
+			unsigned long long mixed = hash;
+			mixed ^= mixed >> 33;
+			mixed *= 0xff51afd7ed558ccdULL;
+			mixed ^= mixed >> 33;
+			return static_cast<std::size_t>(mixed);
+		}
+		
+		static signed char tag(std::size_t hash)
+		{
+			return static_cast<signed char>(hash & 0x7f);
+		}
+		
+		static unsigned int lowestBit(unsigned int bits)
+		{
+			#ifdef __GNUC__
+				return __builtin_ctz(bits);
+			#else
+				unsigned int bit = 0;
+				while(!(bits & 1))
+				{
+					bits >>= 1;
+					bit++;
+				}
+				return bit;
+			#endif
+		}
+		
+		// a bit for every slot of group whose control byte is control
+		unsigned int match(std::size_t group, signed char control) const
+		{
+			#ifdef __SSE2__
+				__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&controls[group * width]));
+				return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(control)));
+			#else
+				unsigned int bits = 0;
+				for(std::size_t i = 0; i < width; i++)
+					if(controls[group * width + i] == control)
+						bits |= 1u << i;
+				return bits;
+			#endif
+		}
+		
+		// a bit for every empty or deleted slot of group, those are the control bytes with the sign bit set
+		unsigned int matchFree(std::size_t group) const
+		{
+			#ifdef __SSE2__
+				return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&controls[group * width])));
+			#else
+				unsigned int bits = 0;
+				for(std::size_t i = 0; i < width; i++)
+					if(controls[group * width + i] < 0)
+						bits |= 1u << i;
+				return bits;
+			#endif
+		}
+		
+		// entry must not be there and a slot must be free
+		Entry& insertNew(const Entry& entry)
+		{
+			std::size_t hash = mix(Hash()(entry.first));
+			std::size_t mask = slots.size() / width - 1;
+			std::size_t group = (hash >> 7) & mask;
+			unsigned int free;
+			for(std::size_t step = 1; (free = matchFree(group)) == 0; step++)
+				group = (group + step) & mask;
+			
+			std::size_t slot = group * width + lowestBit(free);
+			if(controls[slot] == removed)
+				deleted--;
+			controls[slot] = tag(hash);
+			slots[slot] = entry;
+			used++;
+			return slots[slot];
+		}
+		
+		void resize(std::size_t count)
+		{
+			std::vector<signed char> oldControls(count, static_cast<signed char>(empty));
+			std::vector<Entry> oldSlots(count);
+			oldControls.swap(controls);
+			oldSlots.swap(slots);
+			used = 0;
+			deleted = 0;
+			
+			for(std::size_t i = 0; i < oldSlots.size(); i++)
+				if(oldControls[i] >= 0)
+					insertNew(oldSlots[i]);
+		}
+		
+		std::vector<signed char> controls;
+		std::vector<Entry> slots;
+		std::size_t used;
+		std::size_t deleted;
+};
+
+#endif /* FLAT_TABLE_H */
@@ -1,12 +1,9 @@
-
 #ifndef HASH_INDEX_H
 #define HASH_INDEX_H
 
-#include <string>
-#include <boost/smart_ptr.hpp>
-#include <boost/foreach.hpp>
-#include <boost/bimap.hpp>
-#include <boost/bimap/unordered_multiset_of.hpp>
+#include <cstddef>
+#include <boost/functional/hash.hpp>
+#include <boost/bimap/tags/support/value_type_of.hpp>
 
 template<
 	typename ModelClassPtr,
@@ -18,92 +15,49 @@ template<
 >
 class HashIndex;
 
-#include "Transaction.h"
-#include "InstanceNotFoundException.h"
 #include "ModelStore.h"
-#include "Index.h"
-#include "KeyOperators.h"
+#include "Transaction.h"
+#include "StorageIndex.h"
+#include "FlatMultimap.h"
+#include "Bitmap.h"
 
+// index kept in flat hash tables, the ids of a key are in one bitmap so lookups walk them in order without chasing nodes
+// and hand the bitmaps out to be intersected with those of other fields
 template<
 	typename ModelClassPtr,
 	typename KeyType,
 	class KeyHashFunctor,
 	class EqualKey
 >
-class HashIndex : public Index<ModelClassPtr>, public Lockable
+class HashIndex : public StorageIndex< ModelClassPtr, KeyType, FlatMultimap< KeyType, typename ModelStore<ModelClassPtr>::ID, ModelClassPtr, KeyHashFunctor, EqualKey > >
 {
 	public:
 		
-		typedef ModelClassPtr ValueType;
-		
-		typedef boost::bimap<
-			boost::bimaps::unordered_multiset_of< KeyType, KeyHashFunctor, EqualKey >,
-			boost::bimaps::unordered_multiset_of< ModelClassPtr, value_key_operators::hash<ModelClassPtr>, value_key_operators::equality<ModelClassPtr> >
-		> Multimap;
-		typedef typename Multimap::value_type IndexElementType;
+		typedef StorageIndex< ModelClassPtr, KeyType, FlatMultimap< KeyType, typename ModelStore<ModelClassPtr>::ID, ModelClassPtr, KeyHashFunctor, EqualKey > > ParentClass;
+		typedef typename ParentClass::Visitor Visitor;
+		typedef typename ParentClass::VisitInstance VisitInstance;
 		
-		typedef typename ModelStore<ModelClassPtr>::ModelListPtr ModelListPtr;
-		
-		HashIndex() { };
+		HashIndex(std::size_t position = 0, std::size_t count = 1) : ParentClass(position, count) { };
 		virtual ~HashIndex() { };
 		
-		virtual bool matchKeyType(const boost::any& key)
-		{
-			return key.type() == typeid(KeyType);
-		}
-		
-		virtual void store(FieldId id, const boost::any& key, ModelClassPtr instance)
-		{
-			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getExclusiveLock(this);
-			
-			index.right.erase(instance);
-			index.insert(IndexElementType(boost::any_cast<const KeyType>(key), instance));
-		}
-		
-		virtual void erase(ModelClassPtr instance)
-		{
-			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getExclusiveLock(this);
-			
-			index.right.erase(instance);
-		}
+		virtual bool isBitmap() const { return true; }
 		
-		virtual void clear()
-		{
-			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getExclusiveLock(this);
-			
-			index.right.clear();
-		}
-		
-		virtual ModelListPtr getList(const boost::any& key) const
+		virtual Bitmap getBitmap(const boost::any& key) const
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
 			transaction->getSharedLock(this);
 			
-			ModelListPtr list(new typename ModelListPtr::element_type);
-			
-			BOOST_FOREACH(typename Multimap::left_const_reference& i, index.left.equal_range(boost::any_cast<const KeyType>(key)))
-				list->push_back(i.second);
-			
-			return list;
+			const Bitmap* bitmap = this->storage.find(boost::any_cast<const KeyType&>(key));
+			return bitmap ? *bitmap : Bitmap();
 		}
 		
-		virtual ModelClassPtr get(const boost::any& key) const
+		virtual bool forEachInstance(const Bitmap& ids, const Visitor& visitor) const
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
 			transaction->getSharedLock(this);
 			
-			typename Multimap::left_const_iterator it = index.left.find(boost::any_cast<const KeyType>(key));
-			if(it == index.left.end())
-				throw InstanceNotFoundException(getClassName<typename ModelClassPtr::element_type>(), boost::lexical_cast<std::string>(boost::any_cast<const KeyType>(key)));
-			return it->second;
+			return this->storage.forEach(ids, VisitInstance(visitor));
 		}
-		
-	protected:
-		
-		Multimap index;
 };
 
 #endif /* HASH_INDEX_H */
@@ -0,0 +1,29 @@
+#ifndef ID_ALLOCATOR_H
+#define ID_ALLOCATOR_H
+
+#include <cstddef>
+
+// hands out the ids of the instances in one shard of a ModelStore, the ids of a shard are congruent to its position
+// modulo the shard count so lookups by id know where to look, it is only used under the exclusive lock of its shard
+class IdAllocator
+{
+	public:
+		
+		typedef std::size_t ID;
+		
+		virtual ~IdAllocator() { };
+		
+		// an id that is not in use
+		virtual ID allocate() = 0;
+		// id is not in use any more and may be handed out again
+		virtual void release(ID id) = 0;
+		// id is in use without being allocated here (like an imported one), it is not handed out until it is released
+		virtual void reserve(ID id) = 0;
+		// every id is free again
+		virtual void clear() = 0;
+		
+		// a new empty allocator of the same kind for the shard at position of count shards
+		virtual IdAllocator* create(std::size_t position, std::size_t count) const = 0;
+};
+
+#endif /* ID_ALLOCATOR_H */
@@ -2,7 +2,11 @@
 #ifndef INDEX_H
 #define INDEX_H
 
+#include <typeinfo>
+#include <stdexcept>
+#include <limits>
 #include <boost/any.hpp>
+#include <boost/function.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <boost/tuple/tuple_comparison.hpp>
 #include <boost/tuple/tuple_io.hpp>
@@ -11,6 +15,18 @@ template<typename ModelClassPtr>
 class Index;
 
 #include "Field.h"
+#include "Page.h"
+#include "Bitmap.h"
+
+namespace IndexPolicies
+{
+	enum IndexPolicy
+	{
+		None = 0,
+		// at most one instance per key, see UniqueIndex
+		Unique = 1 << 0,
+	};
+}
 
 template<typename ModelClassPtr>
 class Index
@@ -18,11 +34,14 @@ class Index
 	public:
 		
 		typedef typename ModelStore<ModelClassPtr>::ModelListPtr ModelListPtr;
+		// returns false to stop
+		typedef boost::function<bool(const ModelClassPtr&)> Visitor;
 		
 		Index() { };
 		virtual ~Index() { };
 		
 		virtual bool matchKeyType(const boost::any& key) = 0;
+		virtual const std::type_info& getKeyType() const = 0;
 		
 		virtual void store(FieldId id, const boost::any& key, ModelClassPtr instance) = 0;
 		virtual void erase(ModelClassPtr instance) = 0;
@@ -31,10 +50,56 @@ class Index
 		
 		virtual ModelListPtr getList(const boost::any& key) const = 0;
 		virtual ModelClassPtr get(const boost::any& key) const = 0;
+		// like get() but returns an empty pointer instead of throwing when nothing matches
+		virtual ModelClassPtr find(const boost::any& key) const = 0;
+		// calls visitor with the instances matching key without copying them into a list, under a shared lock on the index
+		// so visitor must not change them in a way that updates this index, returns false if visitor stopped early
+		virtual bool forEach(const boost::any& key, const Visitor& visitor) const = 0;
+		// how many instances match key, to plan lookups with
+		virtual std::size_t count(const boost::any& key) const = 0;
+		// instance matches key
+		virtual bool contains(const boost::any& key, const ModelClassPtr& instance) const = 0;
+		// at most limit of the instances matching key from token on, see PageToken
+		virtual Page<ModelClassPtr> getPage(const boost::any& key, const PageToken& token, std::size_t limit) const = 0;
+		
+		// see Lockable::setOptimisticReadsEnabled()
+		virtual void setOptimisticReadsEnabled(bool enabled) = 0;
+		// see Lockable::setLockPolicy()
+		virtual void setLockPolicy(LockPolicies::LockPolicy policy) = 0;
+		virtual void setLockStatisticsEnabled(bool enabled) = 0;
+		// see Lockable::setLockName()
+		virtual void setLockName(const std::string& name) = 0;
+		virtual LockStatistics getLockStatistics() const = 0;
 		
 		virtual bool isRelationIndex() const { return false; }
 		virtual bool isCompoundIndex() const { return false; }
 		
+		// lookups by the order of the keys, only ordered indexes have them, see OrderedIndex
+		virtual bool isOrdered() const { return false; }
+		// the instances with keys from first to last, both included, in key order
+		virtual ModelListPtr getRange(const boost::any&, const boost::any&) const { throw std::runtime_error("Index is not ordered"); }
+		// at most limit instances whose keys start with prefix, in key order: string keys by a shorter string,
+		// compound keys by a tuple of their first fields
+		virtual ModelListPtr getPrefixList(const boost::any&, std::size_t) const { throw std::runtime_error("Index is not ordered"); }
+		ModelListPtr getPrefixList(const boost::any& prefix) const
+		{
+			return getPrefixList(prefix, std::numeric_limits<std::size_t>::max());
+		}
+		// the instance with the lowest or the highest key, an empty pointer if there are none
+		virtual ModelClassPtr findFirst() const { throw std::runtime_error("Index is not ordered"); }
+		virtual ModelClassPtr findLast() const { throw std::runtime_error("Index is not ordered"); }
+		// calls visitor with the instances in key order, or in reverse, until it returns false
+		virtual bool forEachInOrder(const Visitor&, bool) const { throw std::runtime_error("Index is not ordered"); }
+		
+		// lookups by the ids of the instances, indexes keeping a bitmap of ids for every key have them, see HashIndex
+		virtual bool isBitmap() const { return false; }
+		// the store ids of the instances matching key, to combine with the bitmaps of other keys and fields
+		virtual Bitmap getBitmap(const boost::any&) const { throw std::runtime_error("Index is not a bitmap index"); }
+		// calls visitor with the instances of the ids the index holds in the order of the ids, one at a time as the ids are visited
+		// so nothing is copied and visitor can stop after the first few, returns false if it did;
+		// sharded indexes leave it out, ModelStore::forEach() visits ids of every shard
+		virtual bool forEachInstance(const Bitmap&, const Visitor&) const { throw std::runtime_error("Index is not a bitmap index"); }
+		
 		// only used with compound indexes
 		template<typename... Fields>
 		ModelListPtr getList(typename Fields::type... values)
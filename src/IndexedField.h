@@ -11,6 +11,7 @@ class IndexedField;
 
 #include "Model.h"
 #include "HashIndex.h"
+#include "UniqueKeyException.h"
 
 template<typename FieldType, size_t fieldId, typename ModelClassPtr, FieldPolicies::FieldPolicy fieldPolicies>
 class IndexedField : public Field<FieldType, fieldId, ModelClassPtr, fieldPolicies>
@@ -24,17 +25,30 @@ class IndexedField : public Field<FieldType, fieldId, ModelClassPtr, fieldPolici
 		: parentClass(v)
 		{ }
 		
-		virtual void registerField() const
-		{ }
+		virtual bool isIndexed() const
+		{
+			return true;
+		}
 		
 		virtual const FieldType& operator=(const FieldType& rhs)
 		{
-			// TODO: it may be a bit too expensive to lock on assignment, is it really necessary?
+			// only this instance stays locked until the transaction ends, each index it is in is locked only while it is updated
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getExclusiveLock(static_cast<Lockable*>(&ModelStoreGetter<ModelClassPtr>()()));
+			ModelStoreGetter<ModelClassPtr>()().lockInstance(this->getModel());
 			
+			FieldType previous(this->var);
 			this->var = rhs;
-			updateIndex();
+			try
+			{
+				updateIndex();
+			}
+			catch(const UniqueKeyException&)
+			{
+				// put the indexes updated before the unique one back
+				this->var = previous;
+				updateIndex();
+				throw;
+			}
 			
 			return this->var;
 		}
@@ -0,0 +1,219 @@
+#ifndef INSTANCE_SLOTS_H
+#define INSTANCE_SLOTS_H
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <boost/foreach.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+
+// Values of one shard by id. The ids of the shard, congruent to its position modulo the shard count, index a contiguous
+// array of slots, so a lookup is one array access and a scan walks memory in order instead of chasing hash nodes.
+// Ids the array cannot hold (ids of other shards and ids far beyond its end, both only come from imports) go to a hash map.
+// Empty values mark free slots, so they cannot be stored.
+template<typename ID, typename ValueType>
+class InstanceSlots
+{
+	private:
+		
+		typedef boost::unordered_map<ID, ValueType> Sparse;
+		
+	public:
+		
+		struct Entry
+		{
+			ID id;
+			ValueType value;
+		};
+		
+		class const_iterator : public boost::iterator_facade<const_iterator, const Entry, boost::forward_traversal_tag>
+		{
+			public:
+				
+				const_iterator() : slots(NULL), slot(0) { }
+				const_iterator(const InstanceSlots* s, std::size_t sl, typename Sparse::const_iterator sp) : slots(s), slot(sl), sparse(sp) { skipFree(); }
+				
+			private:
+				
+				friend class boost::iterator_core_access;
+				
+				void skipFree()
+				{
+					while(slot < slots->dense.size() && !slots->dense[slot])
+						slot++;
+					
+					if(slot < slots->dense.size())
+					{
+						current.id = slot * slots->count + slots->position;
+						current.value = slots->dense[slot];
+					}
+					else if(sparse != slots->sparse.end())
+					{
+						current.id = sparse->first;
+						current.value = sparse->second;
+					}
+				}
+				
+				void increment()
+				{
+					if(slot < slots->dense.size())
+						slot++;
+					else
+						++sparse;
+					skipFree();
+				}
+				
+				bool equal(const const_iterator& other) const
+				{
+					return slot == other.slot && sparse == other.sparse;
+				}
+				
+				const Entry& dereference() const
+				{
+					return current;
+				}
+				
+				const InstanceSlots* slots;
+				std::size_t slot;
+				typename Sparse::const_iterator sparse;
+				Entry current;
+		};
+		typedef const_iterator iterator;
+		
+		InstanceSlots(std::size_t p, std::size_t c) : position(p), count(c), used(0) { }
+		
+		const_iterator begin() const { return const_iterator(this, 0, sparse.begin()); }
+		const_iterator end() const { return const_iterator(this, dense.size(), sparse.end()); }
+		
+		// an empty value if id is free
+		ValueType find(ID id) const
+		{
+			const ValueType* value = at(id);
+			return value ? *value : ValueType();
+		}
+		
+		// like find() without copying the value, NULL if id is free
+		const ValueType* at(ID id) const
+		{
+			std::size_t slot;
+			if(denseSlot(id, slot) && slot < dense.size() && dense[slot])
+				return &dense[slot];
+			if(sparse.empty())
+				return NULL;
+			
+			typename Sparse::const_iterator it = sparse.find(id);
+			return it == sparse.end() ? NULL : &it->second;
+		}
+		
+		// false if id is taken already
+		bool insert(ID id, const ValueType& value)
+		{
+			if(find(id))
+				return false;
+			
+			std::size_t slot;
+			if(denseSlot(id, slot) && slot < dense.size() + maxGap)
+			{
+				if(slot >= dense.size())
+					dense.resize(slot + 1);
+				dense[slot] = value;
+			}
+			else
+				sparse[id] = value;
+			used++;
+			return true;
+		}
+		
+		bool erase(ID id)
+		{
+			std::size_t slot;
+			if(denseSlot(id, slot) && slot < dense.size() && dense[slot])
+			{
+				dense[slot] = ValueType();
+				// the free slots at the end are handed out again first, so there is no need to keep them
+				while(!dense.empty() && !dense.back())
+					dense.pop_back();
+			}
+			else if(sparse.erase(id) == 0)
+				return false;
+			used--;
+			return true;
+		}
+		
+		void clear()
+		{
+			std::vector<ValueType>().swap(dense);
+			sparse.clear();
+			used = 0;
+		}
+		
+		std::size_t size() const
+		{
+			return used;
+		}
+		
+		// the shard the slots hold the ids of and the shard count
+		std::size_t getPosition() const
+		{
+			return position;
+		}
+		
+		std::size_t getCount() const
+		{
+			return count;
+		}
+		
+		// appends at most limit entries with ids from first on to entries, the lowest ones in id order
+		void collect(ID first, std::size_t limit, std::vector<Entry>& entries) const
+		{
+			std::size_t start = entries.size();
+			
+			std::size_t slot = first <= position ? 0 : (first - position + count - 1) / count;
+			for(; slot < dense.size() && entries.size() - start < limit; slot++)
+				if(dense[slot])
+					entries.push_back(entry(slot * count + position, dense[slot]));
+			
+			// ids in the hash map can be anywhere between the ids in the array
+			BOOST_FOREACH(const typename Sparse::value_type& i, sparse)
+				if(i.first >= first)
+					entries.push_back(entry(i.first, i.second));
+			std::sort(entries.begin() + start, entries.end(), lowerId);
+			if(entries.size() - start > limit)
+				entries.resize(start + limit);
+		}
+		
+		static bool lowerId(const Entry& a, const Entry& b)
+		{
+			return a.id < b.id;
+		}
+		
+	private:
+		
+		// slots beyond the end of the array that an id may skip before it goes to the hash map instead
+		static const std::size_t maxGap = 65536;
+		
+		static Entry entry(ID id, const ValueType& value)
+		{
+			Entry e;
+			e.id = id;
+			e.value = value;
+			return e;
+		}
+		
+		bool denseSlot(ID id, std::size_t& slot) const
+		{
+			if(id % count != position)
+				return false;
+			slot = id / count;
+			return true;
+		}
+		
+		const std::size_t position;
+		const std::size_t count;
+		std::vector<ValueType> dense;
+		Sparse sparse;
+		std::size_t used;
+};
+
+#endif /* INSTANCE_SLOTS_H */
@@ -2,8 +2,11 @@
 #ifndef KEY_OPERATORS_H
 #define KEY_OPERATORS_H
 
+#include <string>
 #include <boost/type_traits/has_dereference.hpp>
 #include <boost/mpl/if.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
 
 template<typename ValueType>
 struct value_hash_combine { inline void operator()(std::size_t& seed, const ValueType& value) { boost::hash_combine(seed, value); } };
@@ -18,6 +21,17 @@ size_t key_hash(const key_type & key)
 	return boost::hash<key_type>()(key);
 }
 
+// picks one of count shards for key, the hash is mixed first since pointer hashes have their low bits zeroed by alignment
+template<typename key_type>
+size_t key_shard(const key_type & key, size_t count)
+{
+	unsigned long long hash = key_hash(key);
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return hash % count;
+}
+
 namespace pointer_key_operators
 {
 	template<typename key_type>
@@ -122,4 +136,79 @@ namespace value_key_operators
 	};
 }
 
+namespace ordered_key_operators
+{
+	// compares a key with a prefix of it, a shorter string or a tuple of the first fields of a compound key,
+	// negative if the key is before the prefix, zero if it starts with the prefix and positive if it is after the prefix
+	inline int compare_prefix(const std::string& key, const std::string& prefix)
+	{
+		return key.compare(0, prefix.size(), prefix);
+	}
+	
+	inline int compare_prefix(const boost::tuples::null_type&, const boost::tuples::null_type&)
+	{
+		return 0;
+	}
+	
+	template<class KeyHead, class KeyTail>
+	inline int compare_prefix(const boost::tuples::cons<KeyHead, KeyTail>&, const boost::tuples::null_type&)
+	{
+		return 0;
+	}
+	
+	template<class KeyHead, class KeyTail, class PrefixHead, class PrefixTail>
+	inline int compare_prefix(const boost::tuples::cons<KeyHead, KeyTail>& key, const boost::tuples::cons<PrefixHead, PrefixTail>& prefix)
+	{
+		if(key.get_head() < prefix.get_head())
+			return -1;
+		if(prefix.get_head() < key.get_head())
+			return 1;
+		return compare_prefix(key.get_tail(), prefix.get_tail());
+	}
+	
+	// bounds of the compound keys starting with prefix in the order of operator<, for ordered bimap views' range()
+	template<typename prefix_type>
+	struct prefix_lower_bound
+	{
+		public:
+			prefix_lower_bound(const prefix_type& p) : prefix(p) { }
+			
+			template<typename key_type>
+			bool operator()(const key_type& key) const
+			{
+				return compare_prefix(key, prefix) >= 0;
+			}
+			
+		private:
+			const prefix_type& prefix;
+	};
+	
+	template<typename prefix_type>
+	struct prefix_upper_bound
+	{
+		public:
+			prefix_upper_bound(const prefix_type& p) : prefix(p) { }
+			
+			template<typename key_type>
+			bool operator()(const key_type& key) const
+			{
+				return compare_prefix(key, prefix) <= 0;
+			}
+			
+		private:
+			const prefix_type& prefix;
+	};
+	
+	// keys neither of which is before the other
+	template<typename key_type, class Compare>
+	struct equivalence
+	{
+		public:
+			bool operator()(const key_type& key1, const key_type& key2) const
+			{
+				return !Compare()(key1, key2) && !Compare()(key2, key1);
+			}
+	};
+}
+
 #endif /* KEY_OPERATORS_H */
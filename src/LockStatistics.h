@@ -0,0 +1,62 @@
+#ifndef LOCK_STATISTICS_H
+#define LOCK_STATISTICS_H
+
+#include <algorithm>
+#include <boost/chrono.hpp>
+#include <json/json.h>
+
+#include "ModeLock.h"
+
+// what a Lockable went through since its statistics were enabled or reset
+struct LockStatistics
+{
+	typedef boost::chrono::nanoseconds Duration;
+	
+	LockStatistics() : contended(0), failed(0), upgrades(0), totalWait(0), maxWait(0), totalHold(0)
+	{
+		for(unsigned int i = 0; i < LockModes::Count; i++)
+			acquisitions[i] = 0;
+	}
+	
+	LockStatistics& operator+=(const LockStatistics& rhs)
+	{
+		for(unsigned int i = 0; i < LockModes::Count; i++)
+			acquisitions[i] += rhs.acquisitions[i];
+		contended += rhs.contended;
+		failed += rhs.failed;
+		upgrades += rhs.upgrades;
+		totalWait += rhs.totalWait;
+		maxWait = std::max(maxWait, rhs.maxWait);
+		totalHold += rhs.totalHold;
+		return *this;
+	}
+	
+	Json::Value toJson() const
+	{
+		Json::Value json;
+		for(unsigned int i = LockModes::IntentionShared; i < LockModes::Count; i++)
+			json["acquisitions"][LockModes::toString(LockModes::LockMode(i))] = Json::UInt64(acquisitions[i]);
+		json["contended"] = Json::UInt64(contended);
+		json["failed"] = Json::UInt64(failed);
+		json["upgrades"] = Json::UInt64(upgrades);
+		json["totalWaitNs"] = Json::Int64(totalWait.count());
+		json["maxWaitNs"] = Json::Int64(maxWait.count());
+		json["totalHoldNs"] = Json::Int64(totalHold.count());
+		return json;
+	}
+	
+	// granted requests by mode, conversions count for the mode they converted to
+	unsigned long long acquisitions[LockModes::Count];
+	// requests that had to wait and got the lock in the end
+	unsigned long long contended;
+	// requests that gave up waiting
+	unsigned long long failed;
+	// attempts to convert a held lock to a stronger mode
+	unsigned long long upgrades;
+	Duration totalWait;
+	Duration maxWait;
+	// from the first lock to the last unlock of every holder
+	Duration totalHold;
+};
+
+#endif /* LOCK_STATISTICS_H */
@@ -1,17 +1,288 @@
+#include <stdexcept>
+#include <boost/thread/mutex.hpp>
+
 #include "Lockable.h"
+#include "QueueLock.h"
+#include "BigReaderLock.h"
+#include "PhaseFairLock.h"
 #include "Transaction.h"
 
-Lockable::Lockable()
+using namespace LockModes;
+
+namespace
+{
+	// rows are requested modes, columns are modes held by others
+	const bool compatibility[Count][Count] =
+	{
+		//           None   IS     IX     S      SIX    X
+		/* None */ { true,  true,  true,  true,  true,  true  },
+		/* IS   */ { true,  true,  true,  true,  true,  false },
+		/* IX   */ { true,  true,  true,  false, false, false },
+		/* S    */ { true,  true,  false, true,  false, false },
+		/* SIX  */ { true,  true,  false, false, false, false },
+		/* X    */ { true,  false, false, false, false, false },
+	};
+	
+	const LockMode combination[Count][Count] =
+	{
+		/* None */ { None, IntentionShared, IntentionExclusive, Shared, SharedIntentionExclusive, Exclusive },
+		/* IS   */ { IntentionShared, IntentionShared, IntentionExclusive, Shared, SharedIntentionExclusive, Exclusive },
+		/* IX   */ { IntentionExclusive, IntentionExclusive, IntentionExclusive, SharedIntentionExclusive, SharedIntentionExclusive, Exclusive },
+		/* S    */ { Shared, Shared, SharedIntentionExclusive, Shared, SharedIntentionExclusive, Exclusive },
+		/* SIX  */ { SharedIntentionExclusive, SharedIntentionExclusive, SharedIntentionExclusive, SharedIntentionExclusive, SharedIntentionExclusive, Exclusive },
+		/* X    */ { Exclusive, Exclusive, Exclusive, Exclusive, Exclusive, Exclusive },
+	};
+}
+
+namespace
 {
+	boost::mutex namedLockablesMutex;
+	Lockable::NamedLockables namedLockables;
 	
+	ModeLock* createLock(LockPolicies::LockPolicy policy)
+	{
+		switch(policy)
+		{
+			case LockPolicies::BigReader:
+				return new BigReaderLock;
+			case LockPolicies::PhaseFair:
+				return new PhaseFairLock;
+			default:
+				return new QueueLock;
+		}
+	}
+}
+
+Lockable::Lockable(LockPolicies::LockPolicy policy, bool lockHistory) : modeLock(createLock(policy)), lockPolicy(policy), lockVersion(0), lockHistoryEnabled(lockHistory), lockHistoryUsed(lockHistory), optimisticReadsEnabled(true), lockStatisticsEnabled(false), releaseCallbacksWaiting(false)
+{
 };
 
+Lockable::Counters::Counters() : contended(0), failed(0), upgrades(0), totalWait(0), maxWait(0), totalHold(0)
+{
+	for(unsigned int i = 0; i < Count; i++)
+		acquisitions[i] = 0;
+}
+
 Lockable::~Lockable()
 {
-	Transaction::removeLockable(this);
+	if(!lockName.empty())
+	{
+		boost::lock_guard<boost::mutex> guard(namedLockablesMutex);
+		namedLockables.erase(lockName);
+	}
+	
+	if(lockHistoryUsed)
+		Transaction::removeLockable(this);
+	
+	// once nothing refers to this any more, whoever waits for it gets to find out it is gone
+	runReleaseCallbacks();
+}
+
+bool Lockable::compatible(LockMode requested, LockMode held)
+{
+	return compatibility[requested][held];
+}
+
+LockMode Lockable::combine(LockMode a, LockMode b)
+{
+	return combination[a][b];
+}
+
+bool Lockable::queuesBehind(LockMode mode, Ticket ticket, LockMode waitingMode, Ticket waitingTicket) const
+{
+	return modeLock->queuesBehind(mode, ticket, waitingMode, waitingTicket);
+}
+
+bool Lockable::tryLock(LockMode held, LockMode mode) const
+{
+	bool statistics = lockStatisticsEnabled.load(boost::memory_order_relaxed);
+	if(statistics && held != None)
+		counters.upgrades.fetch_add(1, boost::memory_order_relaxed);
+	
+	if(!modeLock->tryLock(held, mode))
+		return false;
+	
+	if(statistics)
+		counters.acquisitions[mode].fetch_add(1, boost::memory_order_relaxed);
+	if(mode == Exclusive && held != Exclusive)
+		lockVersion++;
+	return true;
+}
+
+bool Lockable::lock(LockMode held, LockMode mode, Ticket ticket, const boost::chrono::milliseconds& timeout) const
+{
+	if(!lockStatisticsEnabled.load(boost::memory_order_relaxed))
+	{
+		if(!modeLock->lock(held, mode, ticket, timeout))
+			return false;
+	}
+	else
+	{
+		boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+		bool acquired = modeLock->lock(held, mode, ticket, timeout);
+		long long wait = boost::chrono::duration_cast<LockStatistics::Duration>(boost::chrono::steady_clock::now() - start).count();
+		
+		counters.totalWait.fetch_add(wait, boost::memory_order_relaxed);
+		long long maxWait = counters.maxWait.load(boost::memory_order_relaxed);
+		while(wait > maxWait && !counters.maxWait.compare_exchange_weak(maxWait, wait, boost::memory_order_relaxed));
+		
+		if(!acquired)
+		{
+			counters.failed.fetch_add(1, boost::memory_order_relaxed);
+			return false;
+		}
+		counters.contended.fetch_add(1, boost::memory_order_relaxed);
+		counters.acquisitions[mode].fetch_add(1, boost::memory_order_relaxed);
+	}
+	
+	if(mode == Exclusive && held != Exclusive)
+		lockVersion++;
+	return true;
+}
+
+void Lockable::unlock(LockMode held, LockMode mode) const
+{
+	// before the next exclusive holder can change it again
+	if(held == Exclusive && mode != Exclusive)
+		lockVersion++;
+	modeLock->unlock(held, mode);
+	
+	if(releaseCallbacksWaiting.load())
+		runReleaseCallbacks();
+}
+
+void Lockable::notifyOnRelease(const boost::function<void()>& callback) const
+{
+	boost::lock_guard<boost::mutex> guard(releaseCallbacksMutex);
+	// a release that happens after this either sees the flag or happens before the caller's next attempt
+	releaseCallbacksWaiting.store(true);
+	releaseCallbacks.push_back(callback);
+}
+
+void Lockable::runReleaseCallbacks() const
+{
+	ReleaseCallbacks callbacks;
+	{
+		boost::lock_guard<boost::mutex> guard(releaseCallbacksMutex);
+		callbacks.swap(releaseCallbacks);
+		releaseCallbacksWaiting.store(false);
+	}
+	
+	// outside the mutex, the callbacks may well try to lock this again
+	BOOST_FOREACH(const boost::function<void()>& callback, callbacks)
+		callback();
+}
+
+void Lockable::setLockHistoryEnabled(bool enabled)
+{
+	lockHistoryEnabled = enabled;
+	lockHistoryUsed = lockHistoryUsed || enabled;
+}
+
+bool Lockable::isLockHistoryEnabled() const
+{
+	return lockHistoryEnabled;
+}
+
+void Lockable::setLockName(const std::string& name)
+{
+	boost::lock_guard<boost::mutex> guard(namedLockablesMutex);
+	if(name == lockName)
+		return;
+	
+	if(!name.empty() && !namedLockables.insert(NamedLockables::value_type(name, this)).second)
+		throw std::runtime_error("Lock name '" + name + "' is already in use");
+	if(!lockName.empty())
+		namedLockables.erase(lockName);
+	lockName = name;
+}
+
+const std::string& Lockable::getLockName() const
+{
+	return lockName;
+}
+
+const Lockable* Lockable::findLockable(const std::string& name)
+{
+	boost::lock_guard<boost::mutex> guard(namedLockablesMutex);
+	NamedLockables::const_iterator it = namedLockables.find(name);
+	return it != namedLockables.end() ? it->second : NULL;
+}
+
+Lockable::NamedLockables Lockable::getNamedLockables()
+{
+	boost::lock_guard<boost::mutex> guard(namedLockablesMutex);
+	return namedLockables;
+}
+
+Lockable::Version Lockable::getVersion() const
+{
+	return lockVersion.load();
+}
+
+void Lockable::setOptimisticReadsEnabled(bool enabled)
+{
+	optimisticReadsEnabled = enabled;
+}
+
+bool Lockable::isOptimisticReadsEnabled() const
+{
+	return optimisticReadsEnabled;
+}
+
+void Lockable::setLockPolicy(LockPolicies::LockPolicy policy)
+{
+	if(policy == lockPolicy)
+		return;
+	if(modeLock->isLocked())
+		throw std::runtime_error("Changing the lock policy of a resource in use");
+	
+	modeLock.reset(createLock(policy));
+	lockPolicy = policy;
+}
+
+LockPolicies::LockPolicy Lockable::getLockPolicy() const
+{
+	return lockPolicy;
+}
+
+void Lockable::setLockStatisticsEnabled(bool enabled)
+{
+	lockStatisticsEnabled = enabled;
+}
+
+bool Lockable::isLockStatisticsEnabled() const
+{
+	return lockStatisticsEnabled.load(boost::memory_order_relaxed);
+}
+
+LockStatistics Lockable::getLockStatistics() const
+{
+	LockStatistics statistics;
+	for(unsigned int i = 0; i < Count; i++)
+		statistics.acquisitions[i] = counters.acquisitions[i].load(boost::memory_order_relaxed);
+	statistics.contended = counters.contended.load(boost::memory_order_relaxed);
+	statistics.failed = counters.failed.load(boost::memory_order_relaxed);
+	statistics.upgrades = counters.upgrades.load(boost::memory_order_relaxed);
+	statistics.totalWait = LockStatistics::Duration(counters.totalWait.load(boost::memory_order_relaxed));
+	statistics.maxWait = LockStatistics::Duration(counters.maxWait.load(boost::memory_order_relaxed));
+	statistics.totalHold = LockStatistics::Duration(counters.totalHold.load(boost::memory_order_relaxed));
+	return statistics;
+}
+
+void Lockable::resetLockStatistics()
+{
+	for(unsigned int i = 0; i < Count; i++)
+		counters.acquisitions[i] = 0;
+	counters.contended = 0;
+	counters.failed = 0;
+	counters.upgrades = 0;
+	counters.totalWait = 0;
+	counters.maxWait = 0;
+	counters.totalHold = 0;
 }
 
-boost::shared_mutex& Lockable::getMutex() const
+void Lockable::recordHold(const LockStatistics::Duration& held) const
 {
-	return mutex;
+	counters.totalHold.fetch_add(held.count(), boost::memory_order_relaxed);
 }
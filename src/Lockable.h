@@ -1,23 +1,122 @@
-
 #ifndef LOCKABLE_H
 #define LOCKABLE_H
 
+#include <string>
+#include <vector>
 #include <boost/smart_ptr.hpp>
-#include <boost/thread/shared_mutex.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/chrono.hpp>
+#include <boost/atomic.hpp>
 #include <boost/enable_shared_from_this.hpp>
 
+#include "ModeLock.h"
+#include "LockStatistics.h"
+
+class Transaction;
+
 class Lockable : public boost::enable_shared_from_this< Lockable >
 {
 	public:
 		
-		Lockable();
+		typedef LockModes::LockMode LockMode;
+		typedef ModeLock::Ticket Ticket;
+		typedef unsigned long long Version;
+		typedef boost::unordered_map<std::string, const Lockable*> NamedLockables;
+		
+		// a resource created without lock history (like the lock of every model instance) never enters it,
+		// so it is not looked for there when it goes
+		Lockable(LockPolicies::LockPolicy policy = LockPolicies::Queue, bool lockHistory = true);
 		virtual ~Lockable();
 		
-		virtual boost::shared_mutex& getMutex() const;
+		static bool compatible(LockMode requested, LockMode held);
+		// weakest mode that allows everything both modes allow
+		static LockMode combine(LockMode a, LockMode b);
+		// true if a new request has to wait for an earlier one that is still waiting, depends on the lock policy
+		bool queuesBehind(LockMode mode, Ticket ticket, LockMode waitingMode, Ticket waitingTicket) const;
+		
+		// changes the mode the caller holds from held (None if it holds nothing) to mode if that can be done without waiting
+		bool tryLock(LockMode held, LockMode mode) const;
+		// same, but waits at most timeout, the ticket orders the request among the waiting ones
+		bool lock(LockMode held, LockMode mode, Ticket ticket, const boost::chrono::milliseconds& timeout) const;
+		// releases held or downgrades it to mode
+		void unlock(LockMode held, LockMode mode = LockModes::None) const;
+		
+		// calls callback from the thread that next releases or downgrades this (or destroys it), for callers that would rather
+		// try again later than wait, releases between a failed attempt and this call are not missed if the attempt is repeated afterwards
+		void notifyOnRelease(const boost::function<void()>& callback) const;
+		
+		// called by the transaction holding the exclusive lock right before it releases it
+		virtual void beforeExclusiveUnlock(const Transaction*) const { };
+		
+		// transactions remember what they locked so the next one started from the same place can lock it preemptively,
+		// resources a call site picks differently every time (like the shards of a store) should stay out of that history
+		void setLockHistoryEnabled(bool enabled);
+		bool isLockHistoryEnabled() const;
+		
+		// the lock history refers to named resources by name when it is saved, so it still applies after a restart,
+		// names have to be unique and an empty one removes it
+		virtual void setLockName(const std::string& name);
+		const std::string& getLockName() const;
+		// the resource with that name or NULL
+		static const Lockable* findLockable(const std::string& name);
+		static NamedLockables getNamedLockables();
+		
+		// changes every time an exclusive lock is granted or released, so it is odd while somebody holds one,
+		// optimistic transactions compare it instead of holding read locks
+		Version getVersion() const;
+		
+		// optimistic transactions release read locks on this right after using them, disabled they keep them until they end
+		virtual void setOptimisticReadsEnabled(bool enabled);
+		bool isOptimisticReadsEnabled() const;
+		
+		// picks the lock implementation, only while nobody holds or waits for the lock (like right after creating it)
+		virtual void setLockPolicy(LockPolicies::LockPolicy policy);
+		LockPolicies::LockPolicy getLockPolicy() const;
+		
+		// counts how the lock is used, off by default because every thread using the lock writes the same counters
+		virtual void setLockStatisticsEnabled(bool enabled);
+		bool isLockStatisticsEnabled() const;
+		LockStatistics getLockStatistics() const;
+		void resetLockStatistics();
+		// called by transactions when they release their last lock on this
+		void recordHold(const LockStatistics::Duration& held) const;
 		
 	private:
 		
-		mutable boost::shared_mutex mutex;
+		struct Counters
+		{
+			Counters();
+			
+			boost::atomic<unsigned long long> acquisitions[LockModes::Count];
+			boost::atomic<unsigned long long> contended;
+			boost::atomic<unsigned long long> failed;
+			boost::atomic<unsigned long long> upgrades;
+			// in nanoseconds
+			boost::atomic<long long> totalWait;
+			boost::atomic<long long> maxWait;
+			boost::atomic<long long> totalHold;
+		};
+		
+		boost::scoped_ptr<ModeLock> modeLock;
+		LockPolicies::LockPolicy lockPolicy;
+		mutable boost::atomic<Version> lockVersion;
+		bool lockHistoryEnabled;
+		// set once the history was enabled, the history may refer to this from then on
+		bool lockHistoryUsed;
+		std::string lockName;
+		bool optimisticReadsEnabled;
+		boost::atomic<bool> lockStatisticsEnabled;
+		mutable Counters counters;
+		
+		typedef std::vector< boost::function<void()> > ReleaseCallbacks;
+		// set before the callbacks are added, so unlock() only takes the mutex when there are some
+		mutable boost::atomic<bool> releaseCallbacksWaiting;
+		mutable boost::mutex releaseCallbacksMutex;
+		mutable ReleaseCallbacks releaseCallbacks;
+		
+		void runReleaseCallbacks() const;
 };
 
 #endif /* LOCKABLE_H */
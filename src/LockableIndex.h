@@ -0,0 +1,44 @@
+#ifndef LOCKABLE_INDEX_H
+#define LOCKABLE_INDEX_H
+
+#include <string>
+
+template<typename ModelClassPtr>
+class LockableIndex;
+
+#include "Lockable.h"
+#include "Index.h"
+
+// index guarded by a lock of its own
+template<typename ModelClassPtr>
+class LockableIndex : public Index<ModelClassPtr>, public Lockable
+{
+	public:
+		
+		virtual void setOptimisticReadsEnabled(bool enabled)
+		{
+			Lockable::setOptimisticReadsEnabled(enabled);
+		}
+		
+		virtual void setLockPolicy(LockPolicies::LockPolicy policy)
+		{
+			Lockable::setLockPolicy(policy);
+		}
+		
+		virtual void setLockStatisticsEnabled(bool enabled)
+		{
+			Lockable::setLockStatisticsEnabled(enabled);
+		}
+		
+		virtual void setLockName(const std::string& name)
+		{
+			Lockable::setLockName(name);
+		}
+		
+		virtual LockStatistics getLockStatistics() const
+		{
+			return Lockable::getLockStatistics();
+		}
+};
+
+#endif /* LOCKABLE_INDEX_H */
@@ -0,0 +1,120 @@
+#ifndef MODE_LOCK_H
+#define MODE_LOCK_H
+
+#include <algorithm>
+#include <boost/chrono.hpp>
+
+namespace LockModes
+{
+	// multiple granularity lock modes, the intention modes are taken on a container (like a store)
+	// before locking a part of it (like one of its instances) in the corresponding mode
+	enum LockMode
+	{
+		None = 0,
+		IntentionShared,
+		IntentionExclusive,
+		Shared,
+		SharedIntentionExclusive,
+		Exclusive,
+	};
+	
+	const unsigned int Count = Exclusive + 1;
+	
+	// modes that do not change anything on their own, only these can be held by many readers at once
+	inline bool isRead(LockMode mode)
+	{
+		return mode == IntentionShared || mode == Shared;
+	}
+	
+	// short names used in json output
+	inline const char* toString(LockMode mode)
+	{
+		static const char* names[Count] = { "None", "IS", "IX", "S", "SIX", "X" };
+		return names[mode];
+	}
+}
+
+namespace LockPolicies
+{
+	enum LockPolicy
+	{
+		// one queue, waiting exclusive requests hold back new weaker ones and anything else is granted as soon as it is compatible
+		Queue = 0,
+		// readers count themselves in per-thread slots and only meet writers, for resources that are read a lot more than written
+		BigReader,
+		// readers and writers take turns, readers wait for at most one writer and writers for the readers that came before them
+		PhaseFair,
+	};
+}
+
+namespace Priorities
+{
+	// priority classes of transactions, a waiting request goes before incompatible requests of lower classes
+	// unless those started waiting longer ago than the aging limit of their class (see Transaction::setPriorityAging())
+	enum Priority
+	{
+		// latency critical request handling
+		Interactive = 0,
+		Normal,
+		// exports, imports, cleanups and the like
+		Batch,
+	};
+	
+	const unsigned int Count = Batch + 1;
+	
+	inline const char* toString(Priority priority)
+	{
+		static const char* names[Count] = { "interactive", "normal", "batch" };
+		return names[priority];
+	}
+}
+
+// the lock behind a Lockable, the Lockable and its transactions decide what to lock and these decide who waits for whom
+class ModeLock
+{
+	public:
+		
+		typedef LockModes::LockMode LockMode;
+		typedef unsigned long long Ticket;
+		typedef Priorities::Priority Priority;
+		
+		virtual ~ModeLock() { };
+		
+		// tickets order the waiting requests, lower ones go first, and carry the priority class of the request in their lowest bits
+		static Ticket makeTicket(Ticket order, Priority priority)
+		{
+			return (order << PriorityBits) | priority;
+		}
+		
+		// tryLock() asks with the highest possible ticket, which counts as the lowest class
+		static Priority priorityOf(Ticket ticket)
+		{
+			return static_cast<Priority>(std::min<Ticket>(ticket & ((1 << PriorityBits) - 1), Priorities::Batch));
+		}
+		
+		// requests of different classes are served in ticket order when they are incompatible,
+		// so higher classes go first and lower ones still get their turn once they have waited out their aging limit
+		static bool queuesAcrossClasses(Ticket ticket, Ticket waitingTicket)
+		{
+			return waitingTicket < ticket && priorityOf(waitingTicket) != priorityOf(ticket);
+		}
+		
+		// changes the mode the caller holds from held (None if it holds nothing) to mode if that can be done without waiting
+		virtual bool tryLock(LockMode held, LockMode mode) = 0;
+		// same, but waits at most timeout, the ticket orders the request among the waiting ones
+		virtual bool lock(LockMode held, LockMode mode, Ticket ticket, const boost::chrono::milliseconds& timeout) = 0;
+		// releases held or downgrades it to mode
+		virtual void unlock(LockMode held, LockMode mode) = 0;
+		
+		// true if a new request has to wait for an earlier one that is still waiting, used by the deadlock detection
+		virtual bool queuesBehind(LockMode mode, Ticket ticket, LockMode waitingMode, Ticket waitingTicket) const = 0;
+		
+		// true if anybody holds or waits for the lock
+		virtual bool isLocked() const = 0;
+		
+	private:
+		
+		static const unsigned int PriorityBits = 2;
+};
+
+#endif /* MODE_LOCK_H */
@@ -4,34 +4,21 @@
 
 #include <boost/smart_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/atomic.hpp>
 #include <json/value.h>
 
+#include "ModelTypes.h"
+
 template<typename T>
 inline std::string getClassName()
 {
-	std::string name = typeid(T).name();
-	#ifdef __GNUC__
-		int status;
-		char *realname = abi::__cxa_demangle(name.c_str(), 0, 0, &status);
-		name = realname;
-		free(realname);
-	#endif
-	
-	return name;
+	return demangleClassName(typeid(T));
 }
 
 template<typename T>
 inline std::string getClassName(const T& t)
 {
-	std::string name = typeid(t).name();
-	#ifdef __GNUC__
-		int status;
-		char *realname = abi::__cxa_demangle(name.c_str(), 0, 0, &status);
-		name = realname;
-		free(realname);
-	#endif
-	
-	return name;
+	return demangleClassName(typeid(t));
 }
 
 typedef std::size_t ModelId;
@@ -68,6 +55,7 @@ typedef boost::shared_ptr<Json::Value> JsonValuePtr;
 #include "ModelStore.h"
 #include "IndexedField.h"
 #include "RelationField.h"
+#include "UniqueKeyException.h"
 
 inline Json::Value ValueToJsonValue(const ModelBase& value) { return Json::UInt64(value.getId()); };
 template<typename ModelClassPtr>
@@ -97,7 +85,16 @@ class Model : public ModelBase
 			TransactionPtr transaction = Transaction::startTransaction();
 			ModelStore<ModelClassPtr>& store(getModelStore());
 			ModelId id = store.store(this->mePtr());
-			store.updateIndexes(this->mePtr());
+			try
+			{
+				store.updateIndexes(this->mePtr());
+			}
+			catch(const UniqueKeyException&)
+			{
+				// the keys of stored instances are checked when they are assigned, so only a new instance can get here
+				store.erase(this->mePtr());
+				throw;
+			}
 			return id;
 		}
 		
@@ -114,7 +111,19 @@ class Model : public ModelBase
 				this->erase();
 		}
 		
-		virtual std::string getModelName() const { return getClassName(*this); }
+		virtual std::string getModelName() const { return getModelType().name; }
+		
+		// looked up the first time it is needed, the class of an instance never changes
+		const ModelType& getModelType() const
+		{
+			const ModelType* type = modelType.load(boost::memory_order_acquire);
+			if(!type)
+			{
+				type = &ModelTypes<ModelClassPtr>::get(typeid(*this));
+				modelType.store(type, boost::memory_order_release);
+			}
+			return *type;
+		}
 		virtual JsonValuePtr toJson() { return getModelStore().toJson(this->mePtr()); }
 		
 		virtual ModelClassPtr mePtr() const
@@ -128,10 +137,22 @@ class Model : public ModelBase
 		
 	protected:
 		
-		Model() { }
+		Model() : modelType(NULL), storedIn(NULL), storedId(0), instanceLock(LockPolicies::Queue, false) { }
+		// a copy is another instance that is not stored yet
+		Model(const Model&) : ModelBase(), modelType(NULL), storedIn(NULL), storedId(0), instanceLock(LockPolicies::Queue, false) { }
+		Model& operator=(const Model&) { return *this; }
 		
 	private:
 		
+		friend class ModelStore<ModelClassPtr>;
+		
+		mutable boost::atomic<const ModelType*> modelType;
+		// the store holding the instance and its id there, guarded by the lock of the instance's shard in that store
+		const ModelStore<ModelClassPtr>* storedIn;
+		ModelId storedId;
+		// taken by field writes, so writers of different instances never wait for each other,
+		// every transaction picks different ones so they stay out of the lock history
+		Lockable instanceLock;
 };
 
 #endif	/* MODEL_H */
@@ -4,12 +4,14 @@
 
 #include <vector>
 #include <set>
+#include <algorithm>
+#include <typeindex>
+#include <limits>
 #include <boost/smart_ptr.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 #include <boost/foreach.hpp>
 #include <boost/container/map.hpp>
-#include <boost/bimap.hpp>
-#include <boost/bimap/unordered_set_of.hpp>
 #include <json/json.h>
 #include <string>
 #include <fstream>
@@ -20,19 +22,33 @@
 #include <boost/tuple/tuple.hpp>
 #include <boost/tuple/tuple_comparison.hpp>
 #include <boost/tuple/tuple_io.hpp>
+#include <boost/iterator/iterator_facade.hpp>
 
 class ModelStoreBase;
 
 template<typename ModelClassPtr>
 class ModelStore;
 
+template<typename ModelClassPtr>
+class Model;
+
 #include "KeyOperators.h"
 #include "Transaction.h"
+#include "VersionedList.h"
+#include "InstanceSlots.h"
+#include "Page.h"
 #include "Index.h"
 #include "HashIndex.h"
+#include "ShardedIndex.h"
 #include "CompoundIndex.h"
+#include "OrderedIndex.h"
+#include "OrderedCompoundIndex.h"
+#include "StringIndex.h"
+#include "UniqueIndex.h"
+#include "BitmapIndex.h"
 #include "RelationStore.h"
 #include "InstanceNotFoundException.h"
+#include "DenseIdAllocator.h"
 #include "Field.h"
 
 template<typename ModelClassPtr>
@@ -40,9 +56,15 @@ class ModelContainerBase
 {
 	public:
 		virtual bool matchType(ModelClassPtr instance) const = 0;
-		virtual FieldList getModelInstanceFields(ModelClassPtr instance) const = 0;
+		virtual const FieldDescriptors& getFieldDescriptors() const = 0;
 		virtual ModelClassPtr construct() const = 0;
+		virtual const ModelType& getModelType() const = 0;
 		virtual std::string getModelName() const = 0;
+		
+		inline ModelFields getModelInstanceFields(ModelClassPtr instance) const
+		{
+			return ModelFields(getFieldDescriptors(), instance.get());
+		}
 };
 
 template<typename ModelClassPtr, typename ModelClass>
@@ -50,22 +72,40 @@ class ModelContainer : public ModelContainerBase<ModelClassPtr>
 {
 	public:
 		
+		// the fields are looked up once in a sample instance, they are at the same offsets in every instance of ModelClass
+		ModelContainer() : type(ModelTypes<ModelClassPtr>::get(typeid(ModelClass)))
+		{
+			ModelClassPtr sample(construct());
+			FieldList fields(getModelFieldReferencesWrapper<ModelClassPtr, ModelClass>(*static_cast<ModelClass*>(sample.get())));
+			BOOST_FOREACH(const FieldBase* field, fields)
+				descriptors.push_back(FieldDescriptor(field, sample.get()));
+		}
+		
 		virtual inline bool matchType(ModelClassPtr instance) const
 		{
 			return typeid(ModelClass) == typeid(*instance);
 		}
-		virtual inline FieldList getModelInstanceFields(ModelClassPtr instance) const
+		virtual inline const FieldDescriptors& getFieldDescriptors() const
 		{
-			return getModelFieldReferencesWrapper<ModelClassPtr, ModelClass>(*static_cast<ModelClass*>(instance.get()));
+			return descriptors;
 		}
 		virtual inline ModelClassPtr construct() const
 		{
 			return ModelClassPtr(new ModelClass);
 		}
+		virtual const ModelType& getModelType() const
+		{
+			return type;
+		}
 		virtual std::string getModelName() const
 		{
-			return getClassName<ModelClass>();
+			return type.name;
 		}
+		
+	private:
+		
+		const ModelType& type;
+		FieldDescriptors descriptors;
 };
 
 class ModelStoreBase : public Lockable
@@ -87,13 +127,11 @@ class ModelStore : public ModelStoreBase
 		typedef ModelContainerBase<ModelClassPtr> ModelContainerType;
 		typedef boost::shared_ptr< ModelContainerType > ModelContainerPtr;
 		typedef boost::container::map<std::string, ModelContainerPtr> ModelClasses;
+		// the models by the tags of their types, an instance finds its model with the tag in its Model base
+		typedef std::vector<ModelContainerPtr> ModelContainers;
+		typedef boost::shared_ptr<const ModelContainers> ModelContainersPtr;
 		
-		typedef boost::bimap<
-			boost::bimaps::unordered_set_of<ID>,
-			boost::bimaps::unordered_set_of< ModelClassPtr, value_key_operators::hash<ModelClassPtr>, value_key_operators::equality<ModelClassPtr> >
-		> Multimap;
-		
-		typedef typename Multimap::value_type IndexElementType;
+		typedef InstanceSlots<ID, ModelClassPtr> Instances;
 		
 		typedef boost::shared_ptr< std::vector<ModelClassPtr> > ModelListPtr;
 		typedef boost::shared_ptr< std::vector<ID> > IDList;
@@ -101,14 +139,128 @@ class ModelStore : public ModelStoreBase
 		typedef boost::shared_ptr< Index<ModelClassPtr> > IndexPtr;
 		typedef std::set<FieldId> FieldSet;
 		typedef boost::unordered_map<FieldSet, IndexPtr> Indexes;
+		typedef boost::shared_ptr<Indexes> IndexesPtr;
+		// values of single fields to look up together
+		typedef std::vector< std::pair<FieldId, boost::any> > FieldKeys;
 		
 		typedef RelationStoreBase<ModelClassPtr> RelationStore;
 		typedef std::set<RelationStore*> Relations;
 		
 		typedef std::set<ModelStoreBase*> RelationModels;
 		
-		ModelStore() { };
-		virtual ~ModelStore() { };
+		// a relation index on a single field and what happens to the instances in it when the instance they point to is erased
+		struct RelationDispatch
+		{
+			RelationDispatch(FieldId f, const IndexPtr& i, FieldPolicies::FieldPolicy p, const ModelContainersPtr& m) : fieldId(f), index(i), deletePolicy(p), models(m) { }
+			
+			// the field in instance, NULL if its model has none with the id
+			FieldBase* field(const ModelClassPtr& instance) const
+			{
+				unsigned int tag = modelOf(instance).getModelType().tag;
+				return tag < fields.size() && fields[tag] ? fields[tag]->get(instance.get()) : NULL;
+			}
+			
+			FieldId fieldId;
+			IndexPtr index;
+			FieldPolicies::FieldPolicy deletePolicy;
+			// the descriptor of the field by the tag of each model that has it, the models keep them alive
+			std::vector<const FieldDescriptor*> fields;
+			ModelContainersPtr models;
+		};
+		typedef std::vector<RelationDispatch> RelationDispatches;
+		// the relation indexes by the type of the instances they point to
+		typedef boost::unordered_map<std::type_index, RelationDispatches> RelationDispatchTable;
+		typedef boost::shared_ptr<const RelationDispatchTable> RelationDispatchTablePtr;
+		
+		typedef VersionedList<ID, ModelClassPtr> InstanceVersions;
+		typedef typename InstanceVersions::Ptr InstanceVersionsPtr;
+		
+		// instances visible at the epoch pinned when the snapshot was taken, iterating it takes no locks
+		class Snapshot
+		{
+			public:
+				
+				typedef typename InstanceVersions::Entry Entry;
+				
+				class const_iterator : public boost::iterator_facade<const_iterator, const Entry, boost::forward_traversal_tag>
+				{
+					public:
+						
+						const_iterator() : snapshot(NULL), shard(0), position(0) { }
+						const_iterator(const Snapshot* s, std::size_t sh) : snapshot(s), shard(sh), position(0) { skipInvisible(); }
+						
+					private:
+						
+						friend class boost::iterator_core_access;
+						
+						void skipInvisible()
+						{
+							for(; shard < snapshot->shards.size(); shard++, position = 0)
+							{
+								const ShardVersion& version(snapshot->shards[shard]);
+								while(position < version.size && !InstanceVersions::visible((*version.list)[position], snapshot->epoch, version.ownsPending))
+									position++;
+								if(position < version.size)
+									return;
+							}
+						}
+						
+						void increment()
+						{
+							position++;
+							skipInvisible();
+						}
+						
+						bool equal(const const_iterator& other) const
+						{
+							return shard == other.shard && position == other.position;
+						}
+						
+						const Entry& dereference() const
+						{
+							return (*snapshot->shards[shard].list)[position];
+						}
+						
+						const Snapshot* snapshot;
+						std::size_t shard;
+						std::size_t position;
+				};
+				typedef const_iterator iterator;
+				
+				const_iterator begin() const { return const_iterator(this, 0); }
+				const_iterator end() const { return const_iterator(this, shards.size()); }
+				
+			private:
+				
+				friend class ModelStore;
+				
+				struct ShardVersion
+				{
+					ShardVersion(InstanceVersionsPtr l, bool o) : list(l), size(0), ownsPending(o) { }
+					
+					InstanceVersionsPtr list;
+					std::size_t size;
+					bool ownsPending;
+				};
+				
+				std::vector<ShardVersion> shards;
+				Epoch epoch;
+		};
+		
+		// a sharded store spreads its instances and indexes over shards that are locked separately,
+		// so writers of instances in different shards do not wait for each other
+		ModelStore(std::size_t shardCount = 1) : containers(new ModelContainers), indexes(new Indexes), relationDispatch(new RelationDispatchTable), epoch(0)
+		{
+			for(std::size_t i = 0; i < shardCount; i++)
+				shards.push_back(ShardPtr(new Shard(*this, i, shardCount)));
+		};
+		virtual ~ModelStore()
+		{
+			// instances outliving the store must not take a later store at the same address for the one holding them
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				BOOST_FOREACH(const typename Instances::Entry& i, shard->instances)
+					modelOf(i.value).storedIn = NULL;
+		};
 		
 		template<typename ModelClass>
 		void registerModel()
@@ -118,7 +270,9 @@ class ModelStore : public ModelStoreBase
 			
 			ModelContainerPtr model(new ModelContainer<ModelClassPtr, ModelClass>());
 			models[model->getModelName()] = model;
+			setModelContainer(model->getModelType(), model);
 			registerFields(model);
+			updateRelationDispatch();
 		}
 		
 		template<typename ModelClass>
@@ -127,29 +281,33 @@ class ModelStore : public ModelStoreBase
 			TransactionPtr transaction = Transaction::startTransaction();
 			transaction->getExclusiveLock(this);
 			
-			models.erase(ModelContainer<ModelClassPtr, ModelClass>()->getModelName());
+			const ModelType& type(ModelTypes<ModelClassPtr>::get(typeid(ModelClass)));
+			models.erase(type.name);
+			setModelContainer(type, ModelContainerPtr());
+			updateRelationDispatch();
 		}
 		
-		inline FieldList getModelInstanceFields(ModelClassPtr instance) const
+		inline ModelFields getModelInstanceFields(ModelClassPtr instance) const
 		{
-			BOOST_FOREACH(typename ModelClasses::value_type it, models)
-			{
-				ModelContainerPtr model(it.second);
-				if(model->matchType(instance))
-					return model->getModelInstanceFields(instance);
-			}
-			throw std::runtime_error("Model type not registered");
+			return getModelContainer(instance)->getModelInstanceFields(instance);
 		}
 		
-		inline ModelContainerPtr getModelContainer(ModelClassPtr instance)
+		// the field of instance with fieldId, NULL if the class of instance has no such field, like a field of a subclass
+		FieldBase* findField(ModelClassPtr instance, FieldId fieldId) const
 		{
-			BOOST_FOREACH(typename ModelClasses::value_type it, models)
-			{
-				ModelContainerPtr model(it.second);
-				if(model->matchType(instance))
-					return model;
-			}
-			throw std::runtime_error("Model type not registered");
+			BOOST_FOREACH(const FieldDescriptor& field, getModelContainer(instance)->getFieldDescriptors())
+				if(field.id == fieldId)
+					return field.get(instance.get());
+			return NULL;
+		}
+		
+		inline ModelContainerPtr getModelContainer(ModelClassPtr instance) const
+		{
+			unsigned int tag = modelOf(instance).getModelType().tag;
+			ModelContainersPtr current(boost::atomic_load(&containers));
+			if(tag >= current->size() || !(*current)[tag])
+				throw std::runtime_error("Model type not registered");
+			return (*current)[tag];
 		}
 		
 		virtual void registerRelationStore(RelationStore* relation)
@@ -183,87 +341,269 @@ class ModelStore : public ModelStoreBase
 		virtual ID store(ModelClassPtr instance)
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getExclusiveLock(this);
+			transaction->getIntentionExclusiveLock(this);
+			const ShardPtr& shard(shardFor(instance));
+			transaction->getExclusiveLock(shard.get());
 			
-			typename Multimap::right_const_iterator it = instances.right.find(instance);
-			if(it != instances.right.end())
-				return it->second;
-			ID id = generateId(instance);
-			instances.insert(IndexElementType(id, instance));
+			if(isStored(instance))
+				return modelOf(instance).storedId;
+			ID id = generateId(shard);
+			insertInstance(shard, id, instance);
 			return id;
 		}
 		
 		virtual ID getId(ModelClassPtr instance) const
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getSharedLock(this);
+			transaction->getIntentionSharedLock(this);
+			const ShardPtr& shard(shardFor(instance));
+			transaction->getIntentionSharedLock(shard.get());
 			
-			typename Multimap::right_const_iterator it = instances.right.find(instance);
-			if(it == instances.right.end())
+			if(!isStored(instance))
 				throw InstanceNotFoundException(instance->getModelName(), boost::lexical_cast<std::string>(instance));
-			return it->second;
+			return modelOf(instance).storedId;
+		}
+		
+		// the id instance was last stored under, read without a lock for the indexes and relation stores holding it:
+		// they order their pages by it and still need it once the instance left the store, when getId() throws
+		static ID storedId(const ModelClassPtr& instance)
+		{
+			return modelOf(instance).storedId;
 		}
 		
 		virtual const ModelClassPtr getInstance(ID id) const
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getSharedLock(this);
+			transaction->getIntentionSharedLock(this);
 			
-			typename Multimap::left_const_iterator it = instances.left.find(id);
-			if(it == instances.left.end())
+			ModelClassPtr instance(findInstance(id));
+			if(!instance)
 				throw InstanceNotFoundException(getClassName<typename ModelClassPtr::element_type>(), boost::lexical_cast<std::string>(id));
-			return it->second;
+			return instance;
 		}
 		
 		virtual void erase(ID id)
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getExclusiveLock(this);
+			transaction->getIntentionExclusiveLock(this);
+			const ShardPtr& shard(shardForId(id));
+			transaction->getExclusiveLock(shard.get());
 			
-			typename Multimap::left_const_iterator it = instances.left.find(id);
-			if(it == instances.left.end())
+			ModelClassPtr instance(shard->instances.find(id));
+			if(instance)
+			{
+				eraseHelper(instance);
 				return;
+			}
 			
-			eraseHelper(it->second);
+			// imported ids may belong to an instance in another shard
+			instance = findInstance(id);
+			if(instance)
+				erase(instance);
 		}
 		
 		virtual void erase(ModelClassPtr instance)
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getExclusiveLock(this);
+			transaction->getIntentionExclusiveLock(this);
+			transaction->getExclusiveLock(shardFor(instance).get());
 			
 			eraseHelper(instance);
 		}
 		
-		virtual ModelListPtr getList() const
+		// locks instance for writing its fields, the store and its shard only get intention locks
+		// so writers of other instances and readers of the store structure go on in parallel
+		void lockInstance(ModelClassPtr instance) const
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getSharedLock(this);
+			transaction->getIntentionExclusiveLock(this);
+			transaction->getIntentionExclusiveLock(shardFor(instance).get());
+			transaction->keepOwner(instanceLock(instance), instance);
+			transaction->getExclusiveLock(instanceLock(instance));
+		}
+		
+		// waits until a transaction writing instance, if another one does, ends
+		void waitForInstance(const ModelClassPtr& instance) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			Transaction::ScopedLock lock(*transaction, instanceLock(instance), LockModes::Shared);
+		}
+		
+		// copies a field value of instance so that an optimistic transaction notices when somebody writes to instance after it read it
+		template<typename T>
+		T readInstance(ModelClassPtr instance, const T& value) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			if(Transaction::isReadingOptimistically())
+				transaction->keepOwner(instanceLock(instance), instance);
+			return transaction->read(instanceLock(instance), value);
+		}
+		
+		// hot stores can keep their read locks until the end even in optimistic transactions, so they do not conflict as often
+		virtual void setOptimisticReadsEnabled(bool enabled)
+		{
+			Lockable::setOptimisticReadsEnabled(enabled);
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				shard->setOptimisticReadsEnabled(enabled);
+			BOOST_FOREACH(const typename Snapshot::Entry& i, getSnapshot())
+				modelOf(i.value).instanceLock.setOptimisticReadsEnabled(enabled);
+			BOOST_FOREACH(typename Indexes::value_type i, *boost::atomic_load(&indexes))
+				i.second->setOptimisticReadsEnabled(enabled);
+		}
+		
+		// applies to the store, its shards and its indexes, instance locks keep the default
+		virtual void setLockPolicy(LockPolicies::LockPolicy policy)
+		{
+			Lockable::setLockPolicy(policy);
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				shard->setLockPolicy(policy);
+			BOOST_FOREACH(typename Indexes::value_type i, *boost::atomic_load(&indexes))
+				i.second->setLockPolicy(policy);
+		}
+		
+		virtual void setLockStatisticsEnabled(bool enabled)
+		{
+			Lockable::setLockStatisticsEnabled(enabled);
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				shard->setLockStatisticsEnabled(enabled);
+			BOOST_FOREACH(const typename Snapshot::Entry& i, getSnapshot())
+				modelOf(i.value).instanceLock.setLockStatisticsEnabled(enabled);
+			BOOST_FOREACH(typename Indexes::value_type i, *boost::atomic_load(&indexes))
+				i.second->setLockStatisticsEnabled(enabled);
+		}
+		
+		// names the store, its shards as name/shard/position and its indexes as name/index/field ids,
+		// instance locks stay out of the lock history and do not need names
+		virtual void setLockName(const std::string& name)
+		{
+			Lockable::setLockName(name);
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				shard->setLockName(name.empty() ? name : name + "/shard/" + boost::lexical_cast<std::string>(shard->position));
+			BOOST_FOREACH(typename Indexes::value_type i, *boost::atomic_load(&indexes))
+				i.second->setLockName(indexLockName(i.first));
+		}
+		
+		// lock statistics of the store, each of its shards, the instances it holds now taken together and each index by field ids
+		JsonValuePtr lockStatisticsToJson() const
+		{
+			JsonValuePtr json(new Json::Value);
+			(*json)["store"] = getLockStatistics().toJson();
+			
+			Json::Value& shardStatistics((*json)["shards"] = Json::Value(Json::arrayValue));
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				shardStatistics.append(shard->getLockStatistics().toJson());
+			
+			LockStatistics instanceStatistics;
+			BOOST_FOREACH(const typename Snapshot::Entry& i, getSnapshot())
+				instanceStatistics += modelOf(i.value).instanceLock.getLockStatistics();
+			(*json)["instances"] = instanceStatistics.toJson();
+			
+			Json::Value& indexStatistics((*json)["indexes"] = Json::Value(Json::objectValue));
+			BOOST_FOREACH(typename Indexes::value_type i, *boost::atomic_load(&indexes))
+				indexStatistics[fieldsToString(i.first)] = i.second->getLockStatistics().toJson();
+			
+			return json;
+		}
+		
+		// pins the current version of the instance list, walking it never waits for writers and writers never wait for it;
+		// only the list is versioned, the fields of its instances and the index entries are not
+		Snapshot getSnapshot() const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			
+			// the lists and the epoch have to be read while the lists are current, compaction replaces them
+			Snapshot snapshot;
+			bool current;
+			do
+			{
+				snapshot.shards.clear();
+				// a transaction writing to this store sees its own pending changes
+				BOOST_FOREACH(const ShardPtr& shard, shards)
+					snapshot.shards.push_back(typename Snapshot::ShardVersion(boost::atomic_load(&shard->versions), shard->pendingOwner.load(boost::memory_order_relaxed) == transaction.get()));
+				snapshot.epoch = epoch.load(boost::memory_order_acquire);
+				
+				current = true;
+				for(std::size_t i = 0; i < shards.size(); i++)
+					if(snapshot.shards[i].list != boost::atomic_load(&shards[i]->versions))
+						current = false;
+			} while(!current);
+			
+			// everything published up to the pinned epoch was appended before it was published
+			BOOST_FOREACH(typename Snapshot::ShardVersion& version, snapshot.shards)
+				version.size = version.list->size();
+			
+			return snapshot;
+		}
+		
+		virtual ModelListPtr getList() const
+		{
+			Snapshot snapshot(getSnapshot());
 			
 			ModelListPtr list(new typename ModelListPtr::element_type);
-			list->reserve(instances.left.size());
-			BOOST_FOREACH(typename Multimap::left_const_reference& i, instances.left)
-				list->push_back(i.second);
+			BOOST_FOREACH(const typename Snapshot::Entry& i, snapshot)
+				list->push_back(i.value);
 			return list;
 		}
 		
 		virtual std::size_t getCount() const
+		{
+			Snapshot snapshot(getSnapshot());
+			
+			return std::distance(snapshot.begin(), snapshot.end());
+		}
+		
+		// calls visitor with every instance in a snapshot of the store, without copying them into a list or taking locks,
+		// visitor returns false to stop and so does forEach()
+		template<typename Visitor>
+		bool forEach(Visitor visitor) const
+		{
+			Snapshot snapshot(getSnapshot());
+			
+			BOOST_FOREACH(const typename Snapshot::Entry& i, snapshot)
+				if(!visitor(i.value))
+					return false;
+			return true;
+		}
+		
+		// at most limit instances in the order of their ids from token on, see PageToken,
+		// every shard is locked only while its part of the page is collected, so pages do not keep instances from being
+		// stored and erased until the transaction ends, and the page is not a snapshot of the store either
+		Page<ModelClassPtr> getPage(const PageToken& token, std::size_t limit) const
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getSharedLock(this);
+			transaction->getIntentionSharedLock(this);
+			
+			Page<ModelClassPtr> page;
+			if(token.isEnd() || limit == 0)
+				return page;
+			
+			// one more from every shard tells if there is another page
+			std::vector<typename Instances::Entry> entries;
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+			{
+				Transaction::ScopedLock lock(*transaction, shard.get(), LockModes::IntentionShared);
+				shard->instances.collect(token.getStart(), limit + 1, entries);
+			}
+			std::sort(entries.begin(), entries.end(), Instances::lowerId);
+			if(entries.size() > limit)
+			{
+				page.next = PageToken(entries[limit].id);
+				entries.resize(limit);
+			}
 			
-			return std::distance(instances.left.begin(),instances.left.end());
+			page.values->reserve(entries.size());
+			BOOST_FOREACH(const typename Instances::Entry& i, entries)
+				page.values->push_back(i.value);
+			return page;
 		}
 		
 		virtual IDList getIdList() const
 		{
-			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getSharedLock(this);
+			Snapshot snapshot(getSnapshot());
 			
 			IDList list(new typename IDList::element_type);
-			list->reserve(instances.left.size());
-			BOOST_FOREACH(typename Multimap::left_const_reference& i, instances.left)
-				list->push_back(i.first);
+			BOOST_FOREACH(const typename Snapshot::Entry& i, snapshot)
+				list->push_back(i.id);
 			return list;
 		}
 		
@@ -273,6 +613,114 @@ class ModelStore : public ModelStoreBase
 			return getIndex(fieldId)->getList(static_cast<typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type>(value));
 		}
 		
+		// a page of getList(), see Index::getPage()
+		template <FieldId fieldId, typename FieldType>
+		Page<ModelClassPtr> getPage(const FieldType & value, const PageToken& token, std::size_t limit)
+		{
+			return getIndex(fieldId)->getPage(static_cast<typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type>(value), token, limit);
+		}
+		
+		// like getList() without copying the instances into a list, see Index::forEach()
+		template <FieldId fieldId, typename FieldType, typename Visitor>
+		bool forEach(const FieldType & value, Visitor visitor)
+		{
+			return getIndex(fieldId)->forEach(static_cast<typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type>(value), visitor);
+		}
+		
+		// the instances with values of the field from first to last, both included, in order, through an ordered index on it
+		template <FieldId fieldId, typename FieldType>
+		ModelListPtr getRange(const FieldType & first, const FieldType & last)
+		{
+			typedef typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type KeyType;
+			return getIndex(fieldId)->getRange(static_cast<KeyType>(first), static_cast<KeyType>(last));
+		}
+		
+		// the instance with the lowest or the highest value of the field, an empty pointer if there are none
+		template <FieldId fieldId>
+		ModelClassPtr findFirst()
+		{
+			return getIndex(fieldId)->findFirst();
+		}
+		
+		template <FieldId fieldId>
+		ModelClassPtr findLast()
+		{
+			return getIndex(fieldId)->findLast();
+		}
+		
+		// at most limit instances whose values of the field start with prefix, in order, see Index::getPrefixList()
+		template <FieldId fieldId>
+		ModelListPtr getPrefixList(const std::string & prefix, std::size_t limit = std::numeric_limits<std::size_t>::max())
+		{
+			return getIndex(fieldId)->getPrefixList(prefix, limit);
+		}
+		
+		// like forEach() in the order of the values of the field, or in reverse, so visitor can stop after the first few
+		template <FieldId fieldId, typename Visitor>
+		bool forEachInOrder(Visitor visitor, bool reverse = false)
+		{
+			return getIndex(fieldId)->forEachInOrder(visitor, reverse);
+		}
+		
+		// the ids of the instances with the value of the field through a bitmap index on it, combine them with &, | and -
+		// and turn them into instances with getList() or forEach() once the combination is known
+		template <FieldId fieldId, typename FieldType>
+		Bitmap getBitmap(const FieldType & value)
+		{
+			return getIndex(fieldId)->getBitmap(static_cast<typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type>(value));
+		}
+		
+		// the ids of the instances with any of the values
+		template <FieldId fieldId, typename FieldType>
+		Bitmap getBitmap(const std::vector<FieldType> & values)
+		{
+			// the index stays locked until the bitmaps of all the values are read
+			TransactionPtr transaction = Transaction::startTransaction();
+			
+			IndexPtr index(getIndex(fieldId));
+			Bitmap ids;
+			BOOST_FOREACH(const FieldType& value, values)
+				ids |= index->getBitmap(static_cast<typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type>(value));
+			return ids;
+		}
+		
+		// the ids of all the instances in a snapshot of the store, subtracting a bitmap from them negates it
+		Bitmap getIdBitmap() const
+		{
+			Snapshot snapshot(getSnapshot());
+			
+			Bitmap ids;
+			BOOST_FOREACH(const typename Snapshot::Entry& i, snapshot)
+				ids.insert(i.id);
+			return ids;
+		}
+		
+		// the instances of ids in the order of the ids, ids of instances erased since are left out
+		ModelListPtr getList(const Bitmap& ids) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getIntentionSharedLock(this);
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				transaction->getIntentionSharedLock(shard.get());
+			
+			ModelListPtr list(new typename ModelListPtr::element_type);
+			list->reserve(ids.size());
+			ids.forEach(AppendInstance(*this, *list));
+			return list;
+		}
+		
+		// like getList() without copying the instances into a list, visitor returns false to stop and so does forEach()
+		template<typename Visitor>
+		bool forEach(const Bitmap& ids, Visitor visitor) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getIntentionSharedLock(this);
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				transaction->getIntentionSharedLock(shard.get());
+			
+			return ids.forEach(VisitInstance<Visitor>(*this, visitor));
+		}
+		
 		template <typename... Args>
 		inline ModelListPtr getListHelper(IndexPtr index, Args... args)
 		{
@@ -285,10 +733,13 @@ class ModelStore : public ModelStoreBase
 			return getListHelper<fieldIds...>(index, args..., static_cast<typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type>(value));
 		}
 		
+		// without an index on exactly these fields the indexes of the single fields are intersected, see getIntersection()
 		template <FieldId fieldId1, FieldId fieldId2, FieldId... fieldIds, typename... Args>
 		ModelListPtr getList(Args... args)
 		{
-			IndexPtr index = getIndex(fieldId1, fieldId2, fieldIds...);
+			IndexPtr index = findIndex(fieldId1, fieldId2, fieldIds...);
+			if(!index)
+				return getIntersection(getFieldKeys<fieldId1, fieldId2, fieldIds...>(args...));
 			return getListHelper<fieldId1, fieldId2, fieldIds...>(index, args...);
 		}
 		
@@ -313,25 +764,110 @@ class ModelStore : public ModelStoreBase
 		template <FieldId fieldId1, FieldId fieldId2, FieldId... fieldIds, typename... Args>
 		ModelClassPtr get(Args... args)
 		{
-			IndexPtr index = getIndex(fieldId1, fieldId2, fieldIds...);
+			IndexPtr index = findIndex(fieldId1, fieldId2, fieldIds...);
+			if(!index)
+			{
+				// stops at the first match
+				ModelClassPtr instance;
+				forEachIntersection(getFieldKeys<fieldId1, fieldId2, fieldIds...>(args...), KeepFirst(instance));
+				if(!instance)
+					throw InstanceNotFoundException(getClassName<typename ModelClassPtr::element_type>(), boost::lexical_cast<std::string>(boost::make_tuple(args...)));
+				return instance;
+			}
 			return getHelper<fieldId1, fieldId2, fieldIds...>(index, args...);
 		}
 		
+		template <typename... Args>
+		inline void getFieldKeysHelper(FieldKeys&)
+		{
+		}
+		
+		template <FieldId fieldId, FieldId... fieldIds, typename FieldType, typename... Args>
+		inline void getFieldKeysHelper(FieldKeys& keys, const FieldType & value, Args... args)
+		{
+			keys.push_back(std::make_pair(fieldId, boost::any(static_cast<typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type>(value))));
+			getFieldKeysHelper<fieldIds...>(keys, args...);
+		}
+		
+		template <FieldId... fieldIds, typename... Args>
+		FieldKeys getFieldKeys(Args... args)
+		{
+			FieldKeys keys;
+			getFieldKeysHelper<fieldIds...>(keys, args...);
+			return keys;
+		}
+		
+		// the instances matching all keys through the indexes of their single fields, for lookups no index covers,
+		// see forEachIntersection()
+		ModelListPtr getIntersection(const FieldKeys& keys)
+		{
+			ModelListPtr list(new typename ModelListPtr::element_type);
+			forEachIntersection(keys, AppendToList(*list));
+			return list;
+		}
+		
+		// calls visitor with the instances matching all keys one at a time, visitor returns false to stop and so does this:
+		// the indexes keeping a bitmap of ids for every key AND their bitmaps, most selective first, without looking at
+		// the instances, and only the instances left are visited in the order of their ids and checked against the others;
+		// without any bitmaps the index with the fewest matches visits the candidates and the others check them,
+		// so the cost is the smallest match count times the number of keys instead of all matches of every key
+		template<typename Visitor>
+		bool forEachIntersection(const FieldKeys& keys, Visitor visitor)
+		{
+			// the indexes stay locked until the candidates are checked against all of them
+			TransactionPtr transaction = Transaction::startTransaction();
+			
+			std::vector<IndexLookup> lookups;
+			BOOST_FOREACH(const typename FieldKeys::value_type& key, keys)
+			{
+				IndexLookup lookup;
+				lookup.index = getIndex(key.first);
+				lookup.key = &key.second;
+				lookup.matches = lookup.index->count(key.second);
+				lookups.push_back(lookup);
+			}
+			std::sort(lookups.begin(), lookups.end(), IndexLookup::fewerMatches);
+			
+			if(lookups.empty() || lookups.front().matches == 0)
+				return true;
+			
+			Bitmap ids;
+			bool bitmaps = false;
+			std::vector<IndexLookup> probes;
+			BOOST_FOREACH(const IndexLookup& lookup, lookups)
+			{
+				if(!lookup.index->isBitmap())
+					probes.push_back(lookup);
+				else if(!bitmaps)
+				{
+					ids = lookup.index->getBitmap(*lookup.key);
+					bitmaps = true;
+				}
+				else if(!ids.empty())
+					ids &= lookup.index->getBitmap(*lookup.key);
+			}
+			
+			if(bitmaps)
+				return forEach(ids, VisitMatching<Visitor>(probes, visitor, 0));
+			
+			return lookups.front().index->forEach(*lookups.front().key, VisitMatching<Visitor>(lookups, visitor, 1));
+		}
+		
 		virtual void registerFields(ModelContainerPtr model)
 		{
-			// TODO: remove construct() call
-			ModelClassPtr instance(model->construct());
-			BOOST_FOREACH(const FieldBase* field, model->getModelInstanceFields(instance))
+			BOOST_FOREACH(const FieldDescriptor& field, model->getFieldDescriptors())
 			{
-				field->registerField();
+				if(field.registration)
+					field.registration();
 			}
 		}
 		
 		virtual void updateIndexes(ModelClassPtr model)
 		{
-			BOOST_FOREACH(FieldBase* field, getModelInstanceFields(model))
+			BOOST_FOREACH(const FieldDescriptor& field, getModelContainer(model)->getFieldDescriptors())
 			{
-				field->updateIndex();
+				if(field.indexed)
+					field.get(model.get())->updateIndex();
 			}
 		}
 		
@@ -339,9 +875,9 @@ class ModelStore : public ModelStoreBase
 		{
 			JsonValuePtr json(new Json::Value);
 			
-			BOOST_FOREACH(const FieldBase* field, getModelInstanceFields(model))
+			BOOST_FOREACH(const FieldDescriptor& field, getModelContainer(model)->getFieldDescriptors())
 			{
-				(*json)[field->getFieldName()] = field->toJson();
+				(*json)[field.name] = field.get(model.get())->toJson();
 			}
 			
 			return json;
@@ -351,9 +887,9 @@ class ModelStore : public ModelStoreBase
 		{
 			ModelClassPtr instance(model->construct());
 			
-			BOOST_FOREACH(FieldBase* field, model->getModelInstanceFields(instance))
+			BOOST_FOREACH(const FieldDescriptor& field, model->getFieldDescriptors())
 			{
-				field->fromJson(values[field->getFieldName()]);
+				field.get(instance.get())->fromJson(values[field.name]);
 			}
 			
 			return instance;
@@ -379,46 +915,168 @@ class ModelStore : public ModelStoreBase
 			TransactionPtr transaction = Transaction::startTransaction();
 			transaction->getExclusiveLock(this);
 			
-			indexes[fields] = index;
+			// lookups read the index registry without locking the store, so publish a new copy of it
+			index->setOptimisticReadsEnabled(isOptimisticReadsEnabled());
+			index->setLockPolicy(getLockPolicy());
+			index->setLockStatisticsEnabled(isLockStatisticsEnabled());
+			IndexesPtr newIndexes(new Indexes(*indexes));
+			IndexPtr& registered((*newIndexes)[fields]);
+			// an index replaced by one on the same fields may live on for a while, but its name goes to the new one
+			if(registered)
+				registered->setLockName(std::string());
+			index->setLockName(indexLockName(fields));
+			registered = index;
+			boost::atomic_store(&indexes, newIndexes);
+			updateRelationDispatch();
+		}
+		
+		// adds an index of IndexType split the same way as the store, one IndexType per shard
+		template<typename IndexType, typename... FieldIds>
+		void addShardedIndex(FieldIds... fieldIds)
+		{
+			if(shards.size() == 1)
+			{
+				addIndex(IndexPtr(new IndexType), fieldIds...);
+				return;
+			}
+			
+			typename ShardedIndex<ModelClassPtr>::Shards indexShards;
+			for(std::size_t i = 0; i < shards.size(); i++)
+			{
+				// keeps its entries by the ids of the store shard, see StorageIndex
+				boost::shared_ptr<IndexType> indexShard(new IndexType(i, shards.size()));
+				indexShard->setLockHistoryEnabled(false);
+				indexShards.push_back(indexShard);
+			}
+			addIndex(IndexPtr(new ShardedIndex<ModelClassPtr>(indexShards)), fieldIds...);
+		}
+		
+		// IndexPolicies::Unique makes it a unique index, see addUniqueIndex()
+		template<typename FieldType>
+		inline void addIndex(IndexPolicies::IndexPolicy policy = IndexPolicies::None)
+		{
+			if(policy & IndexPolicies::Unique)
+				addUniqueIndex<FieldType>();
+			else
+				addShardedIndex< HashIndex<ModelClassPtr, typename FieldType::type> >(FieldType::field_id);
+		}
+		
+		template<FieldId fieldId>
+		inline void addIndex(IndexPolicies::IndexPolicy policy = IndexPolicies::None)
+		{
+			if(policy & IndexPolicies::Unique)
+				addUniqueIndex<fieldId>();
+			else
+				addShardedIndex< HashIndex<ModelClassPtr, typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type> >(fieldId);
+		}
+		
+		// with IndexPolicies::Unique no two instances can have the same values of all the fields, unique indexes are not sharded
+		template<typename... FieldTypes>
+		inline void addCompoundIndex(IndexPolicies::IndexPolicy policy = IndexPolicies::None)
+		{
+			if(policy & IndexPolicies::Unique)
+				addIndex(IndexPtr(new UniqueCompoundIndex<ModelClassPtr, FieldTypes...>), FieldTypes::field_id...);
+			else
+				addShardedIndex< CompoundIndex<ModelClassPtr, FieldTypes...> >(FieldTypes::field_id...);
+		}
+		
+		template<FieldId... fieldIds>
+		inline void addCompoundIndex(IndexPolicies::IndexPolicy policy = IndexPolicies::None)
+		{
+			if(policy & IndexPolicies::Unique)
+				addIndex(IndexPtr(new UniqueCompoundIndex<ModelClassPtr, MODEL_FIELD_TYPE(ModelClassPtr, fieldIds)...>), fieldIds...);
+			else
+				addShardedIndex< CompoundIndex<ModelClassPtr, MODEL_FIELD_TYPE(ModelClassPtr, fieldIds)...> >(fieldIds...);
 		}
 		
+		// ordered indexes are never split into shards, see OrderedIndex
 		template<typename FieldType>
-		inline void addIndex()
+		inline void addOrderedIndex()
 		{
-			addIndex(boost::shared_ptr< Index<ModelClassPtr> >(new HashIndex<ModelClassPtr, typename FieldType::type>), FieldType::field_id);
+			addIndex(IndexPtr(new OrderedIndex<ModelClassPtr, typename FieldType::type>), FieldType::field_id);
 		}
 		
 		template<FieldId fieldId>
-		inline void addIndex()
+		inline void addOrderedIndex()
+		{
+			addIndex(IndexPtr(new OrderedIndex<ModelClassPtr, typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type>), fieldId);
+		}
+		
+		// instances with the same value of the field cannot be stored, see UniqueIndex
+		template<typename FieldType>
+		inline void addUniqueIndex()
 		{
-			addIndex(boost::shared_ptr< Index<ModelClassPtr> >(new HashIndex<ModelClassPtr, typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type>), fieldId);
+			addIndex(IndexPtr(new UniqueIndex<ModelClassPtr, typename FieldType::type>), FieldType::field_id);
 		}
 		
+		template<FieldId fieldId>
+		inline void addUniqueIndex()
+		{
+			addIndex(IndexPtr(new UniqueIndex<ModelClassPtr, typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type>), fieldId);
+		}
+		
+		// an ordered index on a string field that also finds its values by prefix, see StringIndex
+		template<typename FieldType>
+		inline void addStringIndex()
+		{
+			addIndex(IndexPtr(new StringIndex<ModelClassPtr>), FieldType::field_id);
+		}
+		
+		template<FieldId fieldId>
+		inline void addStringIndex()
+		{
+			addIndex(IndexPtr(new StringIndex<ModelClassPtr>), fieldId);
+		}
+		
+		// one bitmap of ids per value, for fields with few values, see BitmapIndex
+		template<typename FieldType>
+		inline void addBitmapIndex()
+		{
+			addIndex(IndexPtr(new BitmapIndex<ModelClassPtr, typename FieldType::type>), FieldType::field_id);
+		}
+		
+		template<FieldId fieldId>
+		inline void addBitmapIndex()
+		{
+			addIndex(IndexPtr(new BitmapIndex<ModelClassPtr, typename MODEL_FIELD_TYPE(ModelClassPtr, fieldId)::type>), fieldId);
+		}
+		
+		// ordered by the first field, then the second one and so on, see Index::getPrefixList()
 		template<typename... FieldTypes>
-		inline void addCompoundIndex()
+		inline void addOrderedCompoundIndex()
 		{
-			addIndex(boost::shared_ptr< Index<ModelClassPtr> >(new CompoundIndex<ModelClassPtr, FieldTypes...>), FieldTypes::field_id...);
+			addIndex(IndexPtr(new OrderedCompoundIndex<ModelClassPtr, FieldTypes...>), FieldTypes::field_id...);
 		}
 		
 		template<FieldId... fieldIds>
-		inline void addCompoundIndex()
+		inline void addOrderedCompoundIndex()
 		{
-			addIndex(boost::shared_ptr< Index<ModelClassPtr> >(new CompoundIndex<ModelClassPtr, MODEL_FIELD_TYPE(ModelClassPtr, fieldIds)...>), fieldIds...);
+			addIndex(IndexPtr(new OrderedCompoundIndex<ModelClassPtr, MODEL_FIELD_TYPE(ModelClassPtr, fieldIds)...>), fieldIds...);
 		}
 		
 		template<typename... FieldIds>
 		IndexPtr getIndex(FieldIds... fieldIds)
+		{
+			IndexPtr index(findIndex(fieldIds...));
+			if(!index)
+				// TODO: fix
+				throw std::runtime_error("Failed to find index");
+			
+			return index;
+		}
+		
+		// an empty pointer if no index is on exactly these fields
+		template<typename... FieldIds>
+		IndexPtr findIndex(FieldIds... fieldIds)
 		{
 			FieldSet fields;
 			fieldSetAppender(fields, fieldIds...);
 			
-			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getSharedLock(this);
+			IndexesPtr currentIndexes(boost::atomic_load(&indexes));
 			
-			typename Indexes::const_iterator it = indexes.find(fields);
-			if(it == indexes.end())
-				// TODO: fix
-				throw std::runtime_error("Failed to find index");
+			typename Indexes::const_iterator it = currentIndexes->find(fields);
+			if(it == currentIndexes->end())
+				return IndexPtr();
 			
 			return it->second;
 		}
@@ -427,13 +1085,14 @@ class ModelStore : public ModelStoreBase
 		void updateIndex(ModelClassPtr instance, FieldId fieldId, const FieldType & value)
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getSharedLock(this);
+			transaction->getIntentionSharedLock(this);
+			const ShardPtr& shard(shardFor(instance));
+			transaction->getIntentionSharedLock(shard.get());
 			
-			typename Multimap::right_const_iterator iit = instances.right.find(instance);
-			if(iit == instances.right.end())
+			if(!isStored(instance))
 				return;
 			
-			BOOST_FOREACH(typename Indexes::value_type i, indexes)
+			BOOST_FOREACH(typename Indexes::value_type i, *indexes)
 			{
 				const FieldSet& fieldSet(i.first);
 				if(fieldSet.find(fieldId) != fieldSet.end())
@@ -447,28 +1106,19 @@ class ModelStore : public ModelStoreBase
 		virtual bool hasIndexReferences(const boost::any& instance) const
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getSharedLock(this);
+			transaction->getIntentionSharedLock(this);
 			
-			// go through relation indexes and check if they contain instance
-			BOOST_FOREACH(typename Indexes::value_type i, indexes)
+			RelationDispatchTablePtr table(boost::atomic_load(&relationDispatch));
+			typename RelationDispatchTable::const_iterator it = table->find(std::type_index(instance.type()));
+			if(it == table->end())
+				return false;
+			
+			BOOST_FOREACH(const RelationDispatch& relation, it->second)
 			{
-				IndexPtr index(i.second);
-				
-				if(!index->isRelationIndex())
-					continue;
-				
-				// trying to match relation index pointing to instance
-				if(!index->matchKeyType(instance))
-					continue;
-				
-				try
-				{
-					ModelClassPtr referencingInstance = index->get(instance);
-					if(referencingInstance)
-						if(!referencingInstance->isAutomaticCleanupEnabled())
-							return true;
-				}
-				catch(const InstanceNotFoundException&) { }
+				ModelClassPtr referencingInstance = relation.index->find(instance);
+				if(referencingInstance)
+					if(!referencingInstance->isAutomaticCleanupEnabled())
+						return true;
 			}
 			
 			return false;
@@ -477,7 +1127,7 @@ class ModelStore : public ModelStoreBase
 		virtual bool hasRelationReferences(ModelClassPtr instance) const
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
-			transaction->getSharedLock(this);
+			transaction->getIntentionSharedLock(this);
 			
 			BOOST_FOREACH(typename RelationModels::value_type i, relationModels)
 			{
@@ -499,35 +1149,29 @@ class ModelStore : public ModelStoreBase
 			TransactionPtr transaction = Transaction::startTransaction();
 			transaction->getExclusiveLock(this);
 			
-			for(auto it = instances.begin(); it != instances.end();)
+			BOOST_FOREACH(const ShardPtr& shard, shards)
 			{
-				ModelClassPtr instance(it->right);
-				if(instance->isAutomaticCleanupEnabled() && !instance->hasReferences())
-				{
-					it = instances.erase(it);
+				// erasing an instance can erase others, so the shard is not changed while it is scanned
+				std::vector<ModelClassPtr> garbage;
+				BOOST_FOREACH(const typename Instances::Entry& i, shard->instances)
+					if(i.value->isAutomaticCleanupEnabled() && !i.value->hasReferences())
+						garbage.push_back(i.value);
+				BOOST_FOREACH(ModelClassPtr instance, garbage)
 					instance->erase();
-					continue;
-				}
-				++it;
 			}
 		}
 		
-		virtual FieldPolicies::FieldPolicy getFieldDeletePolicy(FieldId fieldId)
+		virtual FieldPolicies::FieldPolicy getFieldDeletePolicy(FieldId fieldId) const
 		{
-			// for each registered models
 			BOOST_FOREACH(typename ModelClasses::value_type it, models)
 			{
-				ModelContainerPtr model(it.second);
-				
-				// TODO: remove construct() call
-				ModelClassPtr instance = model->construct();
-				BOOST_FOREACH(const FieldBase* field, model->getModelInstanceFields(instance))
+				BOOST_FOREACH(const FieldDescriptor& field, it.second->getFieldDescriptors())
 				{
-					if(field->getFieldId() == fieldId)
+					if(field.id == fieldId)
 					{
-						if(field->policyExists(FieldPolicies::OnDeleteErase))
+						if(field.policies & FieldPolicies::OnDeleteErase)
 							return FieldPolicies::OnDeleteErase;
-						if(field->policyExists(FieldPolicies::OnDeleteSetToNull))
+						if(field.policies & FieldPolicies::OnDeleteSetToNull)
 							return FieldPolicies::OnDeleteSetToNull;
 						return FieldPolicies::None;
 					}
@@ -539,33 +1183,18 @@ class ModelStore : public ModelStoreBase
 		
 		virtual void triggerRelationModelDeleteEvent(const boost::any& deletingInstance)
 		{
-			// go through relation indexes and trigger delete event on each instance that points to deletingInstance
+			// go through the relation indexes pointing to the type of deletingInstance and trigger the delete event on each instance that points to it
+			RelationDispatchTablePtr table(boost::atomic_load(&relationDispatch));
+			typename RelationDispatchTable::const_iterator it = table->find(std::type_index(deletingInstance.type()));
+			if(it == table->end())
+				return;
 			
-			BOOST_FOREACH(typename Indexes::value_type ind, indexes)
+			BOOST_FOREACH(const RelationDispatch& relation, it->second)
 			{
-				IndexPtr index = ind.second;
-				
-				if(!index->isRelationIndex())
-					continue;
-				
-				// trying to match relation index pointing to deletingInstance
-				if(!index->matchKeyType(deletingInstance))
-					continue;
-				
-				const FieldSet& fieldIds = ind.first;
-				
-				// ignore compound indexes
-				if(fieldIds.size() != 1)
-					continue;
-				
-				FieldId fieldId = *(fieldIds.begin());
-				
-				FieldPolicies::FieldPolicy deletePolicy(getFieldDeletePolicy(fieldId));
-				
-				ModelListPtr list = index->getList(deletingInstance);
+				ModelListPtr list = relation.index->getList(deletingInstance);
 				BOOST_FOREACH(ModelClassPtr& instance, *list)
 				{
-					switch(deletePolicy)
+					switch(relation.deletePolicy)
 					{
 						case FieldPolicies::None:
 							// erase if no flag is set
@@ -573,14 +1202,8 @@ class ModelStore : public ModelStoreBase
 							instance->erase();
 							break;
 						case FieldPolicies::OnDeleteSetToNull:
-							BOOST_FOREACH(FieldBase* field, getModelInstanceFields(instance))
-							{
-								if(field->getFieldId() == fieldId)
-								{
-									field->reset();
-									break;
-								}
-							}
+							if(FieldBase* field = relation.field(instance))
+								field->reset();
 					}
 				}
 			}
@@ -591,20 +1214,51 @@ class ModelStore : public ModelStoreBase
 			TransactionPtr transaction = Transaction::startTransaction();
 			transaction->getExclusiveLock(this);
 			
-			BOOST_FOREACH(typename Multimap::left_const_reference& i, instances.left)
-				BOOST_FOREACH(typename RelationModels::value_type r, relationModels)
-					r->triggerRelationModelDeleteEvent(i.second);
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				BOOST_FOREACH(const typename Instances::Entry& i, shard->instances)
+					BOOST_FOREACH(typename RelationModels::value_type r, relationModels)
+						r->triggerRelationModelDeleteEvent(i.value);
 			
-			instances.clear();
-			BOOST_FOREACH(typename Indexes::value_type i, indexes)
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+			{
+				BOOST_FOREACH(const typename Instances::Entry& i, shard->instances)
+				{
+					pendingVersions(shard).erase(i.id);
+					modelOf(i.value).storedIn = NULL;
+				}
+				shard->instances.clear();
+				shard->foreignIds.clear();
+				shard->ids->clear();
+			}
+			BOOST_FOREACH(typename Indexes::value_type i, *indexes)
 				i.second->clear();
 			BOOST_FOREACH(typename Relations::value_type i, relations)
 				i->clear();
 		}
 		
+		std::size_t getShardCount() const
+		{
+			return shards.size();
+		}
+		
+		// every shard gets its own allocator made from prototype, only while the store is empty, the default is a DenseIdAllocator
+		void setIdAllocator(const IdAllocator& prototype)
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getExclusiveLock(this);
+			
+			if(size() != 0)
+				throw std::runtime_error("Changing the id allocator of a store that is not empty");
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				shard->ids.reset(prototype.create(shard->position, shards.size()));
+		}
+		
 		virtual std::size_t size() const
 		{
-			return instances.left.size();
+			std::size_t size = 0;
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				size += shard->instances.size();
+			return size;
 		}
 		
 		virtual void exportJson(const std::string filepath, double* progress = NULL, double* total = NULL) const
@@ -620,24 +1274,51 @@ class ModelStore : public ModelStoreBase
 			
 			boost::posix_time::ptime printTime = boost::posix_time::second_clock::local_time();
 			
-			BOOST_FOREACH(typename Multimap::left_const_reference& i, instances.left)
+			// in order of their ids, so the allocators of the store importing this only see the gaps erased instances left
+			std::vector< std::pair<ID, ModelClassPtr> > instances;
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				BOOST_FOREACH(const typename Instances::Entry& i, shard->instances)
+					instances.push_back(std::make_pair(i.id, i.value));
+			std::sort(instances.begin(), instances.end());
+			
+			// the model names are written once up front, the instances refer to them by their position in that table
+			std::vector<Json::UInt> fileTypes;
 			{
-				Json::Value value;
-				value["id"] = Json::UInt64(i.first);
-				value["model"] = i.second->getModelName();
-				value["fields"] = *(toJson(i.second));
-				writer->write(value, &outfile);
+				Json::Value header;
+				Json::Value& names(header["models"] = Json::Value(Json::arrayValue));
+				BOOST_FOREACH(typename ModelClasses::value_type it, models)
+				{
+					unsigned int tag = it.second->getModelType().tag;
+					if(fileTypes.size() <= tag)
+						fileTypes.resize(tag + 1);
+					fileTypes[tag] = names.size();
+					names.append(it.first);
+				}
+				writer->write(header, &outfile);
 				outfile << std::endl;
-				
-				if(progress != NULL && total != NULL)
+			}
+			
+			{
+				typedef std::pair<ID, ModelClassPtr> Instance;
+				BOOST_FOREACH(const Instance& i, instances)
 				{
-					*progress += 1.0;
-					boost::posix_time::ptime currentTime = boost::posix_time::second_clock::local_time();
-					if(printTime + boost::posix_time::seconds(1) < currentTime)
+					Json::Value value;
+					value["id"] = Json::UInt64(i.first);
+					value["type"] = fileTypes[getModelContainer(i.second)->getModelType().tag];
+					value["fields"] = *(toJson(i.second));
+					writer->write(value, &outfile);
+					outfile << std::endl;
+					
+					if(progress != NULL && total != NULL)
 					{
-						double percent = (*progress / *total) * 100.0;
-						printTime = currentTime;
-						std::cout << "[" << percent << "%] Exporting to " << filepath << std::endl;
+						*progress += 1.0;
+						boost::posix_time::ptime currentTime = boost::posix_time::second_clock::local_time();
+						if(printTime + boost::posix_time::seconds(1) < currentTime)
+						{
+							double percent = (*progress / *total) * 100.0;
+							printTime = currentTime;
+							std::cout << "[" << percent << "%] Exporting to " << filepath << std::endl;
+						}
 					}
 				}
 			}
@@ -660,6 +1341,9 @@ class ModelStore : public ModelStoreBase
 			rbuilder["failIfExtra"] = true;
 			rbuilder["stackLimit"] = 10000;
 			
+			// the model table of the file, files written before there was one name the model of every instance
+			std::vector<ModelContainerPtr> fileModels;
+			
 			std::stringstream data;
 			while(infile.peek() != EOF)
 			{
@@ -694,43 +1378,380 @@ class ModelStore : public ModelStoreBase
 				
 				data.str("");
 				
+				if(root.isMember("models"))
+				{
+					const Json::Value& names(root["models"]);
+					fileModels.clear();
+					for(Json::ArrayIndex i = 0; i < names.size(); i++)
+						fileModels.push_back(findModel(names[i].asString()));
+					continue;
+				}
+				
 				ID id = root["id"].asUInt64();
-				std::string modelName = root["model"].asString();
 				
 				ModelContainerPtr model;
+				if(root.isMember("type"))
 				{
-					typename ModelClasses::const_iterator it = models.find(modelName);
-					if(it == models.end())
-						throw std::runtime_error("Invalid model '" + modelName + "'");
-					model = it->second;
+					Json::UInt type = root["type"].asUInt();
+					if(type >= fileModels.size())
+						throw std::runtime_error("Invalid model type " + boost::lexical_cast<std::string>(type));
+					model = fileModels[type];
 				}
+				else
+					model = findModel(root["model"].asString());
 				
 				ModelClassPtr instance = fromJson(model, root["fields"]);
 				
-				typename Multimap::left_const_iterator idit = instances.left.find(id);
-				typename Multimap::right_const_iterator init = instances.right.find(instance);
-				if(init != instances.right.end() || idit != instances.left.end())
+				const ShardPtr& shard(shardFor(instance));
+				const ShardPtr& idShard(shardForId(id));
+				if(isStored(instance) || isIdTaken(idShard, id))
 					throw std::runtime_error("Model " + boost::lexical_cast<std::string>(id) + " already exists");
-				instances.insert(IndexElementType(id, instance));
+				insertInstance(shard, id, instance);
+				// keep the id from being generated again in the shard it points to
+				idShard->ids->reserve(id);
+				if(idShard != shard)
+					idShard->foreignIds.insert(id);
 				updateIndexes(instance);
 			}
 			
 			infile.close();
 		}
 		
+		// whole-store operations write to the shards under the exclusive store lock alone
+		virtual void beforeExclusiveUnlock(const Transaction* transaction) const
+		{
+			publish(transaction);
+		}
+		
 	private:
 		
-		ID generateId(ModelClassPtr instance) const
+		// a step of getIntersection()
+		struct IndexLookup
+		{
+			IndexPtr index;
+			const boost::any* key;
+			std::size_t matches;
+			
+			static bool fewerMatches(const IndexLookup& a, const IndexLookup& b)
+			{
+				return a.matches < b.matches;
+			}
+		};
+		
+		// calls visitor with the candidates that match the lookups from first on
+		template<typename Visitor>
+		struct VisitMatching
+		{
+			VisitMatching(const std::vector<IndexLookup>& l, Visitor& v, std::size_t f) : lookups(l), visitor(v), first(f) { }
+			
+			bool operator()(const ModelClassPtr& instance) const
+			{
+				for(std::size_t i = first; i < lookups.size(); i++)
+					if(!lookups[i].index->contains(*lookups[i].key, instance))
+						return true;
+				return visitor(instance);
+			}
+			
+			const std::vector<IndexLookup>& lookups;
+			Visitor& visitor;
+			std::size_t first;
+		};
+		
+		struct AppendToList
+		{
+			AppendToList(typename ModelListPtr::element_type& l) : list(l) { }
+			
+			bool operator()(const ModelClassPtr& instance) const
+			{
+				list.push_back(instance);
+				return true;
+			}
+			
+			typename ModelListPtr::element_type& list;
+		};
+		
+		struct KeepFirst
+		{
+			KeepFirst(ModelClassPtr& i) : instance(i) { }
+			
+			bool operator()(const ModelClassPtr& i) const
+			{
+				instance = i;
+				return false;
+			}
+			
+			ModelClassPtr& instance;
+		};
+		
+		// appends the instances of the ids it is called with to list, ids of erased instances are skipped
+		struct AppendInstance
 		{
-			ID id = key_hash(instance);
+			AppendInstance(const ModelStore& s, typename ModelListPtr::element_type& l) : store(s), list(l) { }
 			
-			while(true)
+			bool operator()(ID id) const
 			{
-				typename Multimap::left_const_iterator it = instances.left.find(id);
-				if(it == instances.left.end())
-					return id;
-				id++;
+				const ModelClassPtr* instance = store.findLockedInstance(id);
+				if(instance)
+					list.push_back(*instance);
+				return true;
 			}
+			
+			const ModelStore& store;
+			typename ModelListPtr::element_type& list;
+		};
+		
+		template<typename Visitor>
+		struct VisitInstance
+		{
+			VisitInstance(const ModelStore& s, Visitor& v) : store(s), visitor(v) { }
+			
+			bool operator()(ID id) const
+			{
+				const ModelClassPtr* instance = store.findLockedInstance(id);
+				return !instance || visitor(*instance);
+			}
+			
+			const ModelStore& store;
+			Visitor& visitor;
+		};
+		
+		// part of the instances with its own lock, instances are spread over the shards by their hash
+		// and the ids generated for them point back to the same shard and index its slots,
+		// changing which instances a shard holds takes its exclusive lock, instance level access the intention locks
+		class Shard : public Lockable
+		{
+			public:
+				
+				Shard(const ModelStore& s, std::size_t p, std::size_t count) : instances(p, count), versions(new InstanceVersions(p, count)), pendingOwner(NULL), ids(new DenseIdAllocator(p, count)), position(p), store(s)
+				{
+					// a call site touches a different shard for every instance, locking them preemptively would serialize it again
+					setLockHistoryEnabled(count == 1);
+				}
+				
+				// publishes the changes made under the exclusive lock to snapshot readers
+				virtual void beforeExclusiveUnlock(const Transaction* transaction) const
+				{
+					if(pendingOwner.load(boost::memory_order_relaxed) == transaction)
+						store.publish(transaction);
+				}
+				
+				Instances instances;
+				// imported ids that point to this shard but belong to instances in other shards
+				boost::unordered_set<ID> foreignIds;
+				InstanceVersionsPtr versions;
+				// transaction whose changes to versions are not published yet
+				boost::atomic<const Transaction*> pendingOwner;
+				boost::scoped_ptr<IdAllocator> ids;
+				const std::size_t position;
+				
+			private:
+				
+				const ModelStore& store;
+		};
+		typedef boost::shared_ptr<Shard> ShardPtr;
+		typedef std::vector<ShardPtr> Shards;
+		
+		const ShardPtr& shardFor(const ModelClassPtr& instance) const
+		{
+			return shards[key_shard(instance, shards.size())];
+		}
+		
+		const ShardPtr& shardForId(ID id) const
+		{
+			return shards[id % shards.size()];
+		}
+		
+		static const Lockable* instanceLock(const ModelClassPtr& instance)
+		{
+			return &modelOf(instance).instanceLock;
+		}
+		
+		static std::string fieldsToString(const FieldSet& fields)
+		{
+			std::string ids;
+			BOOST_FOREACH(FieldId id, fields)
+				ids += (ids.empty() ? "" : ",") + boost::lexical_cast<std::string>(id);
+			return ids;
+		}
+		
+		std::string indexLockName(const FieldSet& fields) const
+		{
+			return getLockName().empty() ? std::string() : getLockName() + "/index/" + fieldsToString(fields);
+		}
+		
+		// looks id up in the shard it points to, imported ids may belong to an instance in any shard
+		ModelClassPtr findInstance(ID id) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			const ShardPtr& shard(shardForId(id));
+			transaction->getIntentionSharedLock(shard.get());
+			
+			ModelClassPtr instance(shard->instances.find(id));
+			if(instance || shard->foreignIds.find(id) == shard->foreignIds.end())
+				return instance;
+			
+			BOOST_FOREACH(const ShardPtr& other, shards)
+				transaction->getIntentionSharedLock(other.get());
+			const ModelClassPtr* found = findLockedInstance(id);
+			return found ? *found : ModelClassPtr();
+		}
+		
+		// findInstance() for callers holding intention locks on all the shards, so looking up many ids locks them once,
+		// NULL if id is free
+		const ModelClassPtr* findLockedInstance(ID id) const
+		{
+			const ShardPtr& shard(shardForId(id));
+			const ModelClassPtr* instance = shard->instances.at(id);
+			if(instance || shard->foreignIds.find(id) == shard->foreignIds.end())
+				return instance;
+			
+			BOOST_FOREACH(const ShardPtr& other, shards)
+			{
+				if(other == shard)
+					continue;
+				instance = other->instances.at(id);
+				if(instance)
+					return instance;
+			}
+			
+			return NULL;
+		}
+		
+		const ModelContainerPtr& findModel(const std::string& name) const
+		{
+			typename ModelClasses::const_iterator it = models.find(name);
+			if(it == models.end())
+				throw std::runtime_error("Invalid model '" + name + "'");
+			return it->second;
+		}
+		
+		// called under the exclusive lock, an empty model removes it
+		void setModelContainer(const ModelType& type, const ModelContainerPtr& model)
+		{
+			boost::shared_ptr<ModelContainers> newContainers(new ModelContainers(*containers));
+			if(newContainers->size() <= type.tag)
+				newContainers->resize(type.tag + 1);
+			(*newContainers)[type.tag] = model;
+			boost::atomic_store(&containers, ModelContainersPtr(newContainers));
+		}
+		
+		// resolves the relation indexes and the delete policies of their fields once, so erasing an instance they point to does not have to,
+		// called under the exclusive lock whenever models or indexes change
+		void updateRelationDispatch()
+		{
+			boost::shared_ptr<RelationDispatchTable> table(new RelationDispatchTable);
+			BOOST_FOREACH(typename Indexes::value_type i, *indexes)
+			{
+				// compound indexes are left alone
+				if(!i.second->isRelationIndex() || i.first.size() != 1)
+					continue;
+				
+				// an index can be added before the model with its field, it is picked up when the model is registered
+				FieldId fieldId = *(i.first.begin());
+				FieldPolicies::FieldPolicy deletePolicy;
+				try
+				{
+					deletePolicy = getFieldDeletePolicy(fieldId);
+				}
+				catch(const std::runtime_error&)
+				{
+					continue;
+				}
+				
+				ModelContainersPtr models(boost::atomic_load(&containers));
+				RelationDispatch relation(fieldId, i.second, deletePolicy, models);
+				for(unsigned int tag = 0; tag < models->size(); tag++)
+				{
+					if(!(*models)[tag])
+						continue;
+					BOOST_FOREACH(const FieldDescriptor& field, (*models)[tag]->getFieldDescriptors())
+					{
+						if(field.id == fieldId)
+						{
+							relation.fields.resize(tag + 1);
+							relation.fields[tag] = &field;
+						}
+					}
+				}
+				(*table)[std::type_index(i.second->getKeyType())].push_back(relation);
+			}
+			boost::atomic_store(&relationDispatch, RelationDispatchTablePtr(table));
+		}
+		
+		// versions of a shard the transaction holds the exclusive lock of, its changes stay pending until it publishes them
+		InstanceVersions& pendingVersions(const ShardPtr& shard) const
+		{
+			shard->pendingOwner.store(Transaction::startTransaction().get(), boost::memory_order_relaxed);
+			return *shard->versions;
+		}
+		
+		// publishes the changes a transaction made in all the shards under one epoch, so snapshots never see half of them
+		void publish(const Transaction* transaction) const
+		{
+			boost::lock_guard<boost::mutex> guard(publishMutex);
+			
+			bool pending = false;
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				if(shard->pendingOwner.load(boost::memory_order_relaxed) == transaction)
+					pending = true;
+			if(!pending)
+				return;
+			
+			Epoch published = epoch.load(boost::memory_order_relaxed) + 1;
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+				if(shard->pendingOwner.load(boost::memory_order_relaxed) == transaction)
+					shard->versions->commit(published);
+			epoch.store(published, boost::memory_order_release);
+			
+			BOOST_FOREACH(const ShardPtr& shard, shards)
+			{
+				if(shard->pendingOwner.load(boost::memory_order_relaxed) != transaction)
+					continue;
+				shard->pendingOwner.store(NULL, boost::memory_order_relaxed);
+				
+				// readers still using the old list keep it alive, it is freed when the last of them is done
+				if(shard->versions->needsCompaction())
+					boost::atomic_store(&shard->versions, shard->versions->compact(published));
+			}
+		}
+		
+		// instances remember their id in the store holding them, so the shards need no map from instances to ids,
+		// both are written under the exclusive lock of the instance's shard and read under at least an intention lock on it
+		static Model<ModelClassPtr>& modelOf(const ModelClassPtr& instance)
+		{
+			return *instance;
+		}
+		
+		bool isStored(const ModelClassPtr& instance) const
+		{
+			return modelOf(instance).storedIn == this;
+		}
+		
+		void insertInstance(const ShardPtr& shard, ID id, ModelClassPtr instance)
+		{
+			shard->instances.insert(id, instance);
+			modelOf(instance).storedIn = this;
+			modelOf(instance).storedId = id;
+			modelOf(instance).instanceLock.setOptimisticReadsEnabled(isOptimisticReadsEnabled());
+			modelOf(instance).instanceLock.setLockStatisticsEnabled(isLockStatisticsEnabled());
+			pendingVersions(shard).insert(id, instance);
+		}
+		
+		bool isIdTaken(const ShardPtr& shard, ID id) const
+		{
+			return shard->instances.find(id) || shard->foreignIds.find(id) != shard->foreignIds.end();
+		}
+		
+		// ids generated for a shard are congruent to its position modulo the shard count, so lookups by id know where to look
+		ID generateId(const ShardPtr& shard) const
+		{
+			// imported ids are reserved with the allocator, this only keeps an allocator that loses track of some from reusing them
+			ID id;
+			do
+			{
+				id = shard->ids->allocate();
+			} while(isIdTaken(shard, id));
+			return id;
 		}
 		
 		virtual void eraseHelper(ModelClassPtr instance)
@@ -738,8 +1759,18 @@ class ModelStore : public ModelStoreBase
 			BOOST_FOREACH(typename RelationModels::value_type i, relationModels)
 				i->triggerRelationModelDeleteEvent(instance);
 			
-			instances.right.erase(instance);
-			BOOST_FOREACH(typename Indexes::value_type i, indexes)
+			const ShardPtr& shard(shardFor(instance));
+			if(isStored(instance))
+			{
+				ID id(modelOf(instance).storedId);
+				pendingVersions(shard).erase(id);
+				// ids imported into another shard stay reserved with their own shard, whose lock is not held here
+				if(shardForId(id) == shard)
+					shard->ids->release(id);
+				shard->instances.erase(id);
+				modelOf(instance).storedIn = NULL;
+			}
+			BOOST_FOREACH(typename Indexes::value_type i, *indexes)
 				i.second->erase(instance);
 			BOOST_FOREACH(typename Relations::value_type i, relations)
 				i->erase(instance);
@@ -754,8 +1785,15 @@ class ModelStore : public ModelStoreBase
 		}
 		
 		ModelClasses models;
-		Multimap instances;
-		Indexes indexes;
+		// the same models by the tags of their types, replaced as a whole so finding the model of an instance takes no lock
+		ModelContainersPtr containers;
+		Shards shards;
+		IndexesPtr indexes;
+		RelationDispatchTablePtr relationDispatch;
+		
+		// last epoch published to snapshot readers, shared by all the shards
+		mutable boost::atomic<Epoch> epoch;
+		mutable boost::mutex publishMutex;
 		Relations relations;
 		RelationModels relationModels;
 };
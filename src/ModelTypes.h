@@ -0,0 +1,68 @@
+#ifndef MODEL_TYPES_H
+#define MODEL_TYPES_H
+
+#include <cstdlib>
+#include <string>
+#include <typeinfo>
+#include <typeindex>
+#include <cxxabi.h>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+inline std::string demangleClassName(const std::type_info& type)
+{
+	std::string name = type.name();
+	#ifdef __GNUC__
+		int status;
+		char *realname = abi::__cxa_demangle(name.c_str(), 0, 0, &status);
+		name = realname;
+		free(realname);
+	#endif
+	
+	return name;
+}
+
+// a model class with the tag stores find it by and its name, demangled once
+struct ModelType
+{
+	ModelType(unsigned int t, const std::string& n) : tag(t), name(n) { }
+	
+	const unsigned int tag;
+	const std::string name;
+};
+
+// numbers the model classes stored through ModelClassPtr in the order they are first seen,
+// so every store of them can keep its models in an array by tag, the types are never freed
+template<typename ModelClassPtr>
+class ModelTypes
+{
+	public:
+		
+		// every thread keeps the types it looked up, so new instances of a class do not wait for each other here
+		static const ModelType& get(const std::type_info& type)
+		{
+			static thread_local boost::unordered_map<std::type_index, const ModelType*> seen;
+			const ModelType*& modelType(seen[std::type_index(type)]);
+			if(!modelType)
+				modelType = &registered(type);
+			return *modelType;
+		}
+		
+	private:
+		
+		// the first lookup of a class on any thread numbers it
+		static const ModelType& registered(const std::type_info& type)
+		{
+			static boost::mutex mutex;
+			static boost::unordered_map<std::type_index, const ModelType*> types;
+			
+			boost::lock_guard<boost::mutex> guard(mutex);
+			const ModelType*& modelType(types[std::type_index(type)]);
+			if(!modelType)
+				modelType = new ModelType(types.size() - 1, demangleClassName(type));
+			return *modelType;
+		}
+};
+
+#endif /* MODEL_TYPES_H */
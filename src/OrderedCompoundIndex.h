@@ -0,0 +1,60 @@
+#ifndef ORDERED_COMPOUND_INDEX_H
+#define ORDERED_COMPOUND_INDEX_H
+
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <typeinfo>
+#include <stdexcept>
+#include <type_traits>
+#include <boost/tuple/tuple.hpp>
+
+template<typename ModelClassPtr, typename... FieldTypes>
+class OrderedCompoundIndex;
+
+#include "OrderedIndex.h"
+#include "CompoundIndex.h"
+
+// compound index in the order of its first field, then its second one and so on,
+// so the instances with the same values of the first fields can be looked up by a tuple of just those
+template<typename ModelClassPtr, typename... FieldTypes>
+class OrderedCompoundIndex : public CompoundKeyIndex< OrderedIndex< ModelClassPtr, boost::tuple< typename FieldTypes::type... > >, FieldTypes... >
+{
+	public:
+		
+		typedef typename Index<ModelClassPtr>::ModelListPtr ModelListPtr;
+		
+		virtual ModelListPtr getPrefixList(const boost::any& prefix, std::size_t limit) const
+		{
+			return getPrefixListHelper(prefix, limit, std::integral_constant<std::size_t, sizeof...(FieldTypes)>());
+		}
+		
+	private:
+		
+		// the tuple of the first fields at indexes
+		template<typename Indexes>
+		struct Prefix;
+		
+		template<std::size_t... indexes>
+		struct Prefix< std::index_sequence<indexes...> >
+		{
+			typedef boost::tuple< typename std::tuple_element< indexes, std::tuple<typename FieldTypes::type...> >::type... > type;
+		};
+		
+		// tries the prefixes from the longest one down
+		template<std::size_t length>
+		ModelListPtr getPrefixListHelper(const boost::any& prefix, std::size_t limit, std::integral_constant<std::size_t, length>) const
+		{
+			typedef typename Prefix< std::make_index_sequence<length> >::type PrefixType;
+			if(prefix.type() == typeid(PrefixType))
+				return this->getPrefixListOf(boost::any_cast<const PrefixType&>(prefix), limit);
+			return getPrefixListHelper(prefix, limit, std::integral_constant<std::size_t, length - 1>());
+		}
+		
+		ModelListPtr getPrefixListHelper(const boost::any&, std::size_t, std::integral_constant<std::size_t, 0>) const
+		{
+			throw std::runtime_error("Prefix does not match the index");
+		}
+};
+
+#endif /* ORDERED_COMPOUND_INDEX_H */
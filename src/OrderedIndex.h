@@ -0,0 +1,148 @@
+#ifndef ORDERED_INDEX_H
+#define ORDERED_INDEX_H
+
+#include <functional>
+#include <utility>
+
+#include "KeyOperators.h"
+
+template<
+	typename ModelClassPtr,
+	typename KeyType,
+	class Compare = std::less<KeyType>
+>
+class OrderedIndex;
+
+#include "ModelStore.h"
+#include "StorageIndex.h"
+#include "OrderedMultimap.h"
+
+// index with its keys in order, for range, prefix, first and last lookups and ordered iteration besides the lookups by key,
+// instances with the same key come in id order; it is not split into shards since those lookups need all keys in one order
+template<
+	typename ModelClassPtr,
+	typename KeyType,
+	class Compare
+>
+class OrderedIndex : public StorageIndex< ModelClassPtr, KeyType, OrderedMultimap< KeyType, typename ModelStore<ModelClassPtr>::ID, ModelClassPtr, Compare > >
+{
+	public:
+		
+		typedef OrderedMultimap< KeyType, typename ModelStore<ModelClassPtr>::ID, ModelClassPtr, Compare > Storage;
+		typedef StorageIndex< ModelClassPtr, KeyType, Storage > ParentClass;
+		typedef typename ParentClass::ModelListPtr ModelListPtr;
+		typedef typename ParentClass::Visitor Visitor;
+		typedef typename ParentClass::AppendInstance AppendInstance;
+		typedef typename ParentClass::VisitInstance VisitInstance;
+		typedef typename ParentClass::KeepFirst KeepFirst;
+		
+		OrderedIndex() : ParentClass(0, 1) { };
+		virtual ~OrderedIndex() { };
+		
+		virtual bool isOrdered() const { return true; }
+		
+		virtual ModelListPtr getRange(const boost::any& first, const boost::any& last) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			ModelListPtr list(new typename ModelListPtr::element_type);
+			const KeyType& from(boost::any_cast<const KeyType&>(first));
+			const KeyType& to(boost::any_cast<const KeyType&>(last));
+			if(Compare()(to, from))
+				return list;
+			
+			const typename Storage::Keys& keys(this->storage.getKeys());
+			typename Storage::const_iterator end = keys.upper_bound(to);
+			for(typename Storage::const_iterator it = keys.lower_bound(from); it != end; ++it)
+				this->storage.forEach(it->ids, AppendInstance(*list));
+			
+			return list;
+		}
+		
+		virtual ModelClassPtr findFirst() const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			ModelClassPtr instance;
+			const typename Storage::Keys& keys(this->storage.getKeys());
+			if(!keys.empty())
+				this->storage.forEach(keys.begin()->ids, KeepFirst(instance));
+			return instance;
+		}
+		
+		virtual ModelClassPtr findLast() const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			ModelClassPtr instance;
+			const typename Storage::Keys& keys(this->storage.getKeys());
+			if(!keys.empty())
+				this->storage.forEach(keys.rbegin()->ids, KeepFirst(instance));
+			return instance;
+		}
+		
+		// the instances with the same key come in id order either way
+		virtual bool forEachInOrder(const Visitor& visitor, bool reverse) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			const typename Storage::Keys& keys(this->storage.getKeys());
+			if(reverse)
+			{
+				for(typename Storage::const_reverse_iterator it = keys.rbegin(); it != keys.rend(); ++it)
+					if(!this->storage.forEach(it->ids, VisitInstance(visitor)))
+						return false;
+			}
+			else
+			{
+				for(typename Storage::const_iterator it = keys.begin(); it != keys.end(); ++it)
+					if(!this->storage.forEach(it->ids, VisitInstance(visitor)))
+						return false;
+			}
+			
+			return true;
+		}
+		
+	protected:
+		
+		// at most limit instances whose keys start with prefix, see ordered_key_operators::compare_prefix(),
+		// Compare has to order the keys like operator< does
+		template<typename PrefixType>
+		ModelListPtr getPrefixListOf(const PrefixType& prefix, std::size_t limit) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			ModelListPtr list(new typename ModelListPtr::element_type);
+			std::pair<typename Storage::const_iterator, typename Storage::const_iterator> range = this->storage.getKeys().range(ordered_key_operators::prefix_lower_bound<PrefixType>(prefix), ordered_key_operators::prefix_upper_bound<PrefixType>(prefix));
+			for(typename Storage::const_iterator it = range.first; it != range.second && list->size() < limit; ++it)
+				this->storage.forEach(it->ids, AppendFirst(*list, limit));
+			
+			return list;
+		}
+		
+	private:
+		
+		// appends instances until list has limit of them
+		struct AppendFirst
+		{
+			AppendFirst(typename ModelListPtr::element_type& l, std::size_t m) : list(l), limit(m) { }
+			
+			bool operator()(typename ParentClass::ID, const ModelClassPtr& instance) const
+			{
+				if(list.size() == limit)
+					return false;
+				list.push_back(instance);
+				return true;
+			}
+			
+			typename ModelListPtr::element_type& list;
+			std::size_t limit;
+		};
+};
+
+#endif /* ORDERED_INDEX_H */
@@ -0,0 +1,156 @@
+#ifndef ORDERED_MULTIMAP_H
+#define ORDERED_MULTIMAP_H
+
+#include <cstddef>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/member.hpp>
+
+#include "InstanceSlots.h"
+#include "Bitmap.h"
+
+// Keys in order to the ids of their values and ids back to their value and key, the storage of ordered indexes.
+// Like FlatMultimap but the bitmaps of the keys are in an ordered tree, so they can be walked in key order and
+// looked up by ranges of keys, and every id remembers the node of its key.
+template<typename Key, typename ID, typename Value, class Compare>
+class OrderedMultimap
+{
+	public:
+		
+		struct Postings
+		{
+			explicit Postings(const Key& k) : key(k) { }
+			
+			Key key;
+			// not part of the order
+			mutable Bitmap ids;
+		};
+		
+		typedef boost::multi_index_container<
+			Postings,
+			boost::multi_index::indexed_by< boost::multi_index::ordered_unique< boost::multi_index::member<Postings, Key, &Postings::key>, Compare > >
+		> Keys;
+		typedef typename Keys::const_iterator const_iterator;
+		typedef typename Keys::const_reverse_iterator const_reverse_iterator;
+		
+		OrderedMultimap(std::size_t position, std::size_t count) : locations(position, count) { }
+		
+		// the keys in order with their ids
+		const Keys& getKeys() const
+		{
+			return keys;
+		}
+		
+		// NULL if key has no values
+		const Bitmap* find(const Key& key) const
+		{
+			const_iterator it = keys.find(key);
+			return it == keys.end() ? NULL : &it->ids;
+		}
+		
+		// NULL if id is not there
+		const Value* at(ID id) const
+		{
+			const Location* location = locations.at(id);
+			return location ? &location->value : NULL;
+		}
+		
+		std::size_t count(const Key& key) const
+		{
+			const Bitmap* ids = find(key);
+			return ids ? ids->size() : 0;
+		}
+		
+		bool contains(const Key& key, ID id) const
+		{
+			const Bitmap* ids = find(key);
+			return ids && ids->contains(id);
+		}
+		
+		// calls visitor with the ids of key from first on and their values in id order, see Bitmap::forEach()
+		template<typename Visitor>
+		bool forEach(const Key& key, Visitor visitor, ID first = 0) const
+		{
+			const Bitmap* ids = find(key);
+			return !ids || forEach(*ids, visitor, first);
+		}
+		
+		// the same for ids from anywhere, ids that are not here are left out
+		template<typename Visitor>
+		bool forEach(const Bitmap& ids, Visitor visitor, ID first = 0) const
+		{
+			return ids.forEach(VisitValue<Visitor>(*this, visitor), first);
+		}
+		
+		// takes the place of what id had before
+		void insert(const Key& key, ID id, const Value& value)
+		{
+			erase(id);
+			
+			const_iterator it = keys.insert(Postings(key)).first;
+			it->ids.insert(id);
+			Location location;
+			location.value = value;
+			location.postings = it;
+			locations.insert(id, location);
+		}
+		
+		bool erase(ID id)
+		{
+			const Location* location = locations.at(id);
+			if(!location)
+				return false;
+			
+			const_iterator it = location->postings;
+			it->ids.erase(id);
+			locations.erase(id);
+			if(it->ids.empty())
+				keys.erase(it);
+			return true;
+		}
+		
+		void clear()
+		{
+			keys.clear();
+			locations.clear();
+		}
+		
+		// the number of values
+		std::size_t size() const
+		{
+			return locations.size();
+		}
+		
+	private:
+		
+		// an empty value marks a free slot, see InstanceSlots
+		struct Location
+		{
+			explicit operator bool() const { return bool(value); }
+			
+			Value value;
+			const_iterator postings;
+		};
+		
+		typedef InstanceSlots<ID, Location> Locations;
+		
+		template<typename Visitor>
+		struct VisitValue
+		{
+			VisitValue(const OrderedMultimap& m, Visitor& v) : multimap(m), visitor(v) { }
+			
+			bool operator()(ID id) const
+			{
+				const Value* value = multimap.at(id);
+				return !value || visitor(id, *value);
+			}
+			
+			const OrderedMultimap& multimap;
+			Visitor& visitor;
+		};
+		
+		Keys keys;
+		Locations locations;
+};
+
+#endif /* ORDERED_MULTIMAP_H */
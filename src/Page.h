@@ -0,0 +1,122 @@
+#ifndef PAGE_H
+#define PAGE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/smart_ptr.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+// where a paged lookup goes on, results are paged in the order of the store ids of the instances and the token is
+// the first id of the next page, so it stays valid while instances come and go and means the same after a restart:
+// no instance is returned twice by one lookup, instances erased before their page comes are not returned,
+// and instances added meanwhile are returned if they sort after the page that is current when they are added
+class PageToken
+{
+	public:
+		
+		// the first page
+		PageToken() : start(0), done(false) { }
+		explicit PageToken(std::size_t s) : start(s), done(false) { }
+		// the same as toString() returned, like when a client sends it back
+		explicit PageToken(const std::string& token) : start(0), done(token.empty())
+		{
+			if(!done)
+				start = boost::lexical_cast<std::size_t>(token);
+		}
+		
+		static PageToken end()
+		{
+			PageToken token;
+			token.done = true;
+			return token;
+		}
+		
+		// empty for the end
+		std::string toString() const
+		{
+			return done ? std::string() : boost::lexical_cast<std::string>(start);
+		}
+		
+		std::size_t getStart() const { return start; }
+		// there are no more pages
+		bool isEnd() const { return done; }
+		
+	private:
+		
+		std::size_t start;
+		bool done;
+};
+
+template<typename ValueType>
+struct Page
+{
+	typedef boost::shared_ptr< std::vector<ValueType> > ListPtr;
+	
+	Page() : values(new std::vector<ValueType>), next(PageToken::end()) { }
+	
+	ListPtr values;
+	PageToken next;
+};
+
+// page values taken from the elements themselves or from the second member of pairs
+struct ValueItself
+{
+	template<typename ValueType>
+	const ValueType& operator()(const ValueType& value) const { return value; }
+};
+struct PairSecond
+{
+	template<typename Pair>
+	auto operator()(const Pair& pair) const -> decltype((pair.second)) { return pair.second; }
+};
+
+template<typename ModelClassPtr>
+class ModelStore;
+
+// the page of the values from begin to end whose store ids are at or after token, in id order, for lookups that do not
+// keep their instances by id: only the page is copied and sorted so it costs a scan of the range plus sorting the page
+template<typename ValueType, typename Iterator, typename GetValue>
+Page<ValueType> pageById(Iterator begin, Iterator end, const PageToken& token, std::size_t limit, GetValue getValue)
+{
+	typedef std::pair<std::size_t, const ValueType*> Candidate;
+	
+	Page<ValueType> page;
+	if(token.isEnd() || limit == 0)
+		return page;
+	
+	// the limit + 1 lowest ids in a max heap, the extra one tells if there is another page
+	std::vector<Candidate> lowest;
+	lowest.reserve(limit + 1);
+	for(; begin != end; ++begin)
+	{
+		const ValueType& value(getValue(*begin));
+		std::size_t id = ModelStore<ValueType>::storedId(value);
+		if(id < token.getStart())
+			continue;
+		if(lowest.size() == limit + 1)
+		{
+			if(id > lowest.front().first)
+				continue;
+			std::pop_heap(lowest.begin(), lowest.end());
+			lowest.pop_back();
+		}
+		lowest.push_back(Candidate(id, &value));
+		std::push_heap(lowest.begin(), lowest.end());
+	}
+	
+	std::sort(lowest.begin(), lowest.end());
+	if(lowest.size() > limit)
+	{
+		page.next = PageToken(lowest[limit].first);
+		lowest.pop_back();
+	}
+	page.values->reserve(lowest.size());
+	BOOST_FOREACH(const Candidate& i, lowest)
+		page.values->push_back(*i.second);
+	return page;
+}
+
+#endif /* PAGE_H */
@@ -0,0 +1,60 @@
+#include <boost/foreach.hpp>
+
+#include "PhaseFairLock.h"
+#include "Lockable.h"
+
+using namespace LockModes;
+
+bool PhaseFairLock::queuesBehind(LockMode mode, Ticket ticket, LockMode waitingMode, Ticket waitingTicket) const
+{
+	boost::lock_guard<boost::mutex> guard(mutex);
+	
+	Waiter waiting(waitingTicket, waitingMode);
+	waiting.admitted = isAdmitted(waitingTicket);
+	return waitsFor(mode, ticket, isAdmitted(ticket), waiting);
+}
+
+bool PhaseFairLock::grantable(LockMode held, LockMode mode, Ticket ticket) const
+{
+	if(!compatibleWithGranted(held, mode))
+		return false;
+	
+	if(held != None)
+		return true;
+	
+	bool admitted = isAdmitted(ticket);
+	BOOST_FOREACH(const Waiter& i, waiters)
+		if(i.ticket != ticket && waitsFor(mode, ticket, admitted, i))
+			return false;
+	
+	return true;
+}
+
+void PhaseFairLock::released(LockMode held)
+{
+	if(isRead(held))
+		return;
+	
+	// the writer phase is over, everybody who waited to read through it goes next
+	BOOST_FOREACH(Waiter& i, waiters)
+		if(isRead(i.mode))
+			i.admitted = true;
+}
+
+bool PhaseFairLock::isAdmitted(Ticket ticket) const
+{
+	BOOST_FOREACH(const Waiter& i, waiters)
+		if(i.ticket == ticket)
+			return i.admitted;
+	return false;
+}
+
+bool PhaseFairLock::waitsFor(LockMode mode, Ticket ticket, bool admitted, const Waiter& waiting)
+{
+	if(Lockable::compatible(mode, waiting.mode) || admitted)
+		return false;
+	// admitted readers go before anybody else
+	if(waiting.admitted)
+		return true;
+	return waiting.ticket < ticket;
+}
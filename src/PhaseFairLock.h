@@ -0,0 +1,26 @@
+#ifndef PHASE_FAIR_LOCK_H
+#define PHASE_FAIR_LOCK_H
+
+#include "QueueLock.h"
+
+// incompatible requests are served in ticket order, first come first served within a priority class, except that a writer leaving
+// lets every reader waiting at that moment in before the next writer, so readers wait for at most one writer and writers never starve behind a stream of readers
+class PhaseFairLock : public QueueLock
+{
+	public:
+		
+		virtual bool queuesBehind(LockMode mode, Ticket ticket, LockMode waitingMode, Ticket waitingTicket) const;
+		
+	protected:
+		
+		virtual bool grantable(LockMode held, LockMode mode, Ticket ticket) const;
+		virtual void released(LockMode held);
+		
+	private:
+		
+		// must be called with mutex held
+		bool isAdmitted(Ticket ticket) const;
+		static bool waitsFor(LockMode mode, Ticket ticket, bool admitted, const Waiter& waiting);
+};
+
+#endif /* PHASE_FAIR_LOCK_H */
@@ -0,0 +1,123 @@
+#include <limits>
+#include <boost/foreach.hpp>
+
+#include "QueueLock.h"
+#include "Lockable.h"
+
+using namespace LockModes;
+
+QueueLock::QueueLock()
+{
+	for(unsigned int i = 0; i < Count; i++)
+		granted[i] = 0;
+}
+
+bool QueueLock::tryLock(LockMode held, LockMode mode)
+{
+	boost::lock_guard<boost::mutex> guard(mutex);
+	
+	if(!grantable(held, mode, std::numeric_limits<Ticket>::max()))
+		return false;
+	grant(held, mode);
+	return true;
+}
+
+bool QueueLock::lock(LockMode held, LockMode mode, Ticket ticket, const boost::chrono::milliseconds& timeout)
+{
+	boost::chrono::steady_clock::time_point deadline = boost::chrono::steady_clock::now() + timeout;
+	boost::unique_lock<boost::mutex> guard(mutex);
+	
+	waiters.push_back(Waiter(ticket, mode));
+	
+	bool acquired = true;
+	while(!grantable(held, mode, ticket))
+	{
+		if(changed.wait_until(guard, deadline) == boost::cv_status::timeout && !grantable(held, mode, ticket))
+		{
+			acquired = false;
+			break;
+		}
+	}
+	
+	for(std::vector<Waiter>::iterator it = waiters.begin(); it != waiters.end(); ++it)
+	{
+		if(it->ticket == ticket)
+		{
+			waiters.erase(it);
+			break;
+		}
+	}
+	
+	if(acquired)
+		grant(held, mode);
+	else if(!waiters.empty())
+		// requests queued behind this one may be able to go now
+		changed.notify_all();
+	
+	return acquired;
+}
+
+void QueueLock::unlock(LockMode held, LockMode mode)
+{
+	boost::lock_guard<boost::mutex> guard(mutex);
+	granted[held]--;
+	if(mode != None)
+		granted[mode]++;
+	released(held);
+	if(!waiters.empty())
+		changed.notify_all();
+}
+
+bool QueueLock::queuesBehind(LockMode mode, Ticket ticket, LockMode waitingMode, Ticket waitingTicket) const
+{
+	if(waitingTicket >= ticket)
+		return false;
+	if(waitingMode == Exclusive && mode != Exclusive)
+		return true;
+	return queuesAcrossClasses(ticket, waitingTicket) && !Lockable::compatible(mode, waitingMode);
+}
+
+bool QueueLock::isLocked() const
+{
+	boost::lock_guard<boost::mutex> guard(mutex);
+	
+	for(unsigned int i = IntentionShared; i < Count; i++)
+		if(granted[i] != 0)
+			return true;
+	return !waiters.empty();
+}
+
+bool QueueLock::grantable(LockMode held, LockMode mode, Ticket ticket) const
+{
+	if(!compatibleWithGranted(held, mode))
+		return false;
+	
+	// a conversion cannot queue behind requests that wait for the mode it already holds
+	if(held != None)
+		return true;
+	
+	BOOST_FOREACH(const Waiter& i, waiters)
+		if(queuesBehind(mode, ticket, i.mode, i.ticket))
+			return false;
+	
+	return true;
+}
+
+bool QueueLock::compatibleWithGranted(LockMode held, LockMode mode) const
+{
+	for(unsigned int i = IntentionShared; i < Count; i++)
+	{
+		unsigned int others = granted[i] - (i == held ? 1 : 0);
+		if(others != 0 && !Lockable::compatible(mode, static_cast<LockMode>(i)))
+			return false;
+	}
+	
+	return true;
+}
+
+void QueueLock::grant(LockMode held, LockMode mode)
+{
+	if(held != None)
+		granted[held]--;
+	granted[mode]++;
+}
@@ -0,0 +1,53 @@
+#ifndef QUEUE_LOCK_H
+#define QUEUE_LOCK_H
+
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "ModeLock.h"
+
+class QueueLock : public ModeLock
+{
+	public:
+		
+		QueueLock();
+		virtual ~QueueLock() { };
+		
+		virtual bool tryLock(LockMode held, LockMode mode);
+		virtual bool lock(LockMode held, LockMode mode, Ticket ticket, const boost::chrono::milliseconds& timeout);
+		virtual void unlock(LockMode held, LockMode mode);
+		
+		// a waiting exclusive request blocks new weaker ones so a stream of readers cannot starve it,
+		// and any waiting request blocks incompatible ones of other priority classes with later tickets,
+		// anything else is granted as soon as it is compatible with the granted modes to avoid convoys
+		virtual bool queuesBehind(LockMode mode, Ticket ticket, LockMode waitingMode, Ticket waitingTicket) const;
+		
+		virtual bool isLocked() const;
+		
+	protected:
+		
+		struct Waiter
+		{
+			Waiter(Ticket t, LockMode m) : ticket(t), mode(m), admitted(false) { }
+			
+			Ticket ticket;
+			LockMode mode;
+			// only used by PhaseFairLock
+			bool admitted;
+		};
+		
+		// all of these must be called with mutex held
+		virtual bool grantable(LockMode held, LockMode mode, Ticket ticket) const;
+		// called after held was released or downgraded
+		virtual void released(LockMode) { };
+		bool compatibleWithGranted(LockMode held, LockMode mode) const;
+		void grant(LockMode held, LockMode mode);
+		
+		mutable boost::mutex mutex;
+		boost::condition_variable changed;
+		unsigned int granted[LockModes::Count];
+		std::vector<Waiter> waiters;
+};
+
+#endif /* QUEUE_LOCK_H */
@@ -20,14 +20,17 @@ class RelationField : public IndexedField<RelationModelClassPtr, fieldId, ModelC
 		: parentClass(v)
 		{ }
 		
-		virtual void registerField() const
+		static void registerField()
 		{
-			typedef boost::shared_ptr< Index<ModelClassPtr> > IndexPtr;
-			IndexPtr index(new RelationIndex<ModelClassPtr, RelationModelClassPtr>);
-			ModelStoreGetter<ModelClassPtr>()().addIndex(index, fieldId);
+			ModelStoreGetter<ModelClassPtr>()().template addShardedIndex< RelationIndex<ModelClassPtr, RelationModelClassPtr> >(fieldId);
 			ModelStoreGetter<RelationModelClassPtr>()().registerRelationModelStore(&ModelStoreGetter<ModelClassPtr>()());
 		}
 		
+		virtual typename parentClass::Registration getRegistration() const
+		{
+			return &RelationField::registerField;
+		}
+		
 		virtual const RelationModelClassPtr& operator=(const RelationModelClassPtr& rhs)
 		{
 			// check to make sure this instance has been stored
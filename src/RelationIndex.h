@@ -11,7 +11,13 @@ class RelationIndex;
 template<typename ModelClassPtr, typename KeyModelClassPtr>
 class RelationIndex : public HashIndex< ModelClassPtr, KeyModelClassPtr, value_key_operators::hash<KeyModelClassPtr>, value_key_operators::equality<KeyModelClassPtr> >
 {
-	virtual bool isRelationIndex() const { return true; }
+	public:
+		
+		typedef HashIndex< ModelClassPtr, KeyModelClassPtr, value_key_operators::hash<KeyModelClassPtr>, value_key_operators::equality<KeyModelClassPtr> > ParentClass;
+		
+		RelationIndex(std::size_t position = 0, std::size_t count = 1) : ParentClass(position, count) { };
+		
+		virtual bool isRelationIndex() const { return true; }
 };
 
 #endif /* RELATION_INDEX_H */
@@ -31,6 +31,7 @@ template<typename ModelAClassPtr, typename ModelBClassPtr>
 class RelationStore;
 
 #include "InstanceNotFoundException.h"
+#include "Page.h"
 #include "KeyOperators.h"
 #include "Lockable.h"
 #include "Model.h"
@@ -197,6 +198,53 @@ class RelationStore : public RelationStoreBase<ModelAClassPtr>, public RelationS
 			return list;
 		}
 		
+		// a page of getList() in the order of the store ids of the related instances, see PageToken
+		Page<ModelBClassPtr> getPage(ModelAClassPtr instance, const PageToken& token, std::size_t limit) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			std::pair<typename Multimap::left_const_iterator, typename Multimap::left_const_iterator> range = relations.left.equal_range(instance);
+			return pageById<ModelBClassPtr>(range.first, range.second, token, limit, PairSecond());
+		}
+		
+		Page<ModelAClassPtr> getPage(ModelBClassPtr instance, const PageToken& token, std::size_t limit) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			std::pair<typename Multimap::right_const_iterator, typename Multimap::right_const_iterator> range = relations.right.equal_range(instance);
+			return pageById<ModelAClassPtr>(range.first, range.second, token, limit, PairSecond());
+		}
+		
+		// like getList() without copying the related instances into a list, visitor returns false to stop and so does forEach(),
+		// the relation store stays locked for sharing meanwhile
+		template<typename Visitor>
+		bool forEach(ModelAClassPtr instance, Visitor visitor) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			std::pair<typename Multimap::left_const_iterator, typename Multimap::left_const_iterator> range = relations.left.equal_range(instance);
+			BOOST_FOREACH(typename Multimap::left_const_reference& i, range)
+				if(!visitor(i.second))
+					return false;
+			return true;
+		}
+		
+		template<typename Visitor>
+		bool forEach(ModelBClassPtr instance, Visitor visitor) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			std::pair<typename Multimap::right_const_iterator, typename Multimap::right_const_iterator> range = relations.right.equal_range(instance);
+			BOOST_FOREACH(typename Multimap::right_const_reference& i, range)
+				if(!visitor(i.second))
+					return false;
+			return true;
+		}
+		
 		virtual void exportJson(const std::string filepath) const
 		{
 			TransactionPtr transaction = Transaction::startTransaction();
@@ -0,0 +1,188 @@
+#ifndef SHARDED_INDEX_H
+#define SHARDED_INDEX_H
+
+#include <vector>
+#include <boost/smart_ptr.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+template<typename ModelClassPtr>
+class ShardedIndex;
+
+#include "Index.h"
+#include "KeyOperators.h"
+
+// index split into shards that each have their own lock,
+// instances go to the same shard as in their ModelStore so writers of different shards never meet
+template<typename ModelClassPtr>
+class ShardedIndex : public Index<ModelClassPtr>
+{
+	public:
+		
+		typedef boost::shared_ptr< Index<ModelClassPtr> > IndexPtr;
+		typedef std::vector<IndexPtr> Shards;
+		typedef typename Index<ModelClassPtr>::ModelListPtr ModelListPtr;
+		typedef typename Index<ModelClassPtr>::Visitor Visitor;
+		
+		ShardedIndex(const Shards& s) : shards(s) { };
+		virtual ~ShardedIndex() { };
+		
+		virtual bool matchKeyType(const boost::any& key)
+		{
+			return shards.front()->matchKeyType(key);
+		}
+		
+		virtual const std::type_info& getKeyType() const
+		{
+			return shards.front()->getKeyType();
+		}
+		
+		virtual void store(FieldId id, const boost::any& key, ModelClassPtr instance)
+		{
+			shardFor(instance)->store(id, key, instance);
+		}
+		
+		virtual void erase(ModelClassPtr instance)
+		{
+			shardFor(instance)->erase(instance);
+		}
+		
+		virtual void clear()
+		{
+			BOOST_FOREACH(const IndexPtr& shard, shards)
+				shard->clear();
+		}
+		
+		// lookups by key have to ask every shard, always in the same order
+		virtual ModelListPtr getList(const boost::any& key) const
+		{
+			ModelListPtr list(new typename ModelListPtr::element_type);
+			
+			BOOST_FOREACH(const IndexPtr& shard, shards)
+			{
+				ModelListPtr shardList(shard->getList(key));
+				list->insert(list->end(), shardList->begin(), shardList->end());
+			}
+			
+			return list;
+		}
+		
+		virtual bool forEach(const boost::any& key, const Visitor& visitor) const
+		{
+			BOOST_FOREACH(const IndexPtr& shard, shards)
+				if(!shard->forEach(key, visitor))
+					return false;
+			
+			return true;
+		}
+		
+		virtual std::size_t count(const boost::any& key) const
+		{
+			std::size_t matches = 0;
+			BOOST_FOREACH(const IndexPtr& shard, shards)
+				matches += shard->count(key);
+			
+			return matches;
+		}
+		
+		virtual bool contains(const boost::any& key, const ModelClassPtr& instance) const
+		{
+			return shardFor(instance)->contains(key, instance);
+		}
+		
+		// the next page is somewhere in the pages of the shards one longer than it
+		virtual Page<ModelClassPtr> getPage(const boost::any& key, const PageToken& token, std::size_t limit) const
+		{
+			std::vector<ModelClassPtr> candidates;
+			if(!token.isEnd() && limit != 0)
+			{
+				BOOST_FOREACH(const IndexPtr& shard, shards)
+				{
+					Page<ModelClassPtr> shardPage(shard->getPage(key, token, limit + 1));
+					candidates.insert(candidates.end(), shardPage.values->begin(), shardPage.values->end());
+				}
+			}
+			
+			return pageById<ModelClassPtr>(candidates.begin(), candidates.end(), token, limit, ValueItself());
+		}
+		
+		virtual ModelClassPtr get(const boost::any& key) const
+		{
+			ModelClassPtr instance(find(key));
+			if(instance)
+				return instance;
+			
+			// let a shard throw the not found exception, it knows how to print the key
+			return shards.back()->get(key);
+		}
+		
+		virtual ModelClassPtr find(const boost::any& key) const
+		{
+			BOOST_FOREACH(const IndexPtr& shard, shards)
+			{
+				ModelClassPtr instance(shard->find(key));
+				if(instance)
+					return instance;
+			}
+			
+			return ModelClassPtr();
+		}
+		
+		virtual void setOptimisticReadsEnabled(bool enabled)
+		{
+			BOOST_FOREACH(const IndexPtr& shard, shards)
+				shard->setOptimisticReadsEnabled(enabled);
+		}
+		
+		virtual void setLockPolicy(LockPolicies::LockPolicy policy)
+		{
+			BOOST_FOREACH(const IndexPtr& shard, shards)
+				shard->setLockPolicy(policy);
+		}
+		
+		virtual void setLockStatisticsEnabled(bool enabled)
+		{
+			BOOST_FOREACH(const IndexPtr& shard, shards)
+				shard->setLockStatisticsEnabled(enabled);
+		}
+		
+		virtual void setLockName(const std::string& name)
+		{
+			for(std::size_t i = 0; i < shards.size(); i++)
+				shards[i]->setLockName(name.empty() ? name : name + "/" + boost::lexical_cast<std::string>(i));
+		}
+		
+		virtual LockStatistics getLockStatistics() const
+		{
+			LockStatistics statistics;
+			BOOST_FOREACH(const IndexPtr& shard, shards)
+				statistics += shard->getLockStatistics();
+			return statistics;
+		}
+		
+		virtual bool isBitmap() const { return shards.front()->isBitmap(); }
+		
+		// the shards keep the store ids of their instances, so their bitmaps OR into the ids of the whole store
+		virtual Bitmap getBitmap(const boost::any& key) const
+		{
+			Bitmap ids;
+			BOOST_FOREACH(const IndexPtr& shard, shards)
+				ids |= shard->getBitmap(key);
+			
+			return ids;
+		}
+		
+		virtual bool isRelationIndex() const { return shards.front()->isRelationIndex(); }
+		virtual bool isCompoundIndex() const { return shards.front()->isCompoundIndex(); }
+		
+	private:
+		
+		const IndexPtr& shardFor(ModelClassPtr instance) const
+		{
+			return shards[key_shard(instance, shards.size())];
+		}
+		
+		Shards shards;
+};
+
+#endif /* SHARDED_INDEX_H */
@@ -0,0 +1,113 @@
+#ifndef SMALL_MAP_H
+#define SMALL_MAP_H
+
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <boost/unordered_map.hpp>
+
+// Map for the few keys one transaction touches, like the resources it locked or read. The entries sit in a vector
+// that is searched from the front while it is short and only gets a hash table of positions once it grows, clearing
+// keeps the memory, so the transactions of a thread reusing one map do not allocate. Erasing moves the last entry.
+template<typename Key, typename Value>
+class SmallMap
+{
+	public:
+		
+		typedef std::pair<Key, Value> value_type;
+		typedef typename std::vector<value_type>::iterator iterator;
+		typedef typename std::vector<value_type>::const_iterator const_iterator;
+		
+		iterator begin() { return entries.begin(); }
+		iterator end() { return entries.end(); }
+		const_iterator begin() const { return entries.begin(); }
+		const_iterator end() const { return entries.end(); }
+		
+		std::size_t size() const
+		{
+			return entries.size();
+		}
+		
+		bool empty() const
+		{
+			return entries.empty();
+		}
+		
+		iterator find(const Key& key)
+		{
+			if(entries.size() > scanned)
+			{
+				typename Positions::const_iterator it = positions.find(key);
+				return it == positions.end() ? entries.end() : entries.begin() + it->second;
+			}
+			
+			for(iterator it = entries.begin(); it != entries.end(); ++it)
+				if(it->first == key)
+					return it;
+			return entries.end();
+		}
+		
+		const_iterator find(const Key& key) const
+		{
+			return const_cast<SmallMap&>(*this).find(key);
+		}
+		
+		// leaves the value of a key that is there already, like std::map
+		std::pair<iterator, bool> insert(const value_type& entry)
+		{
+			iterator it = find(entry.first);
+			if(it != entries.end())
+				return std::make_pair(it, false);
+			
+			entries.push_back(entry);
+			if(entries.size() == scanned + 1)
+			{
+				for(std::size_t i = 0; i < entries.size(); i++)
+					positions[entries[i].first] = i;
+			}
+			else if(entries.size() > scanned)
+				positions[entry.first] = entries.size() - 1;
+			return std::make_pair(entries.end() - 1, true);
+		}
+		
+		Value& operator[](const Key& key)
+		{
+			return insert(value_type(key, Value())).first->second;
+		}
+		
+		void erase(iterator it)
+		{
+			bool indexed = entries.size() > scanned;
+			if(indexed)
+				positions.erase(it->first);
+			
+			if(it + 1 != entries.end())
+			{
+				*it = entries.back();
+				if(indexed)
+					positions[it->first] = it - entries.begin();
+			}
+			entries.pop_back();
+			
+			if(entries.size() == scanned)
+				positions.clear();
+		}
+		
+		void clear()
+		{
+			entries.clear();
+			positions.clear();
+		}
+		
+	private:
+		
+		// longer maps get the hash table
+		static const std::size_t scanned = 16;
+		
+		typedef boost::unordered_map<Key, std::size_t> Positions;
+		
+		std::vector<value_type> entries;
+		Positions positions;
+};
+
+#endif /* SMALL_MAP_H */
@@ -0,0 +1,213 @@
+#ifndef STORAGE_INDEX_H
+#define STORAGE_INDEX_H
+
+#include <string>
+#include <boost/smart_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+
+template<typename ModelClassPtr, typename KeyType, class Storage>
+class StorageIndex;
+
+#include "Transaction.h"
+#include "InstanceNotFoundException.h"
+#include "ModelStore.h"
+#include "LockableIndex.h"
+#include "Page.h"
+
+// index answering every lookup by key from Storage, which keeps the instances of every key by their store ids
+// (see FlatMultimap and OrderedMultimap), so the instances of a key come in id order, pages go on from an id
+// and the entry of an instance is found by its id; the indexes only differ in their storage and extra lookups
+template<typename ModelClassPtr, typename KeyType, class Storage>
+class StorageIndex : public LockableIndex<ModelClassPtr>
+{
+	public:
+		
+		typedef ModelClassPtr ValueType;
+		typedef typename ModelStore<ModelClassPtr>::ID ID;
+		
+		typedef typename ModelStore<ModelClassPtr>::ModelListPtr ModelListPtr;
+		typedef typename Index<ModelClassPtr>::Visitor Visitor;
+		
+		// indexes of one store shard get its position and the shard count, see InstanceSlots
+		StorageIndex(std::size_t position, std::size_t count) : storage(position, count) { };
+		virtual ~StorageIndex() { };
+		
+		virtual bool matchKeyType(const boost::any& key)
+		{
+			return key.type() == typeid(KeyType);
+		}
+		
+		virtual const std::type_info& getKeyType() const
+		{
+			return typeid(KeyType);
+		}
+		
+		// entries are written under a short exclusive lock, the instance lock taken by the writer keeps them consistent,
+		// so writers of different instances only wait for each other while they write; see UniqueIndex for taken keys
+		virtual void store(FieldId, const boost::any& key, ModelClassPtr instance)
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			Transaction::ScopedLock lock(*transaction, this, LockModes::Exclusive);
+			
+			storage.insert(boost::any_cast<const KeyType&>(key), ModelStore<ModelClassPtr>::storedId(instance), instance);
+		}
+		
+		// instances are erased from their store before its indexes, so the id is the one they were stored under
+		virtual void erase(ModelClassPtr instance)
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			Transaction::ScopedLock lock(*transaction, this, LockModes::Exclusive);
+			
+			if(holds(instance))
+				storage.erase(ModelStore<ModelClassPtr>::storedId(instance));
+		}
+		
+		// the store clearing its indexes keeps itself locked exclusively until its transaction ends
+		virtual void clear()
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			Transaction::ScopedLock lock(*transaction, this, LockModes::Exclusive);
+			
+			storage.clear();
+		}
+		
+		virtual ModelListPtr getList(const boost::any& key) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			ModelListPtr list(new typename ModelListPtr::element_type);
+			const KeyType& lookup(boost::any_cast<const KeyType&>(key));
+			list->reserve(storage.count(lookup));
+			storage.forEach(lookup, AppendInstance(*list));
+			
+			return list;
+		}
+		
+		virtual bool forEach(const boost::any& key, const Visitor& visitor) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			return storage.forEach(boost::any_cast<const KeyType&>(key), VisitInstance(visitor));
+		}
+		
+		virtual std::size_t count(const boost::any& key) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			return storage.count(boost::any_cast<const KeyType&>(key));
+		}
+		
+		virtual bool contains(const boost::any& key, const ModelClassPtr& instance) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			return holds(instance) && storage.contains(boost::any_cast<const KeyType&>(key), ModelStore<ModelClassPtr>::storedId(instance));
+		}
+		
+		// the token is the first id of the next page, so a page costs as much as the page
+		virtual Page<ModelClassPtr> getPage(const boost::any& key, const PageToken& token, std::size_t limit) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			Page<ModelClassPtr> page;
+			if(!token.isEnd() && limit != 0)
+				storage.forEach(boost::any_cast<const KeyType&>(key), AppendPage(page, limit), token.getStart());
+			return page;
+		}
+		
+		virtual ModelClassPtr get(const boost::any& key) const
+		{
+			ModelClassPtr instance = find(key);
+			if(!instance)
+				throw InstanceNotFoundException(getClassName<typename ModelClassPtr::element_type>(), boost::lexical_cast<std::string>(boost::any_cast<const KeyType&>(key)));
+			return instance;
+		}
+		
+		// the instance with the lowest id
+		virtual ModelClassPtr find(const boost::any& key) const
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getSharedLock(this);
+			
+			ModelClassPtr instance;
+			storage.forEach(boost::any_cast<const KeyType&>(key), KeepFirst(instance));
+			return instance;
+		}
+		
+	protected:
+		
+		// the id an instance was stored under may have been taken by another instance since, the entry has to be its own
+		bool holds(const ModelClassPtr& instance) const
+		{
+			const ModelClassPtr* held = storage.at(ModelStore<ModelClassPtr>::storedId(instance));
+			return held && *held == instance;
+		}
+		
+		// visitors of the ids and the instances of the storage
+		struct AppendInstance
+		{
+			AppendInstance(typename ModelListPtr::element_type& l) : list(l) { }
+			
+			bool operator()(ID, const ModelClassPtr& instance) const
+			{
+				list.push_back(instance);
+				return true;
+			}
+			
+			typename ModelListPtr::element_type& list;
+		};
+		
+		struct VisitInstance
+		{
+			VisitInstance(const Visitor& v) : visitor(v) { }
+			
+			bool operator()(ID, const ModelClassPtr& instance) const
+			{
+				return visitor(instance);
+			}
+			
+			const Visitor& visitor;
+		};
+		
+		struct KeepFirst
+		{
+			KeepFirst(ModelClassPtr& i) : instance(i) { }
+			
+			bool operator()(ID, const ModelClassPtr& i) const
+			{
+				instance = i;
+				return false;
+			}
+			
+			ModelClassPtr& instance;
+		};
+		
+		// fills page with limit instances and makes the id after them the next token
+		struct AppendPage
+		{
+			AppendPage(Page<ModelClassPtr>& p, std::size_t l) : page(p), limit(l) { }
+			
+			bool operator()(ID id, const ModelClassPtr& instance) const
+			{
+				if(page.values->size() == limit)
+				{
+					page.next = PageToken(id);
+					return false;
+				}
+				page.values->push_back(instance);
+				return true;
+			}
+			
+			Page<ModelClassPtr>& page;
+			std::size_t limit;
+		};
+		
+		Storage storage;
+};
+
+#endif /* STORAGE_INDEX_H */
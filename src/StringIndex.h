@@ -0,0 +1,26 @@
+#ifndef STRING_INDEX_H
+#define STRING_INDEX_H
+
+#include <string>
+
+template<typename ModelClassPtr>
+class StringIndex;
+
+#include "OrderedIndex.h"
+
+// ordered index on strings that also finds them by prefix in lexical order, so it serves both lookups by name
+// and autocompletion of names
+template<typename ModelClassPtr>
+class StringIndex : public OrderedIndex<ModelClassPtr, std::string>
+{
+	public:
+		
+		typedef typename Index<ModelClassPtr>::ModelListPtr ModelListPtr;
+		
+		virtual ModelListPtr getPrefixList(const boost::any& prefix, std::size_t limit) const
+		{
+			return this->getPrefixListOf(boost::any_cast<const std::string&>(prefix), limit);
+		}
+};
+
+#endif /* STRING_INDEX_H */
@@ -1,12 +1,22 @@
 #include "Transaction.h"
 
-const unsigned int Transaction::deadlockTimeout = 300;
+Transaction::LockTimeout Transaction::defaultLockTimeout = boost::chrono::seconds(300);
 
 boost::mutex Transaction::coutMutex;
 
-boost::mutex Transaction::transactionsMutex;
-Transaction::Transactions Transaction::transactions;
+thread_local Transaction Transaction::threadTransaction;
+thread_local bool Transaction::readingOptimistically = false;
 
-boost::mutex Transaction::historyMutex;
-Transaction::LockHistory Transaction::sharedLockHistory;
-Transaction::LockHistory Transaction::exclusiveLockHistory;
+boost::mutex Transaction::waitsMutex;
+Transaction::WaitingTransactions Transaction::waitingTransactions;
+Lockable::Ticket Transaction::lastTicketOrders[Priorities::Count] = { 0, 0, 0 };
+// interactive requests go first for up to 10 ms, normal ones before batch work for up to 100 ms
+boost::chrono::milliseconds Transaction::priorityAging[Priorities::Count] = { boost::chrono::milliseconds(0), boost::chrono::milliseconds(10), boost::chrono::milliseconds(110) };
+
+Transaction::HistoryShard Transaction::historyShards[Transaction::HistoryShardCount];
+
+boost::mutex Transaction::callSiteMutex;
+Transaction::CallSiteCounters Transaction::callSiteCounters;
+Transaction::WaitCounters Transaction::priorityWaits[Priorities::Count];
+boost::mutex Transaction::callSiteNamesMutex;
+Transaction::CallSiteNames Transaction::callSiteNames;
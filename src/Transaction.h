@@ -3,431 +3,1237 @@
 #define TRANSACTION_H
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
 #include <set>
+#include <map>
+#include <vector>
 #include <boost/smart_ptr.hpp>
-#include <boost/enable_shared_from_this.hpp>
+#include <boost/atomic.hpp>
+#include <boost/type_traits/is_trivially_copyable.hpp>
+#include <boost/intrusive_ptr.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/unordered_map.hpp>
-#include <boost/bimap.hpp>
-#include <boost/bimap/unordered_multiset_of.hpp>
-#include <boost/bimap/unordered_set_of.hpp>
+#include <boost/unordered_set.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/foreach.hpp>
+#include <boost/chrono.hpp>
+#include <json/json.h>
 
 class Transaction;
 
-typedef boost::shared_ptr<Transaction> TransactionPtr;
+typedef boost::intrusive_ptr<Transaction> TransactionPtr;
 
 #include "Lockable.h"
 #include "DeadlockException.h"
+#include "ConflictException.h"
+#include "SmallMap.h"
 
 #define DEBUG_TRANSACTIONS false
 
-class Transaction : public boost::enable_shared_from_this< Transaction >
+namespace TransactionModes
+{
+	enum TransactionMode
+	{
+		// locks are held until the transaction ends
+		Pessimistic = 0,
+		// read locks are released right after each read and only the versions of what was read are remembered,
+		// the first write or commit() checks that none of it changed and throws a ConflictException otherwise
+		Optimistic,
+	};
+}
+
+class Transaction
 {
 public:
 		
-		static const unsigned int deadlockTimeout;
+		typedef LockModes::LockMode LockMode;
+		typedef TransactionModes::TransactionMode TransactionMode;
 		
-		typedef boost::unordered_map<boost::thread::id, Transaction*> Transactions;
+		typedef boost::chrono::milliseconds LockTimeout;
 		
-		typedef boost::shared_lock<boost::shared_mutex> SharedLock;
-		typedef boost::upgrade_lock<boost::shared_mutex> UpgradeLock;
-		typedef boost::upgrade_to_unique_lock< boost::shared_mutex > UpgradedLock;
-		typedef boost::unique_lock<boost::shared_mutex> ExclusiveLock;
-		typedef boost::shared_ptr< SharedLock > SharedLockPtr;
-		typedef boost::shared_ptr< UpgradeLock > UpgradeLockPtr;
-		typedef boost::shared_ptr< UpgradedLock > UpgradedLockPtr;
-		typedef boost::shared_ptr< ExclusiveLock > ExclusiveLockPtr;
+		typedef boost::unordered_map<const Lockable*, LockMode> Locks;
+		// the modes one transaction holds
+		typedef SmallMap<const Lockable*, LockMode> TransactionLocks;
 		
-		typedef boost::unordered_map<const Lockable*, SharedLockPtr> SharedLocks;
-		typedef boost::unordered_map<const Lockable*, UpgradeLockPtr> UpgradeLocks;
-		typedef boost::unordered_map<const Lockable*, UpgradedLockPtr> UpgradedLocks;
-		typedef boost::unordered_map<const Lockable*, ExclusiveLockPtr> ExclusiveLocks;
+		// modes locked from each transaction start address, published copy-on-write so reading it takes no lock
+		typedef boost::shared_ptr<const Locks> LocksPtr;
+		typedef boost::unordered_map<const void*, LocksPtr> LockHistory;
+		typedef boost::shared_ptr<const LockHistory> LockHistoryPtr;
 		
-		typedef boost::bimap<
-			boost::bimaps::unordered_multiset_of<const void*>,
-			boost::bimaps::unordered_multiset_of<const Lockable*>,
-			boost::bimaps::unordered_set_of_relation<>
-		> LockHistory;
-		typedef LockHistory::value_type LockHistoryElementType;
+		// learned modes in order of increasing memory address, the order they are locked in up front
+		typedef std::vector< std::pair<const Lockable*, LockMode> > OrderedLocks;
+		
+		// a thread's copy of what it last read from the shared history for a start address
+		struct CachedLocks
+		{
+			CachedLocks() : valid(false), generation(0) { }
+			
+			bool valid;
+			unsigned int generation;
+			LocksPtr locks;
+			// sorted once per change of the history instead of on every start
+			OrderedLocks ordered;
+		};
+		typedef boost::unordered_map<const void*, CachedLocks> LockHistoryCache;
 		
-		~Transaction()
+		struct HeldLock
 		{
-			// release all the locks
-			BOOST_FOREACH(ExclusiveLocks::value_type& i, exclusiveLocks)
-				i.second.reset();
-			BOOST_FOREACH(UpgradedLocks::value_type& i, upgradedLocks)
-				i.second.reset();
-			BOOST_FOREACH(UpgradeLocks::value_type& i, upgradeLocks)
-				i.second.reset();
-			BOOST_FOREACH(SharedLocks::value_type& i, sharedLocks)
-				i.second.reset();
+			HeldLock(const Lockable* r, LockMode m) : resource(r), mode(m) { }
 			
+			const Lockable* resource;
+			LockMode mode;
+		};
+		typedef std::vector<HeldLock> HeldLocks;
+		
+		typedef boost::unordered_set<Transaction*> WaitingTransactions;
+		
+		struct ReadVersion
+		{
+			ReadVersion(LockMode m, Lockable::Version v) : mode(m), version(v) { }
+			
+			LockMode mode;
+			Lockable::Version version;
+		};
+		// the versions an optimistic transaction read
+		typedef SmallMap<const Lockable*, ReadVersion> ReadSet;
+		typedef std::vector< boost::shared_ptr<const void> > Owners;
+		
+		// read lock of an optimistic transaction, released when the call that took it returns
+		struct ShortLock
+		{
+			ShortLock(const Lockable* r, LockMode p, unsigned int d) : resource(r), previous(p), depth(d) { }
+			
+			const Lockable* resource;
+			LockMode previous;
+			unsigned int depth;
+		};
+		typedef std::vector<ShortLock> ShortLocks;
+		
+		typedef boost::chrono::steady_clock Clock;
+		// when each resource with lock statistics enabled was locked
+		typedef boost::unordered_map<const Lockable*, Clock::time_point> LockTimes;
+		
+		typedef Priorities::Priority Priority;
+		
+		// lock waits of the transactions started from one address or of one priority class
+		struct LockWaits
+		{
+			static const unsigned int BucketCount = 64;
+			
+			LockWaits() : waits(0), failed(0), totalWait(0), maxWait(0)
 			{
-				boost::lock_guard<boost::mutex> guard(transactionsMutex);
-				transactions.erase(boost::this_thread::get_id());
+				std::fill(buckets, buckets + BucketCount, 0);
 			}
 			
-			// save history of locks so next time we can lock all needed locks right away to avoid deadlocks
+			void record(const LockStatistics::Duration& wait, bool acquired)
 			{
-				boost::lock_guard<boost::mutex> guard(historyMutex);
+				if(acquired)
+					waits++;
+				else
+					failed++;
+				totalWait += wait;
+				maxWait = std::max(maxWait, wait);
 				
-				BOOST_FOREACH(const ExclusiveLocks::value_type& i, exclusiveLocks)
-				{
-					LockHistoryElementType relation(transactionStartAddress, i.first);
-					if(exclusiveLockHistory.find(relation) == exclusiveLockHistory.end())
-					{
-						sharedLockHistory.erase(relation);
-						exclusiveLockHistory.insert(relation);
-					}
-				}
-				BOOST_FOREACH(const UpgradedLocks::value_type& i, upgradedLocks)
-				{
-					LockHistoryElementType relation(transactionStartAddress, i.first);
-					if(exclusiveLockHistory.find(relation) == exclusiveLockHistory.end())
-					{
-						sharedLockHistory.erase(relation);
-						exclusiveLockHistory.insert(relation);
-					}
-				}
-				BOOST_FOREACH(const SharedLocks::value_type& i, sharedLocks)
+				unsigned long long ns = wait.count() > 0 ? wait.count() : 1;
+				buckets[63 - __builtin_clzll(ns)]++;
+			}
+			
+			// the wait that the given fraction of all waits did not exceed, rounded up to the next power of two nanoseconds
+			LockStatistics::Duration percentile(double fraction) const
+			{
+				unsigned long long count = 0, wanted = std::max(1ull, static_cast<unsigned long long>(std::ceil(fraction * (waits + failed))));
+				// the last buckets would overflow the duration
+				for(unsigned int i = 0; i < BucketCount - 2; i++)
 				{
-					LockHistoryElementType relation(transactionStartAddress, i.first);
-					if(exclusiveLockHistory.find(relation) == exclusiveLockHistory.end()
-					&& sharedLockHistory.find(relation) == sharedLockHistory.end())
-						sharedLockHistory.insert(relation);
+					count += buckets[i];
+					if(count >= wanted)
+						return std::min(maxWait, LockStatistics::Duration(2ll << i));
 				}
+				return maxWait;
 			}
 			
-			if(DEBUG_TRANSACTIONS)
+			Json::Value toJson() const
 			{
-				boost::lock_guard<boost::mutex> guard(coutMutex);
-				std::cout << "transaction " << threadId << ": ended" << std::endl << std::flush;
-				std::cout << "shared history:" << sharedLockHistory.size() << ", exclusive history:" << exclusiveLockHistory.size() << std::endl << std::flush;
+				Json::Value json;
+				json["waits"] = Json::UInt64(waits);
+				json["failed"] = Json::UInt64(failed);
+				json["totalWaitNs"] = Json::Int64(totalWait.count());
+				json["maxWaitNs"] = Json::Int64(maxWait.count());
+				json["p50WaitNs"] = Json::Int64(percentile(0.5).count());
+				json["p99WaitNs"] = Json::Int64(percentile(0.99).count());
+				return json;
 			}
-		}
+			
+			unsigned long long waits;
+			// waits that ended in a deadlock or a timeout
+			unsigned long long failed;
+			LockStatistics::Duration totalWait;
+			LockStatistics::Duration maxWait;
+			// waits between 2^i and 2^(i+1) nanoseconds by i
+			unsigned long long buckets[BucketCount];
+		};
+		typedef boost::unordered_map<const void*, LockWaits> CallSiteWaits;
 		
-		static TransactionPtr startTransaction()
+		// the same kept in atomic counters, so waits are recorded without taking a lock
+		struct WaitCounters
 		{
-			boost::thread::id threadId = boost::this_thread::get_id();
+			WaitCounters()
+			{
+				reset();
+			}
 			
-			TransactionPtr transaction;
+			void record(const LockStatistics::Duration& wait, bool acquired)
 			{
-				boost::lock_guard<boost::mutex> guard(transactionsMutex);
+				(acquired ? waits : failed).fetch_add(1, boost::memory_order_relaxed);
+				totalWait.fetch_add(wait.count(), boost::memory_order_relaxed);
+				long long longest = maxWait.load(boost::memory_order_relaxed);
+				while(wait.count() > longest && !maxWait.compare_exchange_weak(longest, wait.count(), boost::memory_order_relaxed));
 				
-				Transactions::iterator it = transactions.find(threadId);
-				if(it != transactions.end())
-					return it->second->shared_from_this();
+				unsigned long long ns = wait.count() > 0 ? wait.count() : 1;
+				buckets[63 - __builtin_clzll(ns)].fetch_add(1, boost::memory_order_relaxed);
 			}
 			
-			void* transactionStartAddress = __builtin_extract_return_addr(__builtin_return_address(0));
-			
-			if(DEBUG_TRANSACTIONS)
+			// waits recorded meanwhile may be counted in some of the fields and not yet in others
+			LockWaits get() const
 			{
-				boost::lock_guard<boost::mutex> guard(coutMutex);
-				std::cout << "transaction " << threadId << ": starting, from " << transactionStartAddress << std::endl << std::flush;
+				LockWaits result;
+				result.waits = waits.load(boost::memory_order_relaxed);
+				result.failed = failed.load(boost::memory_order_relaxed);
+				result.totalWait = LockStatistics::Duration(totalWait.load(boost::memory_order_relaxed));
+				result.maxWait = LockStatistics::Duration(maxWait.load(boost::memory_order_relaxed));
+				for(unsigned int i = 0; i < LockWaits::BucketCount; i++)
+					result.buckets[i] = buckets[i].load(boost::memory_order_relaxed);
+				return result;
 			}
 			
-			transaction = TransactionPtr(new Transaction(transactionStartAddress));
-			
+			void reset()
 			{
-				boost::lock_guard<boost::mutex> guard(transactionsMutex);
-				transactions[threadId] = transaction.get();
+				waits.store(0, boost::memory_order_relaxed);
+				failed.store(0, boost::memory_order_relaxed);
+				totalWait.store(0, boost::memory_order_relaxed);
+				maxWait.store(0, boost::memory_order_relaxed);
+				for(unsigned int i = 0; i < LockWaits::BucketCount; i++)
+					buckets[i].store(0, boost::memory_order_relaxed);
 			}
 			
-			return transaction;
+			boost::atomic<unsigned long long> waits;
+			boost::atomic<unsigned long long> failed;
+			// in nanoseconds
+			boost::atomic<long long> totalWait;
+			boost::atomic<long long> maxWait;
+			boost::atomic<unsigned long long> buckets[LockWaits::BucketCount];
+		};
+		// counters are never removed, so the transactions of a thread can keep pointers to them
+		typedef boost::unordered_map<const void*, boost::shared_ptr<WaitCounters> > CallSiteCounters;
+		
+		// names given to call sites, the address of a name is what the transactions started there are recorded under
+		typedef std::set<std::string> CallSiteNames;
+		
+		// holds a lock only until it goes out of scope unless the transaction held it already,
+		// for structures that are consistent on their own (like index entries) and would only make other writers wait otherwise
+		class ScopedLock
+		{
+			public:
+				
+				ScopedLock(Transaction& t, const Lockable* r, LockMode mode) : transaction(t), resource(r), previous(t.getLockMode(r))
+				{
+					transaction.getLock(resource, mode);
+				}
+				
+				~ScopedLock()
+				{
+					transaction.releaseLock(resource, previous);
+				}
+				
+			private:
+				
+				Transaction& transaction;
+				const Lockable* resource;
+				LockMode previous;
+		};
+		
+		// the mode and the priority only matter when no transaction is running on this thread, nested calls join the running one
+		static TransactionPtr startTransaction(TransactionMode mode = TransactionModes::Pessimistic, Priority priority = Priorities::Normal)
+		{
+			return startTransaction(__builtin_extract_return_addr(__builtin_return_address(0)), mode, priority);
 		}
 		
-		static void removeLockable(const Lockable* resource)
+		// same, but a transaction started here is recorded under site instead of the return address, see callSite()
+		static TransactionPtr startTransaction(const void* site, TransactionMode mode = TransactionModes::Pessimistic, Priority priority = Priorities::Normal)
 		{
-			boost::lock_guard<boost::mutex> guard(historyMutex);
-			sharedLockHistory.right.erase(resource);
-			exclusiveLockHistory.right.erase(resource);
+			// every thread owns exactly one transaction object which is reused for every transaction started on that thread,
+			// nested calls only bump its reference count so no locking or allocation is done here
+			Transaction& transaction(threadTransaction);
 			
-			if(DEBUG_TRANSACTIONS)
+			if(transaction.references == 0)
 			{
-				boost::lock_guard<boost::mutex> guard2(coutMutex);
-				std::cout << "shared history:" << sharedLockHistory.size() << ", exclusive history:" << exclusiveLockHistory.size() << std::endl << std::flush;
+				if(DEBUG_TRANSACTIONS)
+				{
+					boost::lock_guard<boost::mutex> guard(coutMutex);
+					std::cout << "transaction " << transaction.threadId << ": starting, from " << site << std::endl << std::flush;
+				}
+				
+				transaction.begin(site, mode, priority);
 			}
+			
+			return TransactionPtr(&transaction);
 		}
 		
-		void getSharedLock(const Lockable* resource)
+		// like startTransaction(site, ...) but never waits for the locks learned for site, if one of them is not free
+		// nothing is started, missed is set to it and the pointer returned is empty
+		static TransactionPtr tryStartTransaction(const void* site, const Lockable*& missed, TransactionMode mode = TransactionModes::Pessimistic, Priority priority = Priorities::Normal)
 		{
-			if(DEBUG_TRANSACTIONS)
-			{
-				boost::lock_guard<boost::mutex> guard(coutMutex);
-				std::cout << "transaction " << threadId << ": trying to shared lock " << resource << " ... " << std::endl << std::flush;
-			}
+			Transaction& transaction(threadTransaction);
 			
-			if(threadId != boost::this_thread::get_id())
-				throw std::runtime_error("Using transaction from the wrong thread");
-			
-			if(sharedLocks.find(resource) != sharedLocks.end()
-			|| exclusiveLocks.find(resource) != exclusiveLocks.end()
-			|| upgradedLocks.find(resource) != upgradedLocks.end())
+			if(transaction.references == 0)
 			{
 				if(DEBUG_TRANSACTIONS)
 				{
 					boost::lock_guard<boost::mutex> guard(coutMutex);
-					std::cout << "transaction " << threadId << ": already have it" << std::endl << std::flush;
+					std::cout << "transaction " << transaction.threadId << ": trying to start, from " << site << std::endl << std::flush;
 				}
-				return;
+				
+				missed = transaction.begin(site, mode, priority, false);
+				if(missed)
+					return TransactionPtr();
 			}
 			
-			SharedLockPtr lock(new SharedLock(resource->getMutex(), boost::defer_lock));
-			if(!lock->try_lock_for(boost::chrono::seconds(deadlockTimeout)))
+			return TransactionPtr(&transaction);
+		}
+		
+		// return addresses change with every build, so the lock history of a call site can only be saved and loaded
+		// when it has a name, the same name always gives the same site, look it up once and keep it:
+		// static const void* site = Transaction::callSite("rename person");
+		static const void* callSite(const std::string& name)
+		{
+			boost::lock_guard<boost::mutex> guard(callSiteNamesMutex);
+			return &*callSiteNames.insert(name).first;
+		}
+		
+		friend inline void intrusive_ptr_add_ref(Transaction* transaction)
+		{
+			++transaction->references;
+		}
+		
+		friend inline void intrusive_ptr_release(Transaction* transaction)
+		{
+			if(--transaction->references == 0)
+				transaction->end();
+			else if(!transaction->shortLocks.empty() && transaction->shortLocks.back().depth > transaction->references)
+				transaction->releaseShortLocks();
+		}
+		
+		// true if the transaction running on this thread reads optimistically, cheap enough to ask on every field read
+		static bool isReadingOptimistically()
+		{
+			return readingOptimistically;
+		}
+		
+		static void removeLockable(const Lockable* resource)
+		{
+			BOOST_FOREACH(HistoryShard& shard, historyShards)
 			{
-				boost::lock_guard<boost::mutex> guard(historyMutex);
-				LockHistoryElementType relation(transactionStartAddress, resource);
-				if(exclusiveLockHistory.find(relation) == exclusiveLockHistory.end()
-				&& sharedLockHistory.find(relation) == sharedLockHistory.end())
-					sharedLockHistory.insert(relation);
+				boost::lock_guard<boost::mutex> guard(shard.mutex);
+				LockHistoryPtr history(boost::atomic_load(&shard.history));
 				
-				throw DeadlockException();
+				boost::shared_ptr<LockHistory> updated;
+				BOOST_FOREACH(const LockHistory::value_type& i, *history)
+				{
+					if(i.second->find(resource) == i.second->end())
+						continue;
+					if(!updated)
+						updated.reset(new LockHistory(*history));
+					boost::shared_ptr<Locks> locks(new Locks(*i.second));
+					locks->erase(resource);
+					(*updated)[i.first] = locks;
+				}
+				
+				if(updated)
+					publishHistory(shard, updated);
 			}
 			
 			if(DEBUG_TRANSACTIONS)
 			{
 				boost::lock_guard<boost::mutex> guard(coutMutex);
-				std::cout << "transaction " << threadId << ": got shared lock" << std::endl << std::flush;
+				std::cout << "lock history:" << lockHistorySize() << std::endl << std::flush;
 			}
-			
-			sharedLocks[resource] = lock;
 		}
 		
-		void getExclusiveLock(const Lockable* resource)
+		// locks resource in requested mode, or in the mode combining it with the one already held
+		void getLock(const Lockable* resource, LockMode requested)
 		{
 			if(DEBUG_TRANSACTIONS)
 			{
 				boost::lock_guard<boost::mutex> guard(coutMutex);
-				std::cout << "transaction " << threadId << ": trying to exclusive lock " << resource << " ... " << std::endl << std::flush;
+				std::cout << "transaction " << threadId << ": trying to lock " << resource << " in mode " << requested << " ... " << std::endl << std::flush;
 			}
 			
 			if(threadId != boost::this_thread::get_id())
 				throw std::runtime_error("Using transaction from the wrong thread");
 			
-			if(exclusiveLocks.find(resource) != exclusiveLocks.end()
-			|| upgradedLocks.find(resource) != upgradedLocks.end())
+			if(conflicted)
+				throw ConflictException();
+			
+			bool shortLock = false;
+			if(optimistic)
+			{
+				if(requested != LockModes::IntentionShared && requested != LockModes::Shared)
+					escalate();
+				else
+					shortLock = resource->isOptimisticReadsEnabled();
+			}
+			
+			LockMode held = getLockMode(resource);
+			LockMode mode = Lockable::combine(held, requested);
+			if(mode == held)
 			{
 				if(DEBUG_TRANSACTIONS)
 				{
 					boost::lock_guard<boost::mutex> guard(coutMutex);
 					std::cout << "transaction " << threadId << ": already have it" << std::endl << std::flush;
 				}
-				
 				return;
 			}
-			if(sharedLocks.find(resource) != sharedLocks.end())
+			
+			if(!resource->tryLock(held, mode))
 			{
-				if(DEBUG_TRANSACTIONS)
+				Clock::time_point waitStart = Clock::now();
+				bool acquired;
+				try
 				{
-					boost::lock_guard<boost::mutex> guard(coutMutex);
-					std::cout << "transaction " << threadId << ": trying to get upgrade lock... " << std::endl << std::flush;
+					WaitGuard wait(*this, resource, mode, held != LockModes::None);
+					acquired = resource->lock(held, mode, waitingTicket, lockTimeout);
 				}
-				
-				UpgradeLockPtr lock(new UpgradeLock(resource->getMutex(), boost::defer_lock));
-				if(!lock->try_lock_for(boost::chrono::seconds(deadlockTimeout)))
+				catch(const DeadlockException&)
 				{
-					boost::lock_guard<boost::mutex> guard(historyMutex);
-					LockHistoryElementType relation(transactionStartAddress, resource);
-					if(exclusiveLockHistory.find(relation) == exclusiveLockHistory.end())
-					{
-						sharedLockHistory.erase(relation);
-						exclusiveLockHistory.insert(relation);
-					}
-					
-					throw DeadlockException();
+					recordWait(waitStart, false);
+					throw;
 				}
 				
-				if(DEBUG_TRANSACTIONS)
+				recordWait(waitStart, acquired);
+				if(!acquired)
 				{
-					boost::lock_guard<boost::mutex> guard(coutMutex);
-					std::cout << "transaction " << threadId << ": got upgrade lock, " << std::endl << std::flush;
+					recordDeadlock(resource, mode);
+					throw DeadlockException();
 				}
+			}
+			
+			if(DEBUG_TRANSACTIONS)
+			{
+				boost::lock_guard<boost::mutex> guard(coutMutex);
+				std::cout << "transaction " << threadId << ": got lock in mode " << mode << std::endl << std::flush;
+			}
+			
+			locks[resource] = mode;
+			if(held == LockModes::None)
+				startHolding(resource);
+			
+			if(shortLock)
+			{
+				shortLocks.push_back(ShortLock(resource, held, references));
 				
-				upgradeLocks[resource] = lock;
-				
-				// free shared lock, we have the upgrade lock now
-				sharedLocks.erase(resource);
-				
-				if(DEBUG_TRANSACTIONS)
+				// nobody can take an exclusive lock while this one is held, so the version read now is the one the caller sees
+				ReadSet::iterator it = readSet.find(resource);
+				if(it == readSet.end())
+					readSet.insert(ReadSet::value_type(resource, ReadVersion(mode, resource->getVersion())));
+				else
+					it->second.mode = Lockable::combine(it->second.mode, mode);
+			}
+		}
+		
+		void getIntentionSharedLock(const Lockable* resource)
+		{
+			getLock(resource, LockModes::IntentionShared);
+		}
+		
+		void getIntentionExclusiveLock(const Lockable* resource)
+		{
+			getLock(resource, LockModes::IntentionExclusive);
+		}
+		
+		void getSharedLock(const Lockable* resource)
+		{
+			getLock(resource, LockModes::Shared);
+		}
+		
+		void getExclusiveLock(const Lockable* resource)
+		{
+			getLock(resource, LockModes::Exclusive);
+		}
+		
+		// locks and reads refer to their resources by address, a resource whose owner may go away before the transaction
+		// ends (like the lock of a model instance) is locked or read after handing in the owner, which is kept until then
+		void keepOwner(const Lockable* resource, const boost::shared_ptr<const void>& owner)
+		{
+			if(locks.find(resource) == locks.end() && readSet.find(resource) == readSet.end())
+				owners.push_back(owner);
+		}
+		
+		LockMode getLockMode(const Lockable* resource) const
+		{
+			TransactionLocks::const_iterator it = locks.find(resource);
+			if(it == locks.end())
+				return LockModes::None;
+			return it->second;
+		}
+		
+		// releases resource before the transaction ends, or downgrades it to mode
+		void releaseLock(const Lockable* resource, LockMode mode = LockModes::None)
+		{
+			TransactionLocks::iterator it = locks.find(resource);
+			if(it == locks.end() || it->second == mode)
+				return;
+			
+			resource->unlock(it->second, mode);
+			if(mode == LockModes::None)
+			{
+				locks.erase(it);
+				stopHolding(resource);
+			}
+			else
+				it->second = mode;
+		}
+		
+		// copies value, which only changes under an exclusive lock on resource (like the fields of an instance); pessimistic
+		// transactions copy it without locking as always, optimistic ones copy trivially copyable values without locking and
+		// check that the version of resource stayed the same meanwhile, seqlock style, and anything else under a short
+		// shared lock, since copying a string while it changes can crash
+		template<typename T>
+		T read(const Lockable* resource, const T& value)
+		{
+			if(!optimistic)
+				return value;
+			
+			if(conflicted)
+				throw ConflictException();
+			
+			// the lock is kept until the end like the ones of other resources with optimistic reads disabled
+			if(!resource->isOptimisticReadsEnabled())
+			{
+				getSharedLock(resource);
+				return value;
+			}
+			
+			if(boost::is_trivially_copyable<T>::value)
+			{
+				Lockable::Version version = resource->getVersion();
+				if(!(version & 1))
 				{
-					boost::lock_guard<boost::mutex> guard(coutMutex);
-					std::cout << "transaction " << threadId << ": trying to upgrade... " << std::endl << std::flush;
+					T copy(value);
+					boost::atomic_thread_fence(boost::memory_order_acquire);
+					if(resource->getVersion() == version)
+					{
+						recordRead(resource, version);
+						return copy;
+					}
 				}
+			}
+			
+			// a writer is changing it right now or it cannot be copied safely without the lock, the copy is taken before
+			// the lock goes, and no writer can get in between locking and reading the version
+			ScopedLock lock(*this, resource, LockModes::Shared);
+			recordRead(resource, resource->getVersion());
+			return value;
+		}
+		
+		// throws a ConflictException if anything an optimistic transaction read has changed since,
+		// a transaction that wrote or runs pessimistically holds its locks and always succeeds
+		void commit()
+		{
+			if(conflicted)
+				throw ConflictException();
+			
+			validate();
+		}
+		
+		TransactionMode getMode() const
+		{
+			return transactionMode;
+		}
+		
+		// how long a single lock request may wait before it gives up with a DeadlockException,
+		// actual deadlocks are detected right away, this only bounds waits on slow lock holders
+		void setLockTimeout(const LockTimeout& timeout)
+		{
+			lockTimeout = timeout;
+		}
+		
+		const LockTimeout& getLockTimeout() const
+		{
+			return lockTimeout;
+		}
+		
+		// timeout given to every transaction when it starts
+		static void setDefaultLockTimeout(const LockTimeout& timeout)
+		{
+			defaultLockTimeout = timeout;
+		}
+		
+		static LockTimeout getDefaultLockTimeout()
+		{
+			return defaultLockTimeout;
+		}
+		
+		Priority getPriority() const
+		{
+			return priority;
+		}
+		
+		// added to the time a request of the class starts waiting to order it among the others, a request of a lower class
+		// lets requests of higher classes go first only as long as they started waiting less than the difference after it,
+		// so it still gets its turn under constant high priority load
+		static void setPriorityAging(Priority priority, const boost::chrono::milliseconds& aging)
+		{
+			boost::lock_guard<boost::mutex> guard(waitsMutex);
+			priorityAging[priority] = aging;
+		}
+		
+		static boost::chrono::milliseconds getPriorityAging(Priority priority)
+		{
+			boost::lock_guard<boost::mutex> guard(waitsMutex);
+			return priorityAging[priority];
+		}
+		
+		// how long transactions waited for locks, by the address they were started from,
+		// only waits are counted so this costs nothing while locks are not contended
+		static CallSiteWaits getCallSiteWaits()
+		{
+			CallSiteWaits waits;
+			boost::lock_guard<boost::mutex> guard(callSiteMutex);
+			BOOST_FOREACH(const CallSiteCounters::value_type& i, callSiteCounters)
+				waits[i.first] = i.second->get();
+			return waits;
+		}
+		
+		static Json::Value callSiteWaitsToJson()
+		{
+			Json::Value json(Json::objectValue);
+			BOOST_FOREACH(const CallSiteWaits::value_type& i, getCallSiteWaits())
+				json[callSiteToString(i.first)] = i.second.toJson();
+			return json;
+		}
+		
+		// zeroes the counters in place, transactions keep recording into them
+		static void resetCallSiteWaits()
+		{
+			boost::lock_guard<boost::mutex> guard(callSiteMutex);
+			BOOST_FOREACH(const CallSiteCounters::value_type& i, callSiteCounters)
+				i.second->reset();
+		}
+		
+		// the same by priority class, to see whether the higher classes keep their wait times while lower ones run
+		static LockWaits getPriorityWaits(Priority priority)
+		{
+			return priorityWaits[priority].get();
+		}
+		
+		static Json::Value priorityWaitsToJson()
+		{
+			Json::Value json(Json::objectValue);
+			for(unsigned int i = 0; i < Priorities::Count; i++)
+				json[Priorities::toString(Priority(i))] = getPriorityWaits(Priority(i)).toJson();
+			return json;
+		}
+		
+		static void resetPriorityWaits()
+		{
+			for(unsigned int i = 0; i < Priorities::Count; i++)
+				priorityWaits[i].reset();
+		}
+		
+		// the modes learned for named call sites on named resources, by call site and resource name,
+		// everything else refers to addresses that mean nothing to the next run and is left out
+		static Json::Value lockHistoryToJson()
+		{
+			Lockable::NamedLockables namedLockables(Lockable::getNamedLockables());
+			boost::unordered_map<const Lockable*, const std::string*> lockNames;
+			BOOST_FOREACH(const Lockable::NamedLockables::value_type& i, namedLockables)
+				lockNames[i.second] = &i.first;
+			
+			Json::Value json(Json::objectValue);
+			boost::lock_guard<boost::mutex> guard(callSiteNamesMutex);
+			BOOST_FOREACH(const std::string& name, callSiteNames)
+			{
+				LockHistoryPtr history(boost::atomic_load(&historyShard(&name).history));
+				LockHistory::const_iterator it = history->find(&name);
+				if(it == history->end())
+					continue;
 				
-				// upgrade the lock
-				// TODO: need deadlock detection here
-				UpgradedLockPtr upgradedLock(new UpgradedLock(*lock));
-				
-				if(DEBUG_TRANSACTIONS)
+				BOOST_FOREACH(const Locks::value_type& i, *it->second)
 				{
-					boost::lock_guard<boost::mutex> guard(coutMutex);
-					std::cout << "transaction " << threadId << ": got upgraded lock" << std::endl << std::flush;
+					boost::unordered_map<const Lockable*, const std::string*>::const_iterator lockName = lockNames.find(i.first);
+					if(lockName != lockNames.end() && i.second != LockModes::None)
+						json[name][*lockName->second] = LockModes::toString(i.second);
 				}
-				
-				upgradedLocks[resource] = upgradedLock;
-				
-				return;
 			}
-			
-			ExclusiveLockPtr lock(new ExclusiveLock(resource->getMutex(), boost::defer_lock));
-			if(!lock->try_lock_for(boost::chrono::seconds(deadlockTimeout)))
+			return json;
+		}
+		
+		// merges a history saved by lockHistoryToJson() into the current one, resources that do not exist (yet) are skipped,
+		// so the resources should be named before this is called
+		static void lockHistoryFromJson(const Json::Value& json)
+		{
+			BOOST_FOREACH(const std::string& name, json.getMemberNames())
 			{
-				boost::lock_guard<boost::mutex> guard(historyMutex);
-				LockHistoryElementType relation(transactionStartAddress, resource);
-				if(exclusiveLockHistory.find(relation) == exclusiveLockHistory.end())
+				const Json::Value& site(json[name]);
+				if(!site.isObject())
+					throw std::runtime_error("Invalid lock history for call site '" + name + "'");
+				
+				Locks learned;
+				BOOST_FOREACH(const std::string& lockName, site.getMemberNames())
 				{
-					sharedLockHistory.erase(relation);
-					exclusiveLockHistory.insert(relation);
+					const Lockable* resource = Lockable::findLockable(lockName);
+					if(resource)
+						learned[resource] = parseLockMode(site[lockName].asString());
 				}
 				
-				throw DeadlockException();
+				if(!learned.empty())
+					learnLocks(callSite(name), learned);
 			}
+		}
+		
+		static void exportLockHistory(const std::string& filepath)
+		{
+			Json::StreamWriterBuilder builder;
+			builder["indentation"] = "\t";
+			boost::scoped_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
 			
-			if(DEBUG_TRANSACTIONS)
-			{
-				boost::lock_guard<boost::mutex> guard(coutMutex);
-				std::cout << "transaction " << threadId << ": got exclusive lock" << std::endl << std::flush;
-			}
+			std::ofstream outfile(filepath.c_str(), std::ofstream::binary);
+			writer->write(lockHistoryToJson(), &outfile);
+			outfile << std::endl;
+		}
+		
+		static void importLockHistory(const std::string& filepath)
+		{
+			std::ifstream infile(filepath.c_str(), std::ifstream::binary);
 			
-			exclusiveLocks[resource] = lock;
+			Json::CharReaderBuilder rbuilder;
+			rbuilder["collectComments"] = false;
+			rbuilder["strictRoot"] = true;
+			
+			Json::Value json;
+			std::string errors;
+			if(!Json::parseFromStream(rbuilder, infile, &json, &errors))
+				throw std::runtime_error("Failed to parse " + filepath + ": " + errors);
+			lockHistoryFromJson(json);
 		}
 		
 	private:
 		
-		Transaction(void* addr) : threadId(boost::this_thread::get_id()), transactionStartAddress(addr)
+		Transaction() : threadId(boost::this_thread::get_id()), references(0), lockTimeout(defaultLockTimeout), transactionMode(TransactionModes::Pessimistic), priority(Priorities::Normal), optimistic(false), conflicted(false), waitingResource(NULL), waitingMode(LockModes::None), waitingConversion(false), waitingTicket(0), transactionStartAddress(NULL) { }
+		
+		// unless wait is set this gives up as soon as one of the learned locks is not free, releases the others and returns it
+		const Lockable* begin(const void* addr, TransactionMode m, Priority p, bool wait = true)
 		{
-			// lock all the resources preemptively that were needed last time a transaction was started from this address
-			// lock resources in order of increasing memory address to minimize collisions
-			
-			std::set<const Lockable*> sharedResources, exclusiveResources;
+			transactionStartAddress = addr;
+			lockTimeout = defaultLockTimeout;
+			transactionMode = m;
+			priority = p;
 			
+			// optimistic transactions take nothing up front, they only lock for good once they write
+			if(transactionMode == TransactionModes::Optimistic)
 			{
-				boost::lock_guard<boost::mutex> guard(historyMutex);
-				
-				BOOST_FOREACH(LockHistory::left_const_reference& i, exclusiveLockHistory.left.equal_range(transactionStartAddress))
-					exclusiveResources.insert(i.second);
-				BOOST_FOREACH(LockHistory::left_const_reference& i, sharedLockHistory.left.equal_range(transactionStartAddress))
-					sharedResources.insert(i.second);
+				optimistic = true;
+				readingOptimistically = true;
+				return NULL;
 			}
 			
-			if(exclusiveResources.size() + sharedResources.size() > 1)
+			// lock all the resources preemptively that were needed last time a transaction was started from this address
+			// lock resources in order of increasing memory address to minimize collisions
+			
+			const OrderedLocks& resources(learnedLocks());
+			
+			// a single resource is only worth locking up front for callers that would rather not wait for it later
+			if(resources.size() > 1 || (!wait && !resources.empty()))
 			{
 				const Lockable* failed = NULL;
-				bool failedShared = false;
+				LockMode failedMode = LockModes::None;
 				do
 				{
-					exclusiveLocks.clear();
-					sharedLocks.clear();
+					releaseLocks();
 					
 					if(failed)
 					{
-						if(failedShared)
+						if(DEBUG_TRANSACTIONS)
 						{
-							if(DEBUG_TRANSACTIONS)
-							{
-								boost::lock_guard<boost::mutex> guard(coutMutex);
-								std::cout << "transaction " << threadId << ": preemptively waiting on shared lock " << failed << "..." << std::endl << std::flush;
-							}
-							
-							SharedLockPtr lock(new SharedLock(failed->getMutex()));
-							
-							if(DEBUG_TRANSACTIONS)
-							{
-								boost::lock_guard<boost::mutex> guard(coutMutex);
-								std::cout << "transaction " << threadId << ": preemptively got shared lock " << failed << " on retry" << std::endl << std::flush;
-							}
-							
-							sharedLocks[failed] = lock;
+							boost::lock_guard<boost::mutex> guard(coutMutex);
+							std::cout << "transaction " << threadId << ": preemptively waiting on lock " << failed << "..." << std::endl << std::flush;
 						}
-						else
+						
+						// nothing else is held while waiting here, so if this ends up in a deadlock or a timeout it is enough to start over
+						try
 						{
-							if(DEBUG_TRANSACTIONS)
-							{
-								boost::lock_guard<boost::mutex> guard(coutMutex);
-								std::cout << "transaction " << threadId << ": preemptively waiting on exclusive lock " << failed << "..." << std::endl << std::flush;
-							}
-							
-							ExclusiveLockPtr lock(new ExclusiveLock(failed->getMutex()));
-							
-							if(DEBUG_TRANSACTIONS)
-							{
-								boost::lock_guard<boost::mutex> guard(coutMutex);
-								std::cout << "transaction " << threadId << ": preemptively got exclusive lock " << failed << " on retry" << std::endl << std::flush;
-							}
-							
-							exclusiveLocks[failed] = lock;
+							getLock(failed, failedMode);
 						}
-						failed = NULL;
-					}
-					
-					BOOST_FOREACH(const std::set<const Lockable*>::value_type& resource, exclusiveResources)
-					{
-						if(exclusiveLocks.find(resource) != exclusiveLocks.end()
-						|| sharedLocks.find(resource) != sharedLocks.end())
-							continue;
-						
-						ExclusiveLockPtr lock(new ExclusiveLock(resource->getMutex(), boost::try_to_lock));
-						
-						if(!lock->owns_lock())
+						catch(const DeadlockException&)
 						{
-							if(DEBUG_TRANSACTIONS)
-							{
-								boost::lock_guard<boost::mutex> guard(coutMutex);
-								std::cout << "transaction " << threadId << ": preemptive exclusive locking failed on " << resource << std::endl << std::flush;
-							}
-							
-							failed = resource;
-							failedShared = false;
-							break;
+							continue;
 						}
 						
 						if(DEBUG_TRANSACTIONS)
 						{
 							boost::lock_guard<boost::mutex> guard(coutMutex);
-							std::cout << "transaction " << threadId << ": preemptively got exclusive lock " << resource << std::endl << std::flush;
+							std::cout << "transaction " << threadId << ": preemptively got lock " << failed << " on retry" << std::endl << std::flush;
 						}
 						
-						exclusiveLocks[resource] = lock;
+						failed = NULL;
 					}
 					
-					if(failed)
-						continue;
-					
-					BOOST_FOREACH(const std::set<const Lockable*>::value_type& resource, sharedResources)
+					BOOST_FOREACH(const OrderedLocks::value_type& i, resources)
 					{
-						if(exclusiveLocks.find(resource) != exclusiveLocks.end()
-						|| sharedLocks.find(resource) != sharedLocks.end())
+						if(locks.find(i.first) != locks.end())
 							continue;
 						
-						SharedLockPtr lock(new SharedLock(resource->getMutex(), boost::try_to_lock));
-						
-						if(!lock->owns_lock())
+						if(!i.first->tryLock(LockModes::None, i.second))
 						{
 							if(DEBUG_TRANSACTIONS)
 							{
 								boost::lock_guard<boost::mutex> guard(coutMutex);
-								std::cout << "transaction " << threadId << ": preemptive shared locking failed on " << resource << std::endl << std::flush;
+								std::cout << "transaction " << threadId << ": preemptive locking failed on " << i.first << std::endl << std::flush;
 							}
 							
-							failed = resource;
-							failedShared = true;
+							failed = i.first;
+							failedMode = i.second;
 							break;
 						}
 						
 						if(DEBUG_TRANSACTIONS)
 						{
 							boost::lock_guard<boost::mutex> guard(coutMutex);
-							std::cout << "transaction " << threadId << ": preemptively got shared lock " << resource << std::endl << std::flush;
+							std::cout << "transaction " << threadId << ": preemptively got lock " << i.first << " in mode " << i.second << std::endl << std::flush;
 						}
 						
-						sharedLocks[resource] = lock;
+						locks[i.first] = i.second;
+						startHolding(i.first);
+					}
+					
+					if(failed && !wait)
+					{
+						releaseLocks();
+						return failed;
 					}
 				} while(failed);
 			}
+			
+			return NULL;
+		}
+		
+		void end()
+		{
+			// let the exclusively locked resources publish their changes while everything is still locked
+			BOOST_FOREACH(const TransactionLocks::value_type& i, locks)
+				if(i.second == LockModes::Exclusive)
+					i.first->beforeExclusiveUnlock(this);
+			
+			// save history of locks so next time we can lock all needed locks right away to avoid deadlocks,
+			// optimistic transactions do not lock preemptively so they have no use for it
+			// once a call site has learned its locks this only compares against the thread's own copy
+			if(transactionMode == TransactionModes::Pessimistic && !historyCovers(locks))
+				learnLocks(transactionStartAddress, locks);
+			
+			if(DEBUG_TRANSACTIONS)
+			{
+				boost::lock_guard<boost::mutex> guard(coutMutex);
+				std::cout << "transaction " << threadId << ": ended" << std::endl << std::flush;
+				std::cout << "lock history:" << lockHistorySize() << std::endl << std::flush;
+			}
+			
+			// keep the containers around, the next transaction on this thread reuses them
+			releaseLocks();
+			shortLocks.clear();
+			readSet.clear();
+			transactionMode = TransactionModes::Pessimistic;
+			optimistic = false;
+			readingOptimistically = false;
+			conflicted = false;
+			
+			// last, an owner going away may destroy an instance whose destructor starts a transaction of its own
+			if(!owners.empty())
+			{
+				Owners released;
+				released.swap(owners);
+				released.clear();
+				if(owners.empty())
+					owners.swap(released);
+			}
+		}
+		
+		void releaseLocks()
+		{
+			BOOST_FOREACH(const TransactionLocks::value_type& i, locks)
+				i.first->unlock(i.second);
+			locks.clear();
+			
+			if(!lockTimes.empty())
+			{
+				Clock::time_point now = Clock::now();
+				BOOST_FOREACH(const LockTimes::value_type& i, lockTimes)
+					i.first->recordHold(now - i.second);
+				lockTimes.clear();
+			}
+		}
+		
+		void startHolding(const Lockable* resource)
+		{
+			if(resource->isLockStatisticsEnabled())
+				lockTimes[resource] = Clock::now();
+		}
+		
+		void stopHolding(const Lockable* resource)
+		{
+			if(lockTimes.empty())
+				return;
+			
+			LockTimes::iterator it = lockTimes.find(resource);
+			if(it == lockTimes.end())
+				return;
+			resource->recordHold(Clock::now() - it->second);
+			lockTimes.erase(it);
+		}
+		
+		void recordWait(const Clock::time_point& start, bool acquired)
+		{
+			LockStatistics::Duration wait(boost::chrono::duration_cast<LockStatistics::Duration>(Clock::now() - start));
+			
+			siteWaits(transactionStartAddress).record(wait, acquired);
+			priorityWaits[priority].record(wait, acquired);
+		}
+		
+		// the counters of a call site, the shared map is only locked the first time this thread waits from site
+		WaitCounters& siteWaits(const void* site)
+		{
+			boost::shared_ptr<WaitCounters>& counters(callSiteCountersCache[site]);
+			if(!counters)
+			{
+				boost::lock_guard<boost::mutex> guard(callSiteMutex);
+				boost::shared_ptr<WaitCounters>& shared(callSiteCounters[site]);
+				if(!shared)
+					shared.reset(new WaitCounters);
+				counters = shared;
+			}
+			return *counters;
+		}
+		
+		void releaseShortLocks()
+		{
+			while(!shortLocks.empty() && shortLocks.back().depth > references)
+			{
+				releaseLock(shortLocks.back().resource, shortLocks.back().previous);
+				shortLocks.pop_back();
+			}
+		}
+		
+		// turns an optimistic transaction into a pessimistic one before its first write,
+		// writes change the data in place so everything read so far has to be locked and still current by then
+		void escalate()
+		{
+			if(DEBUG_TRANSACTIONS)
+			{
+				boost::lock_guard<boost::mutex> guard(coutMutex);
+				std::cout << "transaction " << threadId << ": escalating, " << readSet.size() << " resources read" << std::endl << std::flush;
+			}
+			
+			optimistic = false;
+			readingOptimistically = false;
+			// read locks in use right now are simply kept until the end
+			shortLocks.clear();
+			
+			// lock in order of increasing memory address like begin() does
+			std::map<const Lockable*, LockMode> resources;
+			BOOST_FOREACH(const ReadSet::value_type& i, readSet)
+				resources[i.first] = i.second.mode;
+			
+			typedef std::map<const Lockable*, LockMode>::value_type Resource;
+			BOOST_FOREACH(const Resource& i, resources)
+				getLock(i.first, i.second);
+			
+			validate();
+			readSet.clear();
+		}
+		
+		// remembers the version of resource the transaction read, a read of an older or newer one means the transaction
+		// cannot commit anymore, so it fails right away
+		void recordRead(const Lockable* resource, Lockable::Version version)
+		{
+			ReadSet::iterator it = readSet.find(resource);
+			if(it == readSet.end())
+				readSet.insert(ReadSet::value_type(resource, ReadVersion(LockModes::Shared, version)));
+			else if(it->second.version != version)
+			{
+				conflicted = true;
+				throw ConflictException();
+			}
+		}
+		
+		void validate()
+		{
+			BOOST_FOREACH(const ReadSet::value_type& i, readSet)
+			{
+				if(i.first->getVersion() != i.second.version)
+				{
+					if(DEBUG_TRANSACTIONS)
+					{
+						boost::lock_guard<boost::mutex> guard(coutMutex);
+						std::cout << "transaction " << threadId << ": conflict on " << i.first << std::endl << std::flush;
+					}
+					
+					conflicted = true;
+					throw ConflictException();
+				}
+			}
+		}
+		
+		// registers a transaction in the wait-for graph for as long as it is blocked on a lock
+		class WaitGuard
+		{
+			public:
+				
+				WaitGuard(Transaction& t, const Lockable* resource, LockMode mode, bool conversion) : transaction(t)
+				{
+					transaction.startWaiting(resource, mode, conversion);
+				}
+				
+				~WaitGuard()
+				{
+					transaction.stopWaiting();
+				}
+				
+			private:
+				
+				Transaction& transaction;
+		};
+		
+		void startWaiting(const Lockable* resource, LockMode mode, bool conversion)
+		{
+			boost::lock_guard<boost::mutex> guard(waitsMutex);
+			
+			// the locks held by a blocked transaction cannot change until it stops waiting, so a snapshot is enough
+			heldLocks.clear();
+			BOOST_FOREACH(const TransactionLocks::value_type& i, locks)
+				heldLocks.push_back(HeldLock(i.first, i.second));
+			
+			waitingResource = resource;
+			waitingMode = mode;
+			waitingConversion = conversion;
+			// the lock orders new requests the same way, so the graph knows who queues behind whom,
+			// requests are ordered by when they started waiting plus the aging limit of their class
+			Lockable::Ticket order = boost::chrono::duration_cast<boost::chrono::nanoseconds>(Clock::now().time_since_epoch() + priorityAging[priority]).count();
+			// tickets have to be unique, and those of one class differ from the others in their lowest bits
+			order = std::max(order, lastTicketOrders[priority] + 1);
+			lastTicketOrders[priority] = order;
+			waitingTicket = ModeLock::makeTicket(order, priority);
+			
+			// a deadlock can only close when a transaction starts waiting, so checking here finds every cycle
+			// and the transaction that closes it is the victim
+			if(closesCycle())
+			{
+				waitingResource = NULL;
+				
+				if(DEBUG_TRANSACTIONS)
+				{
+					boost::lock_guard<boost::mutex> guard2(coutMutex);
+					std::cout << "transaction " << threadId << ": deadlock on " << resource << std::endl << std::flush;
+				}
+				
+				recordDeadlock(resource, mode);
+				throw DeadlockException();
+			}
+			
+			waitingTransactions.insert(this);
+		}
+		
+		void stopWaiting()
+		{
+			boost::lock_guard<boost::mutex> guard(waitsMutex);
+			waitingTransactions.erase(this);
+			waitingResource = NULL;
+		}
+		
+		// true if the blocked transaction waiter cannot proceed before the blocked transaction holder does
+		static bool waitsFor(const Transaction* waiter, const Transaction* holder)
+		{
+			if(waiter == holder)
+				return false;
+			
+			BOOST_FOREACH(const HeldLock& i, holder->heldLocks)
+				if(i.resource == waiter->waitingResource && !Lockable::compatible(waiter->waitingMode, i.mode))
+					return true;
+			
+			// new requests may also queue behind earlier ones, conversions do not
+			return holder->waitingResource == waiter->waitingResource
+				&& !waiter->waitingConversion
+				&& waiter->waitingResource->queuesBehind(waiter->waitingMode, waiter->waitingTicket, holder->waitingMode, holder->waitingTicket);
+		}
+		
+		// depth first search of the wait-for graph, must be called with waitsMutex held
+		bool closesCycle() const
+		{
+			std::vector<const Transaction*> stack(1, this);
+			boost::unordered_set<const Transaction*> visited;
+			
+			while(!stack.empty())
+			{
+				const Transaction* waiter = stack.back();
+				stack.pop_back();
+				
+				if(waitsFor(waiter, this))
+					return true;
+				
+				BOOST_FOREACH(const Transaction* holder, waitingTransactions)
+					if(waitsFor(waiter, holder) && visited.insert(holder).second)
+						stack.push_back(holder);
+			}
+			
+			return false;
+		}
+		
+		void recordDeadlock(const Lockable* resource, LockMode mode)
+		{
+			if(!resource->isLockHistoryEnabled())
+				return;
+			
+			Locks deadlocked;
+			deadlocked[resource] = mode;
+			learnLocks(transactionStartAddress, deadlocked);
+		}
+		
+		static LockMode parseLockMode(const std::string& name)
+		{
+			for(unsigned int i = LockModes::IntentionShared; i < LockModes::Count; i++)
+				if(name == LockModes::toString(LockMode(i)))
+					return LockMode(i);
+			throw std::runtime_error("Invalid lock mode '" + name + "'");
+		}
+		
+		// the name of a named call site, the address of any other
+		static std::string callSiteToString(const void* site)
+		{
+			{
+				boost::lock_guard<boost::mutex> guard(callSiteNamesMutex);
+				BOOST_FOREACH(const std::string& name, callSiteNames)
+					if(&name == site)
+						return name;
+			}
+			
+			std::ostringstream address;
+			address << site;
+			return address.str();
+		}
+		
+		// the history is split by start address into shards, each published as a whole with a generation
+		// that tells threads when their cached copies are out of date, so readers never take a lock
+		struct HistoryShard
+		{
+			HistoryShard() : history(new LockHistory), generation(0) { }
+			
+			// only serializes writers
+			boost::mutex mutex;
+			LockHistoryPtr history;
+			boost::atomic<unsigned int> generation;
+			char padding[64];
+		};
+		
+		static HistoryShard& historyShard(const void* address)
+		{
+			return historyShards[boost::hash<const void*>()(address) % HistoryShardCount];
+		}
+		
+		// must be called with the shard's mutex held
+		static void publishHistory(HistoryShard& shard, const boost::shared_ptr<LockHistory>& history)
+		{
+			boost::atomic_store(&shard.history, LockHistoryPtr(history));
+			shard.generation.fetch_add(1, boost::memory_order_release);
+		}
+		
+		static size_t lockHistorySize()
+		{
+			size_t size = 0;
+			BOOST_FOREACH(HistoryShard& shard, historyShards)
+				size += boost::atomic_load(&shard.history)->size();
+			return size;
+		}
+		
+		// merges modes locked from address into the shared history
+		template<typename LockMap>
+		static void learnLocks(const void* address, const LockMap& learned)
+		{
+			HistoryShard& shard(historyShard(address));
+			boost::lock_guard<boost::mutex> guard(shard.mutex);
+			LockHistoryPtr history(boost::atomic_load(&shard.history));
+			
+			boost::shared_ptr<Locks> locks(new Locks);
+			LockHistory::const_iterator it = history->find(address);
+			if(it != history->end())
+				*locks = *it->second;
+			
+			bool changed = false;
+			BOOST_FOREACH(const typename LockMap::value_type& i, learned)
+			{
+				if(!i.first->isLockHistoryEnabled())
+					continue;
+				LockMode& mode((*locks)[i.first]);
+				LockMode combined = Lockable::combine(mode, i.second);
+				changed |= combined != mode;
+				mode = combined;
+			}
+			
+			// another thread may have learned the same already
+			if(!changed)
+				return;
+			
+			boost::shared_ptr<LockHistory> updated(new LockHistory(*history));
+			(*updated)[address] = locks;
+			publishHistory(shard, updated);
+		}
+		
+		// the modes locked from the current start address as this thread has seen them last,
+		// refreshed from the shared history only when that changed since
+		const OrderedLocks& learnedLocks()
+		{
+			HistoryShard& shard(historyShard(transactionStartAddress));
+			unsigned int generation = shard.generation.load(boost::memory_order_acquire);
+			
+			CachedLocks& cached(lockHistoryCache[transactionStartAddress]);
+			if(!cached.valid || cached.generation != generation)
+			{
+				LockHistoryPtr history(boost::atomic_load(&shard.history));
+				LockHistory::const_iterator it = history->find(transactionStartAddress);
+				cached.locks = it != history->end() ? it->second : LocksPtr();
+				cached.ordered.clear();
+				if(cached.locks)
+				{
+					cached.ordered.assign(cached.locks->begin(), cached.locks->end());
+					std::sort(cached.ordered.begin(), cached.ordered.end());
+				}
+				cached.generation = generation;
+				cached.valid = true;
+			}
+			
+			return cached.ordered;
+		}
+		
+		// true if held adds nothing to the modes cached for the current start address
+		bool historyCovers(const TransactionLocks& held) const
+		{
+			LockHistoryCache::const_iterator cached = lockHistoryCache.find(transactionStartAddress);
+			const Locks* history = cached != lockHistoryCache.end() ? cached->second.locks.get() : NULL;
+			
+			BOOST_FOREACH(const TransactionLocks::value_type& i, held)
+			{
+				if(!i.first->isLockHistoryEnabled())
+					continue;
+				if(!history)
+					return false;
+				Locks::const_iterator it = history->find(i.first);
+				if(it == history->end() || Lockable::combine(it->second, i.second) != it->second)
+					return false;
+			}
+			
+			return true;
 		}
 		
 		// disable copying
@@ -436,19 +1242,50 @@ public:
 		
 		static boost::mutex coutMutex;
 		
-		static boost::mutex transactionsMutex;
-		static Transactions transactions;
+		static thread_local Transaction threadTransaction;
 		
 		boost::thread::id threadId;
-		SharedLocks sharedLocks;
-		UpgradeLocks upgradeLocks;
-		UpgradedLocks upgradedLocks;
-		ExclusiveLocks exclusiveLocks;
+		unsigned int references;
+		LockTimeout lockTimeout;
+		TransactionLocks locks;
+		
+		TransactionMode transactionMode;
+		Priority priority;
+		// true until an optimistic transaction escalates
+		bool optimistic;
+		static thread_local bool readingOptimistically;
+		// set once validation failed, the transaction can only be ended then
+		bool conflicted;
+		ShortLocks shortLocks;
+		ReadSet readSet;
+		Owners owners;
+		
+		static LockTimeout defaultLockTimeout;
+		
+		static boost::mutex waitsMutex;
+		static WaitingTransactions waitingTransactions;
+		static Lockable::Ticket lastTicketOrders[Priorities::Count];
+		static boost::chrono::milliseconds priorityAging[Priorities::Count];
+		const Lockable* waitingResource;
+		LockMode waitingMode;
+		bool waitingConversion;
+		Lockable::Ticket waitingTicket;
+		HeldLocks heldLocks;
 		
 		const void* transactionStartAddress;
-		static boost::mutex historyMutex;
-		static LockHistory sharedLockHistory;
-		static LockHistory exclusiveLockHistory;
+		static const unsigned int HistoryShardCount = 16;
+		static HistoryShard historyShards[HistoryShardCount];
+		LockHistoryCache lockHistoryCache;
+		// the counters of the call sites this thread waited from
+		CallSiteCounters callSiteCountersCache;
+		
+		// only taken to add the counters of a new call site or to read all of them
+		static boost::mutex callSiteMutex;
+		static CallSiteCounters callSiteCounters;
+		static WaitCounters priorityWaits[Priorities::Count];
+		static boost::mutex callSiteNamesMutex;
+		static CallSiteNames callSiteNames;
+		LockTimes lockTimes;
 };
 
 #define TRANSACTION_H_DONE
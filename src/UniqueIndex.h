@@ -0,0 +1,73 @@
+#ifndef UNIQUE_INDEX_H
+#define UNIQUE_INDEX_H
+
+#include <string>
+#include <boost/lexical_cast.hpp>
+#include <boost/functional/hash.hpp>
+
+template<
+	typename ModelClassPtr,
+	typename KeyType,
+	class KeyHashFunctor = boost::hash<KeyType>,
+	class EqualKey = std::equal_to<KeyType>
+>
+class UniqueIndex;
+
+#include "ModelStore.h"
+#include "StorageIndex.h"
+#include "UniqueMap.h"
+#include "UniqueKeyException.h"
+
+// index with at most one instance per key, so a lookup is a single probe, storing a key another instance has throws;
+// it is not split into shards since that would only keep the keys unique per shard
+template<
+	typename ModelClassPtr,
+	typename KeyType,
+	class KeyHashFunctor,
+	class EqualKey
+>
+class UniqueIndex : public StorageIndex< ModelClassPtr, KeyType, UniqueMap< KeyType, typename ModelStore<ModelClassPtr>::ID, ModelClassPtr, KeyHashFunctor, EqualKey > >
+{
+	public:
+		
+		typedef StorageIndex< ModelClassPtr, KeyType, UniqueMap< KeyType, typename ModelStore<ModelClassPtr>::ID, ModelClassPtr, KeyHashFunctor, EqualKey > > ParentClass;
+		
+		UniqueIndex() : ParentClass(0, 1) { };
+		virtual ~UniqueIndex() { };
+		
+		// the instance stays locked until the transaction ends, so a transaction finding its key taken by an instance
+		// another one is still writing waits for that one to end, which may take the key back, before it gives up
+		virtual void store(FieldId id, const boost::any& key, ModelClassPtr instance)
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			const ModelStore<ModelClassPtr>& modelStore = ModelStoreGetter<ModelClassPtr>()();
+			modelStore.lockInstance(instance);
+			
+			const KeyType& lookup(boost::any_cast<const KeyType&>(key));
+			ModelClassPtr waitedFor;
+			while(true)
+			{
+				ModelClassPtr holder;
+				{
+					Transaction::ScopedLock lock(*transaction, this, LockModes::Exclusive);
+					
+					// checked before the entry of instance goes, so the index is left as it was
+					const ModelClassPtr* held = this->storage.find(lookup);
+					if(!held || *held == instance)
+					{
+						ParentClass::store(id, key, instance);
+						return;
+					}
+					if(*held == waitedFor)
+						throw UniqueKeyException(getClassName<typename ModelClassPtr::element_type>(), boost::lexical_cast<std::string>(lookup));
+					holder = *held;
+				}
+				
+				// not under the index lock, the writer of holder may need it to take the key back
+				modelStore.waitForInstance(holder);
+				waitedFor = holder;
+			}
+		}
+};
+
+#endif /* UNIQUE_INDEX_H */
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "DatabaseException.h"
+
+class UniqueKeyException : public DatabaseException
+{
+	public:
+		UniqueKeyException(std::string modelClass, std::string key) : DatabaseException("Key '" + key + "' of type '" + modelClass + "' is taken") { };
+	private:
+};
@@ -0,0 +1,134 @@
+#ifndef UNIQUE_MAP_H
+#define UNIQUE_MAP_H
+
+#include <cstddef>
+
+template<typename ModelClassPtr>
+class ModelStore;
+
+#include "FlatTable.h"
+#include "InstanceSlots.h"
+#include "Bitmap.h"
+
+// Keys to their one value and ids back to their value and key, the storage of unique indexes. A flat table holds
+// the value of every key, so a lookup is a single probe, and the values sit in slots by id like in FlatMultimap;
+// the id of a value found by key is the one its store has for it.
+template<typename Key, typename ID, typename Value, class KeyHash, class KeyEqual>
+class UniqueMap
+{
+	public:
+		
+		UniqueMap(std::size_t position, std::size_t count) : locations(position, count) { }
+		
+		// NULL if key has no value
+		const Value* find(const Key& key) const
+		{
+			const typename Keys::Entry* entry = keys.find(key);
+			return entry ? &entry->second : NULL;
+		}
+		
+		// NULL if id is not there
+		const Value* at(ID id) const
+		{
+			const Location* location = locations.at(id);
+			return location ? &location->value : NULL;
+		}
+		
+		std::size_t count(const Key& key) const
+		{
+			return find(key) ? 1 : 0;
+		}
+		
+		bool contains(const Key& key, ID id) const
+		{
+			const Location* location = locations.at(id);
+			return location && KeyEqual()(location->key, key);
+		}
+		
+		// calls visitor with the id and the value of key if its id is first or later, see FlatMultimap::forEach()
+		template<typename Visitor>
+		bool forEach(const Key& key, Visitor visitor, ID first = 0) const
+		{
+			const Value* value = find(key);
+			if(!value)
+				return true;
+			ID id = ModelStore<Value>::storedId(*value);
+			return id < first || visitor(id, *value);
+		}
+		
+		// the same for ids from anywhere, ids that are not here are left out
+		template<typename Visitor>
+		bool forEach(const Bitmap& ids, Visitor visitor, ID first = 0) const
+		{
+			return ids.forEach(VisitValue<Visitor>(*this, visitor), first);
+		}
+		
+		// takes the place of what id had before, key must not have another value
+		void insert(const Key& key, ID id, const Value& value)
+		{
+			erase(id);
+			
+			keys.insert(key, value);
+			Location location;
+			location.value = value;
+			location.key = key;
+			locations.insert(id, location);
+		}
+		
+		bool erase(ID id)
+		{
+			const Location* location = locations.at(id);
+			if(!location)
+				return false;
+			
+			keys.erase(location->key);
+			locations.erase(id);
+			return true;
+		}
+		
+		void clear()
+		{
+			keys.clear();
+			locations.clear();
+		}
+		
+		// the number of values
+		std::size_t size() const
+		{
+			return locations.size();
+		}
+		
+	private:
+		
+		// an empty value marks a free slot, see InstanceSlots
+		struct Location
+		{
+			explicit operator bool() const { return bool(value); }
+			
+			Value value;
+			Key key;
+		};
+		
+		typedef FlatTable<Key, Value, KeyHash, KeyEqual> Keys;
+		typedef InstanceSlots<ID, Location> Locations;
+		
+		template<typename Visitor>
+		struct VisitValue
+		{
+			VisitValue(const UniqueMap& m, Visitor& v) : map(m), visitor(v) { }
+			
+			bool operator()(ID id) const
+			{
+				const Value* value = map.at(id);
+				return !value || visitor(id, *value);
+			}
+			
+			const UniqueMap& map;
+			Visitor& visitor;
+		};
+		
+		Keys keys;
+		Locations locations;
+};
+
+#endif /* UNIQUE_MAP_H */
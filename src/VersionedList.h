@@ -0,0 +1,219 @@
+#ifndef VERSIONED_LIST_H
+#define VERSIONED_LIST_H
+
+#include <cstddef>
+#include <vector>
+#include <boost/foreach.hpp>
+#include <boost/atomic.hpp>
+#include <boost/smart_ptr.hpp>
+
+#include "InstanceSlots.h"
+
+typedef unsigned long long Epoch;
+
+// Append-only list of values stamped with the epochs they were added and erased in.
+// A single writer (serialized by the owner's exclusive lock) appends and erases, its changes stay pending
+// until commit() stamps them with the epoch they are published in.
+// Any number of readers iterate it concurrently and only see the entries visible at the epoch they pinned.
+// Entries are stored in chunks of doubling size that are never moved, so readers never see a reallocation.
+template<typename ID, typename ValueType>
+class VersionedList
+{
+	public:
+		
+		struct Entry
+		{
+			Entry() : added(0), erased(0) { }
+			
+			ID id;
+			ValueType value;
+			boost::atomic<Epoch> added;
+			boost::atomic<Epoch> erased;
+		};
+		
+		typedef boost::shared_ptr< VersionedList > Ptr;
+		
+		// stamp of the changes that have not been committed yet
+		static const Epoch Pending = ~Epoch(0);
+		
+		// the ids of a store shard are congruent to position modulo shards, see InstanceSlots
+		VersionedList(std::size_t position, std::size_t shards) : count(0), positions(position, shards), erasedCount(0)
+		{
+			for(std::size_t i = 0; i < maxChunks; i++)
+				chunks[i].store(NULL, boost::memory_order_relaxed);
+		}
+		
+		~VersionedList()
+		{
+			for(std::size_t i = 0; i < maxChunks; i++)
+				delete[] chunks[i].load(boost::memory_order_relaxed);
+		}
+		
+		void insert(ID id, const ValueType& value)
+		{
+			pending.push_back(append(id, value, Pending));
+		}
+		
+		bool erase(ID id)
+		{
+			const Position* position = positions.at(id);
+			if(!position)
+				return false;
+			
+			std::size_t erased = position->get();
+			at(erased).erased.store(Pending, boost::memory_order_release);
+			pending.push_back(erased);
+			positions.erase(id);
+			erasedCount++;
+			return true;
+		}
+		
+		bool hasPending() const
+		{
+			return !pending.empty();
+		}
+		
+		// stamps the pending changes with the epoch they become visible in, the owner publishes the epoch afterwards
+		void commit(Epoch epoch)
+		{
+			BOOST_FOREACH(std::size_t position, pending)
+			{
+				Entry& entry(at(position));
+				if(entry.added.load(boost::memory_order_relaxed) == Pending)
+					entry.added.store(epoch, boost::memory_order_release);
+				if(entry.erased.load(boost::memory_order_relaxed) == Pending)
+					entry.erased.store(epoch, boost::memory_order_release);
+			}
+			pending.clear();
+		}
+		
+		// erased entries are only dropped by compaction, do it once they make up a quarter of the list,
+		// so a compaction copies at most four entries for every one it drops
+		bool needsCompaction() const
+		{
+			return erasedCount >= minCompactionSize && erasedCount * 4 >= size();
+		}
+		
+		// copy of the list without the entries that were erased at or before epoch,
+		// readers that pinned an older epoch keep using this list until they let go of it,
+		// only called with nothing pending
+		Ptr compact(Epoch epoch) const
+		{
+			Ptr list(new VersionedList(positions.getPosition(), positions.getCount()));
+			
+			std::size_t size = this->size();
+			for(std::size_t i = 0; i < size; i++)
+			{
+				const Entry& entry((*this)[i]);
+				Epoch erased = entry.erased.load(boost::memory_order_relaxed);
+				if(erased != 0 && erased <= epoch)
+					continue;
+				
+				std::size_t position = list->append(entry.id, entry.value, entry.added.load(boost::memory_order_relaxed));
+				if(erased != 0)
+				{
+					list->at(position).erased.store(erased, boost::memory_order_relaxed);
+					list->positions.erase(entry.id);
+					list->erasedCount++;
+				}
+			}
+			
+			return list;
+		}
+		
+		std::size_t size() const
+		{
+			return count.load(boost::memory_order_acquire);
+		}
+		
+		const Entry& operator[](std::size_t position) const
+		{
+			return at(position);
+		}
+		
+		// pending changes are only visible to the transaction that made them
+		static bool visible(const Entry& entry, Epoch epoch, bool ownsPending)
+		{
+			Epoch added = entry.added.load(boost::memory_order_acquire);
+			if(added == Pending ? !ownsPending : added > epoch)
+				return false;
+			
+			Epoch erased = entry.erased.load(boost::memory_order_acquire);
+			if(erased == Pending)
+				return !ownsPending;
+			return erased == 0 || erased > epoch;
+		}
+		
+	private:
+		
+		// the position of the live entry of an id, stored plus one so that zero marks a free slot, see InstanceSlots
+		struct Position
+		{
+			Position() : stored(0) { }
+			explicit Position(std::size_t position) : stored(position + 1) { }
+			
+			explicit operator bool() const { return stored != 0; }
+			std::size_t get() const { return stored - 1; }
+			
+			std::size_t stored;
+		};
+		typedef InstanceSlots<ID, Position> Positions;
+		
+		static const std::size_t firstChunkBits = 6;
+		static const std::size_t firstChunkSize = 1 << firstChunkBits;
+		static const std::size_t maxChunks = 48;
+		static const std::size_t minCompactionSize = 64;
+		
+		// chunk k holds firstChunkSize << k entries
+		static std::size_t chunkIndex(std::size_t position)
+		{
+			return 63 - __builtin_clzll((position >> firstChunkBits) + 1);
+		}
+		
+		static std::size_t chunkOffset(std::size_t position, std::size_t chunk)
+		{
+			return position + firstChunkSize - (firstChunkSize << chunk);
+		}
+		
+		std::size_t append(ID id, const ValueType& value, Epoch added)
+		{
+			std::size_t position = count.load(boost::memory_order_relaxed);
+			
+			std::size_t chunk = chunkIndex(position);
+			if(!chunks[chunk].load(boost::memory_order_relaxed))
+				chunks[chunk].store(new Entry[firstChunkSize << chunk], boost::memory_order_release);
+			
+			Entry& entry(chunks[chunk].load(boost::memory_order_relaxed)[chunkOffset(position, chunk)]);
+			entry.id = id;
+			entry.value = value;
+			entry.added.store(added, boost::memory_order_relaxed);
+			entry.erased.store(0, boost::memory_order_relaxed);
+			
+			positions.erase(id);
+			positions.insert(id, Position(position));
+			
+			// publish the entry to the readers
+			count.store(position + 1, boost::memory_order_release);
+			return position;
+		}
+		
+		Entry& at(std::size_t position) const
+		{
+			std::size_t chunk = chunkIndex(position);
+			return chunks[chunk].load(boost::memory_order_acquire)[chunkOffset(position, chunk)];
+		}
+		
+		// disable copying
+		VersionedList(const VersionedList&);
+		VersionedList& operator=(const VersionedList&);
+		
+		boost::atomic<Entry*> chunks[maxChunks];
+		boost::atomic<std::size_t> count;
+		
+		// writer side only
+		Positions positions;
+		std::vector<std::size_t> pending;
+		std::size_t erasedCount;
+};
+
+#endif /* VERSIONED_LIST_H */
@@ -0,0 +1,6 @@
+
+#define VERSION_MAJOR 0
+#define VERSION_MINOR 1
+
+#define SUPPORTED true
+#define NOT_SUPPORTED false
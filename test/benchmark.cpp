@@ -0,0 +1,395 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/chrono.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "benchmark.h"
+#include "../src/AsyncExecutor.h"
+
+namespace
+{
+	const unsigned int iterations = 100000;
+	const unsigned int threadCount = 8;
+	
+	typedef boost::chrono::steady_clock Clock;
+	
+	double nanosecondsPerCall(Clock::time_point start, unsigned int calls)
+	{
+		return double(boost::chrono::duration_cast<boost::chrono::nanoseconds>(Clock::now() - start).count()) / calls;
+	}
+	
+	void startTransactions()
+	{
+		for(unsigned int i = 0; i < iterations; i++)
+			Transaction::startTransaction();
+	}
+	
+	void getPeople(PersonStore& people, boost::barrier& ready)
+	{
+		ready.wait();
+		for(unsigned int i = 0; i < iterations / threadCount; i++)
+			people.get<person::NUMBER>(1);
+	}
+	
+	// one read per transaction, optimistic ones give up their read locks right after the read and validate on commit
+	void readNumbers(PersonStore& people, TransactionModes::TransactionMode mode, boost::barrier& ready)
+	{
+		ready.wait();
+		for(unsigned int i = 0; i < iterations / threadCount; i++)
+		{
+			TransactionPtr transaction = Transaction::startTransaction(mode);
+			people.get<person::NUMBER>(1)->getNumber();
+			transaction->commit();
+		}
+	}
+	
+	void setNumbersInteractively(PersonPtr p, boost::barrier& ready)
+	{
+		ready.wait();
+		for(unsigned int i = 0; i < iterations / threadCount; i++)
+		{
+			TransactionPtr transaction = Transaction::startTransaction(TransactionModes::Pessimistic, Priorities::Interactive);
+			p->setNumber(i);
+		}
+	}
+	
+	// keeps locking the whole store for a moment like imports and cleanups do
+	void lockStore(PersonStore& people, Priorities::Priority priority, const boost::atomic<bool>& done, boost::barrier& ready)
+	{
+		ready.wait();
+		while(!done)
+		{
+			{
+				TransactionPtr transaction = Transaction::startTransaction(TransactionModes::Pessimistic, priority);
+				transaction->getExclusiveLock(&people);
+				boost::this_thread::sleep_for(boost::chrono::microseconds(100));
+			}
+			boost::this_thread::sleep_for(boost::chrono::microseconds(100));
+		}
+	}
+	
+	struct CountPeople
+	{
+		CountPeople(unsigned int& c) : count(c) { }
+		
+		bool operator()(const PersonPtr&) const
+		{
+			count++;
+			return true;
+		}
+		
+		unsigned int& count;
+	};
+	
+	void setNumbers(PersonPtr p, boost::barrier& ready)
+	{
+		ready.wait();
+		for(unsigned int i = 0; i < iterations / threadCount; i++)
+			p->setNumber(i);
+	}
+}
+
+void benchmarkTransactions(db& database)
+{
+	PersonStore& people(database.people);
+	
+	std::cout << "transaction benchmark," << std::endl;
+	
+	Clock::time_point start = Clock::now();
+	startTransactions();
+	std::cout << "startTransaction(): " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	{
+		TransactionPtr transaction = Transaction::startTransaction();
+		start = Clock::now();
+		startTransactions();
+		std::cout << "nested startTransaction(): " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	}
+	
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations; i++)
+		people.get<person::NUMBER>(1);
+	std::cout << "get<person::NUMBER>(): " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	boost::barrier ready(threadCount + 1);
+	boost::thread_group threads;
+	for(unsigned int i = 0; i < threadCount; i++)
+		threads.create_thread(boost::bind(getPeople, boost::ref(people), boost::ref(ready)));
+	ready.wait();
+	start = Clock::now();
+	threads.join_all();
+	std::cout << "get<person::NUMBER>() from " << threadCount << " threads: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	// the same with the other lock policies on the store and its indexes
+	const LockPolicies::LockPolicy policies[] = { LockPolicies::BigReader, LockPolicies::PhaseFair };
+	const char* policyNames[] = { "big reader", "phase fair" };
+	for(unsigned int p = 0; p < 2; p++)
+	{
+		people.setLockPolicy(policies[p]);
+		for(unsigned int i = 0; i < threadCount; i++)
+			threads.create_thread(boost::bind(getPeople, boost::ref(people), boost::ref(ready)));
+		ready.wait();
+		start = Clock::now();
+		threads.join_all();
+		std::cout << "get<person::NUMBER>() from " << threadCount << " threads with " << policyNames[p] << " locks: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	}
+	people.setLockPolicy(LockPolicies::Queue);
+	
+	for(unsigned int i = 0; i < threadCount; i++)
+		threads.create_thread(boost::bind(readNumbers, boost::ref(people), TransactionModes::Pessimistic, boost::ref(ready)));
+	ready.wait();
+	start = Clock::now();
+	threads.join_all();
+	std::cout << "pessimistic read transactions from " << threadCount << " threads: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	for(unsigned int i = 0; i < threadCount; i++)
+		threads.create_thread(boost::bind(readNumbers, boost::ref(people), TransactionModes::Optimistic, boost::ref(ready)));
+	ready.wait();
+	start = Clock::now();
+	threads.join_all();
+	std::cout << "optimistic read transactions from " << threadCount << " threads: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	// every thread writes its own person, with a sharded store most of them land in different shards
+	std::vector<PersonPtr> writers;
+	for(unsigned int i = 0; i < threadCount; i++)
+	{
+		writers.push_back(PersonPtr(new person("benchmark writer", 0)));
+		writers.back()->store();
+	}
+	
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations; i++)
+		people.getInstance(writers[i % threadCount]->getId());
+	std::cout << "getInstance(getId()): " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations; i++)
+		people.toJson(writers[i % threadCount]);
+	std::cout << "toJson(): " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	// the same people once copied into a list and once only visited
+	unsigned int count = 0;
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations / 10; i++)
+		count += people.getList()->size();
+	std::cout << "getList() of " << count / (iterations / 10) << " people: " << nanosecondsPerCall(start, iterations / 10) << " ns/call" << std::endl;
+	
+	count = 0;
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations / 10; i++)
+		people.forEach(CountPeople(count));
+	std::cout << "forEach() over " << count / (iterations / 10) << " people: " << nanosecondsPerCall(start, iterations / 10) << " ns/call" << std::endl;
+	
+	count = 0;
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations; i++)
+		count += people.getList<person::NUMBER>(0)->size();
+	std::cout << "getList<person::NUMBER>() of " << count / iterations << " people: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	count = 0;
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations; i++)
+		people.forEach<person::NUMBER>(0, CountPeople(count));
+	std::cout << "forEach<person::NUMBER>() over " << count / iterations << " people: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	// the first page costs as much as the page, not the store or the instances with the value
+	const std::size_t pageSize = 10;
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations; i++)
+		people.getPage(PageToken(), pageSize);
+	std::cout << "getPage() of " << pageSize << " people: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations; i++)
+		people.getPage<person::NUMBER>(0, PageToken(), pageSize);
+	std::cout << "getPage<person::NUMBER>() of " << pageSize << " people: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	// erasing a founder erases the groups it founded, found through the relation index on their founder field
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations / 10; i++)
+	{
+		PersonPtr founder(new person("benchmark founder", 0));
+		founder->store();
+		GroupPtr(new group("benchmark group", founder))->store();
+		founder->erase();
+	}
+	std::cout << "store() and erase() of a founder with a group: " << nanosecondsPerCall(start, iterations / 10) << " ns/call" << std::endl;
+	
+	// two field lookups, once through an index on both fields and once intersecting the indexes of each field
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations; i++)
+		people.get<person::NAME, person::NUMBER>("benchmark", 1);
+	std::cout << "get<person::NAME, person::NUMBER>() through a compound index: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	PersonPtr founder(new person("benchmark founder", 0));
+	founder->store();
+	GroupPtr(new group("benchmark group", founder))->store();
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations; i++)
+		database.groups.get<group::NAME, group::FOUNDER>("benchmark group", founder);
+	std::cout << "get<group::NAME, group::FOUNDER>() through index intersection: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	founder->erase();
+	
+	// a range of names out of a thousand groups, once through an ordered index and once scanning them all,
+	// the groups store is still empty here so the string index can replace the hash index on the names
+	GroupStore& groups(database.groups);
+	groups.addStringIndex<group::NAME>();
+	founder = PersonPtr(new person("benchmark founder", 0));
+	founder->store();
+	for(unsigned int i = 1000; i < 2000; i++)
+		GroupPtr(new group("group " + boost::lexical_cast<std::string>(i), founder))->store();
+	
+	count = 0;
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations / 10; i++)
+		count += groups.getRange<group::NAME>(std::string("group 1100"), std::string("group 1199"))->size();
+	std::cout << "getRange<group::NAME>() of " << count / (iterations / 10) << " groups: " << nanosecondsPerCall(start, iterations / 10) << " ns/call" << std::endl;
+	
+	count = 0;
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations / 10; i++)
+	{
+		GroupStore::ModelListPtr list(groups.getList());
+		BOOST_FOREACH(const GroupPtr& g, *list)
+		{
+			std::string name(g->getName());
+			if(name >= "group 1100" && name <= "group 1199")
+				count++;
+		}
+	}
+	std::cout << "getList() scan for " << count / (iterations / 10) << " groups: " << nanosecondsPerCall(start, iterations / 10) << " ns/call" << std::endl;
+	
+	// autocompletion of names, the first ten of a hundred
+	count = 0;
+	start = Clock::now();
+	for(unsigned int i = 0; i < iterations; i++)
+		count += groups.getPrefixList<group::NAME>("group 11", 10)->size();
+	std::cout << "getPrefixList<group::NAME>() of " << count / iterations << " groups: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	founder->erase();
+	for(unsigned int i = 0; i < threadCount; i++)
+		threads.create_thread(boost::bind(setNumbers, writers[i], boost::ref(ready)));
+	ready.wait();
+	start = Clock::now();
+	threads.join_all();
+	std::cout << "setNumber() from " << threadCount << " threads on " << people.getShardCount() << " shards: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	
+	// interactive writers against two threads locking the whole store, first at the same priority as everybody else and then as batch work
+	const unsigned int lockerCount = 2;
+	const Priorities::Priority lockerPriorities[] = { Priorities::Normal, Priorities::Batch };
+	BOOST_FOREACH(Priorities::Priority priority, lockerPriorities)
+	{
+		Transaction::resetPriorityWaits();
+		boost::atomic<bool> done(false);
+		boost::barrier lockersReady(threadCount + lockerCount + 1);
+		boost::thread_group lockers;
+		for(unsigned int i = 0; i < lockerCount; i++)
+			lockers.create_thread(boost::bind(lockStore, boost::ref(people), priority, boost::cref(done), boost::ref(lockersReady)));
+		for(unsigned int i = 0; i < threadCount; i++)
+			threads.create_thread(boost::bind(setNumbersInteractively, writers[i], boost::ref(lockersReady)));
+		lockersReady.wait();
+		start = Clock::now();
+		threads.join_all();
+		double perCall = nanosecondsPerCall(start, iterations);
+		done = true;
+		lockers.join_all();
+		std::cout << "interactive setNumber() from " << threadCount << " threads with " << Priorities::toString(priority) << " store locks: " << perCall << " ns/call, "
+			<< "p99 wait " << Transaction::getPriorityWaits(Priorities::Interactive).percentile(0.99).count() << " ns, "
+			<< "longest store lock wait " << Transaction::getPriorityWaits(priority).maxWait.count() << " ns" << std::endl;
+	}
+	
+	// the same writes submitted to two worker threads while the store keeps getting locked as a whole,
+	// the workers put writes that would have to wait for it aside instead of blocking
+	{
+		static const void* site = Transaction::callSite("benchmark async setNumber");
+		boost::atomic<bool> done(false);
+		boost::barrier lockerReady(2);
+		boost::thread locker(boost::bind(lockStore, boost::ref(people), Priorities::Batch, boost::cref(done), boost::ref(lockerReady)));
+		lockerReady.wait();
+		
+		AsyncExecutor executor(2);
+		std::vector< boost::unique_future<void> > futures;
+		start = Clock::now();
+		for(unsigned int i = 0; i < iterations; i++)
+			futures.push_back(executor.submit(site, boost::bind(&person::setNumber, writers[i % threadCount], i)));
+		BOOST_FOREACH(boost::unique_future<void>& future, futures)
+			future.get();
+		std::cout << "async setNumber() on 2 worker threads with batch store locks: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+		
+		done = true;
+		locker.join();
+	}
+	
+	// again with lock statistics, to see what they cost and where the writers wait
+	people.setLockStatisticsEnabled(true);
+	Transaction::resetCallSiteWaits();
+	for(unsigned int i = 0; i < threadCount; i++)
+		threads.create_thread(boost::bind(setNumbers, writers[i], boost::ref(ready)));
+	ready.wait();
+	start = Clock::now();
+	threads.join_all();
+	std::cout << "setNumber() from " << threadCount << " threads with lock statistics: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+	std::cout << *people.lockStatisticsToJson() << Transaction::callSiteWaitsToJson() << std::endl;
+	people.setLockStatisticsEnabled(false);
+	
+	BOOST_FOREACH(PersonPtr& p, writers)
+		p->erase();
+	
+	// a field with few values over many people, once through the hash index on the numbers and once through a bitmap index,
+	// which has to replace it while the store is empty
+	people.get<person::NAME>("benchmark")->erase();
+	const unsigned int manyCount = 100000;
+	const unsigned int numberCount = 8;
+	for(unsigned int pass = 0; pass < 2; pass++)
+	{
+		const char* indexName = pass == 0 ? "hash" : "bitmap";
+		if(pass == 1)
+			people.addBitmapIndex<person::NUMBER>();
+		
+		std::vector<PersonPtr> many;
+		for(unsigned int i = 0; i < manyCount; i++)
+		{
+			many.push_back(PersonPtr(new person("benchmark many", i % numberCount)));
+			many.back()->store();
+		}
+		
+		count = 0;
+		start = Clock::now();
+		for(unsigned int i = 0; i < iterations; i++)
+			count += people.getIndex(person::NUMBER)->count(1u);
+		std::cout << "count of " << count / iterations << " people through the " << indexName << " index: " << nanosecondsPerCall(start, iterations) << " ns/call" << std::endl;
+		
+		count = 0;
+		start = Clock::now();
+		for(unsigned int i = 0; i < iterations / 100; i++)
+			count += people.getList<person::NUMBER>(1)->size();
+		std::cout << "getList<person::NUMBER>() of " << count / (iterations / 100) << " people through the " << indexName << " index: " << nanosecondsPerCall(start, iterations / 100) << " ns/call" << std::endl;
+		
+		if(pass == 1)
+		{
+			// numbers 1 to 3 but not 2
+			std::vector<unsigned int> numbers;
+			for(unsigned int n = 1; n <= 3; n++)
+				numbers.push_back(n);
+			count = 0;
+			start = Clock::now();
+			for(unsigned int i = 0; i < iterations / 10; i++)
+				count += (people.getBitmap<person::NUMBER>(numbers) - people.getBitmap<person::NUMBER>(2)).size();
+			std::cout << "getBitmap<person::NUMBER>() of " << count / (iterations / 10) << " people in 1, 2, 3 and not 2: " << nanosecondsPerCall(start, iterations / 10) << " ns/call" << std::endl;
+			
+			count = 0;
+			start = Clock::now();
+			for(unsigned int i = 0; i < iterations / 100; i++)
+				people.forEach(people.getBitmap<person::NUMBER>(numbers) - people.getBitmap<person::NUMBER>(2), CountPeople(count));
+			std::cout << "forEach() over " << count / (iterations / 100) << " people of that bitmap: " << nanosecondsPerCall(start, iterations / 100) << " ns/call" << std::endl;
+		}
+		
+		BOOST_FOREACH(PersonPtr& p, many)
+			p->erase();
+	}
+	
+	std::cout << std::endl;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "db.h"
+
+void benchmarkTransactions(db& database);
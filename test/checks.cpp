@@ -0,0 +1,1139 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <iterator>
+#include <fstream>
+#include <limits>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/filesystem.hpp>
+
+#include "checks.h"
+#include "../src/AsyncExecutor.h"
+
+namespace
+{
+	unsigned int failures = 0;
+	// the lock policy the checks of locking behavior run with right now, named in their failures
+	std::string lockPolicyName;
+	
+	void check(bool passed, const std::string& what)
+	{
+		if(passed)
+			return;
+		std::cout << "FAILED: " << what << (lockPolicyName.empty() ? "" : " (" + lockPolicyName + " locks)") << std::endl;
+		failures++;
+	}
+	
+	// the people a check works on, they go again with everything else still in the store once the check is done,
+	// so the next check starts on an empty store
+	class StoreFixture
+	{
+		public:
+			
+			explicit StoreFixture(PersonStore& p) : people(p) { }
+			
+			PersonPtr store(const std::string& name, unsigned int number)
+			{
+				PersonPtr p(new person(name, number));
+				p->store();
+				return p;
+			}
+			
+			void clear()
+			{
+				PersonStore::ModelListPtr list(people.getList());
+				BOOST_FOREACH(const PersonPtr& p, *list)
+					p->erase();
+				check(people.size() == 0 && people.getList()->empty(), "the store is empty again");
+			}
+		
+		private:
+			
+			PersonStore& people;
+	};
+	
+	// locks first and then second exclusively, counting the deadlocks it is picked as the victim of
+	void lockBoth(const Lockable* first, const Lockable* second, boost::barrier& ready, boost::atomic<unsigned int>& deadlocks)
+	{
+		try
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getExclusiveLock(first);
+			ready.wait();
+			transaction->getExclusiveLock(second);
+		}
+		catch(const DeadlockException&)
+		{
+			deadlocks++;
+		}
+	}
+	
+	void checkDeadlock(LockPolicies::LockPolicy policy)
+	{
+		Lockable a(policy), b(policy);
+		boost::barrier ready(2);
+		boost::atomic<unsigned int> deadlocks(0);
+		
+		boost::thread first(boost::bind(lockBoth, &a, &b, boost::ref(ready), boost::ref(deadlocks)));
+		boost::thread second(boost::bind(lockBoth, &b, &a, boost::ref(ready), boost::ref(deadlocks)));
+		first.join();
+		second.join();
+		
+		check(deadlocks == 1, "two transactions locking in opposite orders, one of them gets a DeadlockException");
+	}
+	
+	void lockAll(const Lockable* locks, std::size_t count)
+	{
+		TransactionPtr transaction = Transaction::startTransaction();
+		for(std::size_t i = 0; i < count; i++)
+			transaction->getExclusiveLock(&locks[i]);
+	}
+	
+	// called when a task that failed to take its locks up front releases the first one again, lets the holder swap
+	// the locks it holds and waits until it has, so the task only parks on the second one after its release
+	void swapBeforeParking(boost::atomic<unsigned int>& step)
+	{
+		step = 1;
+		while(step != 2)
+			boost::this_thread::yield();
+	}
+	
+	// holds the second lock until the task released the first one, then holds the first one for a while instead
+	void holdSecond(const Lockable* locks, boost::barrier& held, boost::atomic<unsigned int>& step)
+	{
+		TransactionPtr transaction = Transaction::startTransaction();
+		transaction->getExclusiveLock(&locks[1]);
+		held.wait();
+		
+		while(step != 1)
+			boost::this_thread::yield();
+		transaction->getExclusiveLock(&locks[0]);
+		transaction->releaseLock(&locks[1]);
+		step = 2;
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+	}
+	
+	void checkExecutorWakeups(LockPolicies::LockPolicy policy)
+	{
+		// in address order, which is the order tasks take them up front
+		Lockable locks[2];
+		locks[0].setLockPolicy(policy);
+		locks[1].setLockPolicy(policy);
+		const void* site = Transaction::callSite("check executor wakeups");
+		
+		AsyncExecutor executor(1);
+		// learns the locks for the site
+		executor.submit(site, boost::bind(lockAll, locks, 2)).get();
+		
+		// the task misses the second lock, which is released before the task is parked on it, and then misses the first one
+		boost::atomic<unsigned int> step(0);
+		boost::barrier held(2);
+		boost::thread holder(boost::bind(holdSecond, locks, boost::ref(held), boost::ref(step)));
+		held.wait();
+		locks[0].notifyOnRelease(boost::bind(swapBeforeParking, boost::ref(step)));
+		
+		boost::unique_future<void> done(executor.submit(site, boost::bind(lockAll, locks, 2)));
+		holder.join();
+		bool lost = done.wait_for(boost::chrono::seconds(2)) == boost::future_status::timeout;
+		if(lost)
+		{
+			// releasing the locks again wakes whatever it is parked on
+			lockAll(locks, 2);
+		}
+		done.get();
+		
+		check(!lost, "a task parked by the executor runs once the locks it missed are released");
+	}
+	
+	// locks lock once the writer holding it is gone, noting its turn among the ones waiting for it
+	void lockInTurn(const Lockable* lock, bool exclusive, boost::atomic<unsigned int>& turns, unsigned int& turn)
+	{
+		TransactionPtr transaction = Transaction::startTransaction();
+		if(exclusive)
+			transaction->getExclusiveLock(lock);
+		else
+			transaction->getSharedLock(lock);
+		turn = ++turns;
+	}
+	
+	void checkPhaseFair()
+	{
+		Lockable lock(LockPolicies::PhaseFair);
+		boost::atomic<unsigned int> turns(0);
+		unsigned int writerTurn = 0, readerTurn = 0;
+		boost::scoped_ptr<boost::thread> writer, reader;
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getExclusiveLock(&lock);
+			// the next writer asks first, so it would go first if requests were served in order
+			writer.reset(new boost::thread(boost::bind(lockInTurn, &lock, true, boost::ref(turns), boost::ref(writerTurn))));
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+			reader.reset(new boost::thread(boost::bind(lockInTurn, &lock, false, boost::ref(turns), boost::ref(readerTurn))));
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+		}
+		writer->join();
+		reader->join();
+		
+		check(readerTurn == 1 && writerTurn == 2, "with phase fair locks a reader waiting when a writer leaves goes before the next writer, even one that waited longer");
+	}
+	
+	// locks lock exclusively in a transaction of the priority class, noting its turn among the ones waiting for it
+	void lockWithPriority(const Lockable* lock, Priorities::Priority priority, boost::atomic<unsigned int>& turns, unsigned int& turn)
+	{
+		TransactionPtr transaction = Transaction::startTransaction(TransactionModes::Pessimistic, priority);
+		transaction->getExclusiveLock(lock);
+		turn = ++turns;
+	}
+	
+	// a Batch request starts waiting for a held lock and an Interactive one delay later, they note their turns once it is released
+	void queueBatchFirst(const boost::chrono::milliseconds& delay, unsigned int& batchTurn, unsigned int& interactiveTurn)
+	{
+		Lockable lock;
+		boost::atomic<unsigned int> turns(0);
+		boost::scoped_ptr<boost::thread> batch, interactive;
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			transaction->getExclusiveLock(&lock);
+			batch.reset(new boost::thread(boost::bind(lockWithPriority, &lock, Priorities::Batch, boost::ref(turns), boost::ref(batchTurn))));
+			boost::this_thread::sleep_for(delay);
+			interactive.reset(new boost::thread(boost::bind(lockWithPriority, &lock, Priorities::Interactive, boost::ref(turns), boost::ref(interactiveTurn))));
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+		}
+		batch->join();
+		interactive->join();
+	}
+	
+	void checkPriorities()
+	{
+		const boost::chrono::milliseconds aging(Transaction::getPriorityAging(Priorities::Batch) - Transaction::getPriorityAging(Priorities::Interactive));
+		unsigned int batchTurn = 0, interactiveTurn = 0;
+		
+		queueBatchFirst(aging / 4, batchTurn, interactiveTurn);
+		check(interactiveTurn == 1 && batchTurn == 2, "an Interactive request goes before a Batch one that waited for less than their aging difference");
+		
+		queueBatchFirst(aging + boost::chrono::milliseconds(50), batchTurn, interactiveTurn);
+		check(batchTurn == 1 && interactiveTurn == 2, "a Batch request goes before an Interactive one once it waited for longer than their aging difference");
+	}
+	
+	// holds the lock exclusively for a moment once the waiter is about to lock it
+	void holdBriefly(const Lockable* lock, boost::barrier& held)
+	{
+		TransactionPtr transaction = Transaction::startTransaction();
+		transaction->getExclusiveLock(lock);
+		held.wait();
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+	}
+	
+	void checkCallSiteWaits()
+	{
+		Lockable lock;
+		const void* site = Transaction::callSite("check call site waits");
+		Transaction::resetCallSiteWaits();
+		
+		boost::barrier held(2);
+		boost::thread holder(boost::bind(holdBriefly, &lock, boost::ref(held)));
+		held.wait();
+		{
+			TransactionPtr transaction = Transaction::startTransaction(site);
+			transaction->getExclusiveLock(&lock);
+		}
+		holder.join();
+		
+		Transaction::CallSiteWaits waits(Transaction::getCallSiteWaits());
+		check(waits[site].waits == 1 && waits[site].maxWait >= boost::chrono::milliseconds(10), "a contended lock is counted as a wait of the call site the transaction started from");
+		
+		Transaction::resetCallSiteWaits();
+		check(Transaction::getCallSiteWaits()[site].waits == 0, "resetCallSiteWaits() zeroes the waits of every call site");
+	}
+	
+	// the history of a named call site on named resources goes through lockHistoryToJson() and back,
+	// names of resources or call sites this run does not know are skipped
+	void checkLockHistoryJson()
+	{
+		Lockable first, second;
+		first.setLockName("check history first");
+		second.setLockName("check history second");
+		{
+			TransactionPtr transaction = Transaction::startTransaction(Transaction::callSite("check history"));
+			transaction->getExclusiveLock(&first);
+			transaction->getSharedLock(&second);
+		}
+		
+		Json::Value saved(Transaction::lockHistoryToJson()["check history"]);
+		check(saved.size() == 2 && saved["check history first"] == "X" && saved["check history second"] == "S", "lockHistoryToJson() has the modes a named call site took on named resources");
+		
+		// loaded for another call site, with a resource and a call site that are not there
+		Json::Value json(Json::objectValue);
+		json["check history loaded"] = saved;
+		json["check history loaded"]["check history missing"] = "X";
+		json["check history unknown"]["check history missing"] = "S";
+		bool loaded = true;
+		try
+		{
+			Transaction::lockHistoryFromJson(json);
+		}
+		catch(const std::exception&)
+		{
+			loaded = false;
+		}
+		
+		Json::Value history(Transaction::lockHistoryToJson());
+		check(loaded && !history.isMember("check history unknown"), "lockHistoryFromJson() skips the names of resources that are not there");
+		check(history["check history loaded"] == saved, "lockHistoryFromJson() restores the modes of a call site on named resources");
+	}
+	
+	void setNumber(PersonPtr p, unsigned int number)
+	{
+		p->setNumber(number);
+	}
+	
+	void checkConflict(PersonStore& people)
+	{
+		StoreFixture fixture(people);
+		PersonPtr p(fixture.store("check conflict", 1));
+		
+		bool conflicted = false;
+		try
+		{
+			TransactionPtr transaction = Transaction::startTransaction(TransactionModes::Optimistic);
+			p->getNumber();
+			// an optimistic reader holds no lock on the instance, so the writer does not wait for it
+			boost::thread writer(boost::bind(setNumber, p, 2));
+			writer.join();
+			transaction->commit();
+		}
+		catch(const ConflictException&)
+		{
+			conflicted = true;
+		}
+		check(conflicted, "an optimistic transaction whose read was overwritten throws a ConflictException on commit");
+		
+		conflicted = false;
+		try
+		{
+			TransactionPtr transaction = Transaction::startTransaction(TransactionModes::Optimistic);
+			check(p->getNumber() == 2, "an optimistic transaction reads the last committed value");
+			transaction->commit();
+		}
+		catch(const ConflictException&)
+		{
+			conflicted = true;
+		}
+		check(!conflicted, "an optimistic transaction nobody wrote after commits");
+		
+		fixture.clear();
+	}
+	
+	// keeps switching the name of p between a short and a long one that do not share their buffer
+	void switchNames(PersonPtr p, const std::string& shortName, const std::string& longName, boost::atomic<unsigned int>& writes, const boost::atomic<bool>& done)
+	{
+		for(unsigned int i = 0; !done; i++)
+		{
+			p->setName(i % 2 ? longName : shortName);
+			writes++;
+		}
+	}
+	
+	void checkTornReads(PersonStore& people)
+	{
+		const std::string shortName("check torn reads");
+		const std::string longName(shortName + std::string(1000, '!'));
+		StoreFixture fixture(people);
+		PersonPtr p(fixture.store(shortName, 1));
+		
+		boost::atomic<unsigned int> writes(0);
+		boost::atomic<bool> done(false);
+		boost::thread writer(boost::bind(switchNames, p, boost::cref(shortName), boost::cref(longName), boost::ref(writes), boost::cref(done)));
+		
+		// reads for as long as the writer needs for its writes, so they overlap
+		unsigned int torn = 0, committed = 0;
+		while(writes < 20000)
+		{
+			try
+			{
+				TransactionPtr transaction = Transaction::startTransaction(TransactionModes::Optimistic);
+				std::string name(p->getName());
+				if(name != shortName && name != longName)
+					torn++;
+				transaction->commit();
+				committed++;
+			}
+			catch(const ConflictException&)
+			{
+			}
+		}
+		done = true;
+		writer.join();
+		
+		check(torn == 0, "optimistic transactions read a string field another thread keeps writing whole");
+		check(committed > 0, "optimistic transactions reading while another thread writes commit now and then");
+		
+		fixture.clear();
+	}
+	
+	// assigns number to p once the other writer has assigned its own, noting when it is done
+	void setNumberAlongside(PersonPtr p, unsigned int number, boost::barrier& assigned, boost::atomic<bool>& done)
+	{
+		assigned.wait();
+		p->setNumber(number);
+		done = true;
+	}
+	
+	// assigns name to p once the other writer took it, noting whether that one had ended by then
+	void setTakenName(PersonPtr p, const std::string& name, boost::barrier& taken, const boost::atomic<bool>& holderDone, bool& assigned, bool& afterHolder)
+	{
+		taken.wait();
+		try
+		{
+			p->setName(name);
+			assigned = true;
+		}
+		catch(const UniqueKeyException&)
+		{
+			assigned = false;
+		}
+		afterHolder = holderDone;
+	}
+	
+	void checkIndexIsolation(PersonStore& people)
+	{
+		StoreFixture fixture(people);
+		PersonPtr first(fixture.store("check isolation 1", 1));
+		PersonPtr second(fixture.store("check isolation 2", 2));
+		
+		boost::barrier assigned(2);
+		boost::atomic<bool> secondDone(false);
+		boost::thread writer(boost::bind(setNumberAlongside, second, 9, boost::ref(assigned), boost::ref(secondDone)));
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			first->setNumber(8);
+			assigned.wait();
+			for(unsigned int i = 0; i < 200 && !secondDone; i++)
+				boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+			check(secondDone, "writers of an indexed field of different instances do not wait for each other's transactions");
+		}
+		writer.join();
+		check(people.getList<person::NUMBER>(8u)->size() == 1 && people.getList<person::NUMBER>(9u)->size() == 1, "both writers' entries are in the index");
+		
+		fixture.clear();
+		
+		// replaces the hash index on the names while the store is empty
+		people.addUniqueIndex<person::NAME>();
+		PersonPtr holder(fixture.store("check isolation holder", 1));
+		PersonPtr taker(fixture.store("check isolation taker", 2));
+		
+		boost::barrier taken(2);
+		boost::atomic<bool> holderDone(false);
+		bool takerAssigned = false, afterHolder = false;
+		boost::thread other(boost::bind(setTakenName, taker, std::string("check isolation taken"), boost::ref(taken), boost::cref(holderDone), boost::ref(takerAssigned), boost::ref(afterHolder)));
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			holder->setName("check isolation taken");
+			taken.wait();
+			// the other writer would give up now if it took the key for taken for good
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+			holder->setName("check isolation holder");
+			holderDone = true;
+		}
+		other.join();
+		check(takerAssigned && afterHolder, "a unique key taken by a running transaction is free once that transaction gives it back");
+		check(people.get<person::NAME>("check isolation taken") == taker, "the waiting writer got the key");
+		
+		fixture.clear();
+		
+		people.addIndex<person::NAME>();
+	}
+	
+	// assigns a new number to every one of people in a single transaction once the other writer has assigned its own
+	void setNumbers(const std::vector<PersonPtr>& people, boost::barrier& assigned, boost::atomic<bool>& done)
+	{
+		assigned.wait();
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			BOOST_FOREACH(const PersonPtr& p, people)
+				p->setNumber(p->getNumber() + 1);
+		}
+		done = true;
+	}
+	
+	void setAllNumbers(const std::vector<PersonPtr>& people)
+	{
+		boost::barrier assigned(1);
+		boost::atomic<bool> done(false);
+		setNumbers(people, assigned, done);
+	}
+	
+	// more instances than a store could give locks of their own if instances shared locks
+	void checkInstanceLocks(PersonStore& people)
+	{
+		StoreFixture fixture(people);
+		PersonPtr held(fixture.store("check instance locks", 1));
+		std::vector<PersonPtr> others;
+		for(unsigned int i = 0; i < 300; i++)
+			others.push_back(fixture.store("check instance locks " + boost::lexical_cast<std::string>(i), 1));
+		
+		boost::barrier assigned(2);
+		boost::atomic<bool> done(false);
+		boost::thread writer(boost::bind(setNumbers, boost::cref(others), boost::ref(assigned), boost::ref(done)));
+		{
+			TransactionPtr transaction = Transaction::startTransaction();
+			held->setNumber(2);
+			assigned.wait();
+			for(unsigned int i = 0; i < 200 && !done; i++)
+				boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+			check(done, "a writer of many instances does not wait for the transaction of a writer of another one");
+		}
+		writer.join();
+		
+		bool conflicted = false;
+		try
+		{
+			TransactionPtr transaction = Transaction::startTransaction(TransactionModes::Optimistic);
+			held->getNumber();
+			boost::thread other(boost::bind(setAllNumbers, boost::cref(others)));
+			other.join();
+			transaction->commit();
+		}
+		catch(const ConflictException&)
+		{
+			conflicted = true;
+		}
+		check(!conflicted, "writes of other instances do not conflict with an optimistic read of an instance");
+		
+		fixture.clear();
+	}
+	
+	// the lowest id erased from the shard the id of a new instance points to, or 0 if none is left there
+	IdAllocator::ID lowestErased(std::set<IdAllocator::ID>& erased, IdAllocator::ID id, std::size_t shards)
+	{
+		BOOST_FOREACH(IdAllocator::ID e, erased)
+			if(e % shards == id % shards)
+			{
+				erased.erase(e);
+				return e;
+			}
+		return 0;
+	}
+	
+	// the ids of the people by their names
+	std::map<std::string, IdAllocator::ID> idsByName(PersonStore& people)
+	{
+		std::map<std::string, IdAllocator::ID> ids;
+		PersonStore::ModelListPtr list(people.getList());
+		BOOST_FOREACH(const PersonPtr& p, *list)
+			ids[p->getName()] = p->getId();
+		return ids;
+	}
+	
+	// erases some people, exports and reimports the store, then stores new people in the gaps,
+	// and imports an id of the old format far above the others, which must leave the new ids small
+	void checkIds(PersonStore& people)
+	{
+		const std::string file("checks-ids.json");
+		const std::size_t shards = people.getShardCount();
+		
+		StoreFixture fixture(people);
+		std::vector<PersonPtr> stored;
+		for(unsigned int i = 0; i < 30; i++)
+			stored.push_back(fixture.store("check ids " + boost::lexical_cast<std::string>(i), i));
+		std::set<IdAllocator::ID> erased;
+		for(unsigned int i = 1; i < stored.size() - 1; i += 3)
+		{
+			erased.insert(stored[i]->getId());
+			stored[i]->erase();
+		}
+		
+		std::map<std::string, IdAllocator::ID> exported(idsByName(people));
+		people.exportJson(file);
+		people.clear();
+		people.importJson(file);
+		check(idsByName(people) == exported, "every instance has the same id after an export and an import");
+		
+		bool lowestFirst = true;
+		for(unsigned int i = 0; i < erased.size(); i++)
+		{
+			PersonPtr p(fixture.store("check ids new", i));
+			IdAllocator::ID lowest = lowestErased(erased, p->getId(), shards);
+			lowestFirst = lowestFirst && (lowest == 0 || p->getId() == lowest);
+		}
+		check(lowestFirst, "the ids erased before an export are reused lowest first after the import");
+		
+		// files written before the model table name the model of every instance, and their ids are hashes
+		const IdAllocator::ID legacyId = 0xfedcba9876543210ull - 0xfedcba9876543210ull % shards;
+		{
+			PersonPtr legacy(new person("check ids legacy", 0));
+			Json::Value value;
+			value["id"] = Json::UInt64(legacyId);
+			value["model"] = legacy->getModelName();
+			value["fields"] = *people.toJson(legacy);
+			std::ofstream outfile(file.c_str(), std::ofstream::binary);
+			outfile << value << std::endl;
+		}
+		people.importJson(file);
+		boost::filesystem::remove(file);
+		
+		std::map<std::string, IdAllocator::ID> ids(idsByName(people));
+		check(ids["check ids legacy"] == legacyId, "an instance of the old format keeps its id");
+		bool small = true;
+		for(unsigned int i = 0; i < 10; i++)
+			small = small && fixture.store("check ids after legacy", i)->getId() < 1000 * shards;
+		check(small, "importing an id far above the others leaves new ids small");
+		
+		fixture.clear();
+	}
+	
+	// erases three of every four people, enough for the instance lists of the shards to be compacted on the way
+	void checkCompaction(PersonStore& people)
+	{
+		StoreFixture fixture(people);
+		std::vector<PersonPtr> stored;
+		for(unsigned int i = 0; i < 1000; i++)
+			stored.push_back(fixture.store("check compaction", i));
+		
+		std::set<PersonPtr> kept;
+		for(unsigned int i = 0; i < stored.size(); i++)
+		{
+			if(i % 4 == 0)
+				kept.insert(stored[i]);
+			else
+				stored[i]->erase();
+		}
+		
+		PersonStore::ModelListPtr list(people.getList());
+		check(people.size() == kept.size() && std::set<PersonPtr>(list->begin(), list->end()) == kept, "getList() has every instance left after many were erased");
+		check(people.getInstance(stored[4]->getId()) == stored[4], "getInstance() finds an instance left after many were erased");
+		
+		fixture.clear();
+	}
+	
+	// erasing a person erases the groups it founded and takes it off the organizations it is the secretary of,
+	// as the delete policies of their relation fields say
+	void checkRelationDispatch(PersonStore& people, GroupStore& groups)
+	{
+		StoreFixture fixture(people);
+		PersonPtr founder(fixture.store("check relations founder", 1));
+		PersonPtr secretary(fixture.store("check relations secretary", 2));
+		GroupPtr club(new group("check relations club", founder));
+		club->store();
+		boost::shared_ptr<organization> company(new organization("check relations company", fixture.store("check relations owner", 3), secretary));
+		company->store();
+		
+		secretary->erase();
+		check(groups.size() == 2 && !company->getSecretary(), "erasing a person resets the relation fields pointing to it that are set to null on delete");
+		founder->erase();
+		check(groups.size() == 1 && groups.getList<group::NAME>(std::string("check relations club"))->empty(), "erasing a person erases the instances whose relation fields pointing to it erase on delete");
+		
+		// the relation index on the secretaries is there before the model with the field
+		company->erase();
+		groups.unregisterModel<organization>();
+		groups.addShardedIndex< RelationIndex<GroupPtr, PersonPtr> >(organization::SECRETARY);
+		fixture.store("check relations unregistered", 4)->erase();
+		groups.registerModel<organization>();
+		
+		secretary = fixture.store("check relations secretary", 2);
+		company.reset(new organization("check relations company", fixture.store("check relations owner", 3), secretary));
+		company->store();
+		secretary->erase();
+		check(groups.size() == 1 && !company->getSecretary(), "a relation index added before the model with its field resets the field once the model is registered");
+		
+		fixture.clear();
+		check(groups.size() == 0, "the group store is empty again");
+	}
+	
+	// appends the instances it visits and stops once it has limit of them
+	template<typename ModelClassPtr>
+	struct CollectInstances
+	{
+		CollectInstances(std::vector<ModelClassPtr>& v, std::size_t l = std::numeric_limits<std::size_t>::max()) : visited(v), limit(l) { }
+		
+		bool operator()(const ModelClassPtr& instance) const
+		{
+			visited.push_back(instance);
+			return visited.size() < limit;
+		}
+		
+		std::vector<ModelClassPtr>& visited;
+		std::size_t limit;
+	};
+	
+	// whether visited has the instances of listed, in any order
+	template<typename ModelClassPtr>
+	bool sameInstances(std::vector<ModelClassPtr> visited, std::vector<ModelClassPtr> listed)
+	{
+		std::sort(visited.begin(), visited.end());
+		std::sort(listed.begin(), listed.end());
+		return visited == listed;
+	}
+	
+	// forEach() of the stores visits what their getList() returns, or stops early when the visitor says so
+	void checkVisitors(PersonStore& people, GroupStore& groups)
+	{
+		StoreFixture fixture(people);
+		std::vector<PersonPtr> stored;
+		for(unsigned int i = 0; i < 10; i++)
+			stored.push_back(fixture.store("check visitors", i % 2));
+		
+		std::vector<PersonPtr> visited;
+		check(people.forEach(CollectInstances<PersonPtr>(visited)) && sameInstances(visited, *people.getList()), "forEach() visits every instance getList() returns");
+		visited.clear();
+		check(!people.forEach(CollectInstances<PersonPtr>(visited, 3)) && visited.size() == 3, "forEach() stops when the visitor returns false and returns false");
+		
+		visited.clear();
+		check(people.forEach<person::NUMBER>(1u, CollectInstances<PersonPtr>(visited)) && visited.size() == 5 && sameInstances(visited, *people.getList<person::NUMBER>(1u)), "forEach() of a value visits every instance getList() of the value returns");
+		visited.clear();
+		check(!people.forEach<person::NUMBER>(1u, CollectInstances<PersonPtr>(visited, 2)) && visited.size() == 2, "forEach() of a value stops when the visitor returns false and returns false");
+		
+		PersonGroups memberships(people, PersonGroups::None, groups, PersonGroups::None);
+		GroupPtr club(new group("check visitors club", stored[0])), band(new group("check visitors band", stored[0]));
+		club->store();
+		band->store();
+		for(unsigned int i = 0; i < 4; i++)
+			memberships.store(stored[i], club);
+		memberships.store(stored[0], band);
+		
+		visited.clear();
+		check(memberships.forEach(club, CollectInstances<PersonPtr>(visited)) && visited.size() == 4 && sameInstances(visited, *memberships.getList(club)), "forEach() of a relation store visits every instance its getList() returns");
+		visited.clear();
+		check(!memberships.forEach(club, CollectInstances<PersonPtr>(visited, 1)) && visited.size() == 1, "forEach() of a relation store stops when the visitor returns false and returns false");
+		std::vector<GroupPtr> joined;
+		check(memberships.forEach(stored[0], CollectInstances<GroupPtr>(joined)) && joined.size() == 2 && sameInstances(joined, *memberships.getList(stored[0])), "forEach() of a relation store visits the instances on the other side too");
+		
+		fixture.clear();
+		check(groups.size() == 0, "the group store is empty again");
+	}
+	
+	// pages through the people with number 7, through the store or through the index on the numbers,
+	// erasing and adding people between the pages
+	void checkPages(PersonStore& people, bool index)
+	{
+		const std::string lookup(index ? "getPage<person::NUMBER>()" : "getPage()");
+		
+		StoreFixture fixture(people);
+		std::vector<PersonPtr> stored;
+		for(unsigned int i = 0; i < 50; i++)
+			stored.push_back(fixture.store("check page " + boost::lexical_cast<std::string>(i), 7));
+		
+		std::set<PersonPtr> seen, erased;
+		bool duplicates = false, erasedSeen = false;
+		PageToken token;
+		do
+		{
+			Page<PersonPtr> page(index ? people.getPage<person::NUMBER>(7, token, 10) : people.getPage(token, 10));
+			check(page.values->size() <= 10, lookup + " returns at most the limit");
+			BOOST_FOREACH(const PersonPtr& p, *page.values)
+			{
+				duplicates = duplicates || !seen.insert(p).second;
+				erasedSeen = erasedSeen || erased.find(p) != erased.end();
+			}
+			
+			// the token survives a round trip through a client
+			token = PageToken(page.next.toString());
+			
+			// one person that was not returned yet goes, one that was stays and a new one comes
+			BOOST_FOREACH(const PersonPtr& p, stored)
+			{
+				if(seen.find(p) == seen.end() && erased.find(p) == erased.end())
+				{
+					erased.insert(p);
+					p->erase();
+					break;
+				}
+			}
+			fixture.store("check page added", 7);
+		} while(!token.isEnd());
+		
+		check(!duplicates, lookup + " returns no instance twice");
+		check(!erasedSeen, lookup + " does not return instances erased before their page");
+		
+		bool missing = false;
+		BOOST_FOREACH(const PersonPtr& p, stored)
+			if(erased.find(p) == erased.end() && seen.find(p) == seen.end())
+				missing = true;
+		check(!missing, lookup + " returns every instance that stays in the store");
+		
+		fixture.clear();
+	}
+	
+	void checkUnique(PersonStore& people)
+	{
+		// replaces the hash index on the names while the store is empty
+		people.addUniqueIndex<person::NAME>();
+		
+		StoreFixture fixture(people);
+		PersonPtr first(fixture.store("check unique", 1));
+		
+		PersonPtr duplicate(new person("check unique", 2));
+		bool rejected = false;
+		try
+		{
+			duplicate->store();
+		}
+		catch(const UniqueKeyException&)
+		{
+			rejected = true;
+		}
+		check(rejected, "storing a taken key throws a UniqueKeyException");
+		check(people.size() == 1, "the rejected instance is not stored");
+		check(people.getList<person::NUMBER>(2)->empty(), "the rejected instance is in no index");
+		
+		PersonPtr second(fixture.store("check unique 2", 3));
+		rejected = false;
+		try
+		{
+			second->setName("check unique");
+		}
+		catch(const UniqueKeyException&)
+		{
+			rejected = true;
+		}
+		check(rejected, "assigning a taken key throws a UniqueKeyException");
+		check(second->getName() == "check unique 2", "the rejected assignment leaves the field as it was");
+		check(people.get<person::NAME>("check unique 2") == second, "the rejected assignment leaves the index as it was");
+		check(people.get<person::NAME>("check unique") == first, "the rejected assignment leaves the holder of the key in the index");
+		check(people.get<person::NAME, person::NUMBER>("check unique 2", 3) == second, "the rejected assignment leaves the compound index as it was");
+		
+		second->setName("check unique 3");
+		check(people.get<person::NAME>("check unique 3") == second, "assigning a free key moves the instance to it");
+		
+		fixture.clear();
+		
+		people.addIndex<person::NAME>();
+	}
+	
+	// true if the store throws a UniqueKeyException for p
+	bool rejectsStore(const PersonPtr& p)
+	{
+		try
+		{
+			p->store();
+		}
+		catch(const UniqueKeyException&)
+		{
+			return true;
+		}
+		return false;
+	}
+	
+	bool rejectsNumber(const PersonPtr& p, unsigned int number)
+	{
+		try
+		{
+			p->setNumber(number);
+		}
+		catch(const UniqueKeyException&)
+		{
+			return true;
+		}
+		return false;
+	}
+	
+	void checkUniqueCompound(PersonStore& people)
+	{
+		// replaces the compound index on the names and numbers while the store is empty
+		people.addCompoundIndex<person::NAME, person::NUMBER>(IndexPolicies::Unique);
+		
+		StoreFixture fixture(people);
+		PersonPtr first(fixture.store("check unique compound", 1)), second(fixture.store("check unique compound", 2));
+		check(people.size() == 2, "instances that share only some of the fields of a unique compound index are stored");
+		
+		check(rejectsStore(PersonPtr(new person("check unique compound", 1))), "storing a taken compound key throws a UniqueKeyException");
+		check(people.size() == 2 && people.getList<person::NUMBER>(1)->size() == 1, "the rejected instance is not stored and in no index");
+		
+		check(rejectsNumber(second, 1), "assigning one field so the compound key is taken throws a UniqueKeyException");
+		check(second->getNumber() == 2, "the rejected assignment leaves the field as it was");
+		check(people.get<person::NAME, person::NUMBER>("check unique compound", 2) == second && people.get<person::NAME, person::NUMBER>("check unique compound", 1) == first, "the rejected assignment leaves the compound index as it was");
+		check(people.getList<person::NUMBER>(1)->size() == 1 && people.get<person::NUMBER>(2) == second, "the rejected assignment leaves the index of the assigned field as it was");
+		check(people.getList<person::NAME>(std::string("check unique compound"))->size() == 2, "the rejected assignment leaves the index of the other field as it was");
+		
+		second->setNumber(3);
+		second->setName("check unique compound 2");
+		check(people.get<person::NAME, person::NUMBER>("check unique compound 2", 3) == second, "the compound key follows every field assigned");
+		check(!rejectsNumber(second, 1), "a compound key is free once another field of it differs");
+		
+		fixture.clear();
+		
+		people.addCompoundIndex<person::NAME, person::NUMBER>();
+	}
+	
+	// appends the names it visits
+	struct CollectNames
+	{
+		CollectNames(std::vector<std::string>& n) : names(n) { }
+		
+		bool operator()(const PersonPtr& p) const
+		{
+			names.push_back(p->getName());
+			return true;
+		}
+		
+		std::vector<std::string>& names;
+	};
+	
+	void checkOrdered(PersonStore& people)
+	{
+		// replaces the hash index on the names while the store is empty
+		people.addStringIndex<person::NAME>();
+		
+		const char* names[] = { "check order c", "check order a", "check order b", "check order b", "check order d" };
+		StoreFixture fixture(people);
+		std::vector<PersonPtr> stored;
+		for(unsigned int i = 0; i < 5; i++)
+			stored.push_back(fixture.store(names[i], i));
+		
+		PersonStore::ModelListPtr range(people.getRange<person::NAME>(std::string("check order b"), std::string("check order c")));
+		bool inOrder = range->size() == 3 && (*range)[2] == stored[0];
+		inOrder = inOrder && (*range)[0]->getName() == "check order b" && (*range)[1]->getName() == "check order b" && (*range)[0]->getId() < (*range)[1]->getId();
+		check(inOrder, "getRange() returns the keys in the range in order, equal keys in id order");
+		check(people.findFirst<person::NAME>() == stored[1] && people.findLast<person::NAME>() == stored[4], "findFirst() and findLast() return the lowest and the highest key");
+		check(people.getPrefixList<person::NAME>("check order b")->size() == 2 && people.getPrefixList<person::NAME>("check order", 4)->size() == 4, "getPrefixList() returns at most the limit of the keys starting with the prefix");
+		
+		std::vector<std::string> visited;
+		people.forEachInOrder<person::NAME>(CollectNames(visited), true);
+		check(visited.size() == 5 && visited.front() == "check order d" && visited.back() == "check order a", "forEachInOrder() visits the keys in reverse");
+		
+		stored[2]->setName("check order e");
+		check(people.getList<person::NAME>(std::string("check order b"))->size() == 1 && people.findLast<person::NAME>() == stored[2], "assigned instances move to their new key");
+		stored.back()->erase();
+		stored.pop_back();
+		check(people.getPrefixList<person::NAME>("check order d")->empty(), "erased instances leave the ordered index");
+		
+		fixture.clear();
+		
+		people.addIndex<person::NAME>();
+	}
+	
+	void checkBitmaps(PersonStore& people)
+	{
+		// replaces the hash index on the numbers while the store is empty
+		people.addBitmapIndex<person::NUMBER>();
+		
+		StoreFixture fixture(people);
+		std::vector<PersonPtr> stored;
+		for(unsigned int i = 0; i < 40; i++)
+			stored.push_back(fixture.store("check bitmap", i % 4));
+		
+		Bitmap ones(people.getBitmap<person::NUMBER>(1)), twos(people.getBitmap<person::NUMBER>(2));
+		check(ones.size() == 10 && twos.size() == 10, "getBitmap() has the ids of every instance with the value");
+		check((ones & twos).empty(), "AND of the bitmaps of two values is empty");
+		check((ones | twos).size() == 20, "OR of the bitmaps of two values has both");
+		check((people.getIdBitmap() - ones).size() == 30, "NOT of a bitmap has every other instance");
+		
+		std::vector<unsigned int> numbers;
+		numbers.push_back(1);
+		numbers.push_back(2);
+		Bitmap either(people.getBitmap<person::NUMBER>(numbers));
+		check(either.size() == 20, "getBitmap() of several values is their OR");
+		check((either & ones).size() == 10 && (either - ones).size() == 10, "AND and NOT of an OR split it again");
+		
+		bool match = true;
+		PersonStore::ModelListPtr list(people.getList(either - ones));
+		BOOST_FOREACH(const PersonPtr& p, *list)
+			match = match && p->getNumber() == 2;
+		check(list->size() == 10 && match, "getList() of a bitmap returns the instances of its ids");
+		
+		stored[1]->erase();
+		check(people.getBitmap<person::NUMBER>(1).size() == 9, "erased instances leave the bitmaps");
+		stored[2]->setNumber(1);
+		check(people.getBitmap<person::NUMBER>(1).size() == 10 && people.getBitmap<person::NUMBER>(2).size() == 9, "assigned instances move to the bitmap of their new value");
+		
+		fixture.clear();
+		
+		people.addIndex<person::NUMBER>();
+	}
+	
+	// lookups on the names and the founders of groups, which no compound index covers, so the indexes of both fields
+	// are intersected: the founders through their relation index and the names through a hash, a bitmap or an ordered index
+	void checkIntersections(PersonStore& people, GroupStore& groups)
+	{
+		StoreFixture fixture(people);
+		PersonPtr alice(fixture.store("check intersection alice", 1)), bob(fixture.store("check intersection bob", 2));
+		
+		const char* kinds[] = { "a hash", "a bitmap", "an ordered" };
+		for(unsigned int kind = 0; kind < 3; kind++)
+		{
+			// replaces the index on the names while the group store is empty
+			if(kind == 0)
+				groups.addIndex<group::NAME>();
+			else if(kind == 1)
+				groups.addBitmapIndex<group::NAME>();
+			else
+				groups.addOrderedIndex<group::NAME>();
+			const std::string names(std::string(" with ") + kinds[kind] + " index on the names");
+			
+			std::vector<GroupPtr> stored;
+			stored.push_back(GroupPtr(new group("check intersection", alice)));
+			stored.push_back(GroupPtr(new group("check intersection", bob)));
+			stored.push_back(GroupPtr(new group("check intersection", alice)));
+			stored.push_back(GroupPtr(new group("check intersection other", alice)));
+			BOOST_FOREACH(const GroupPtr& g, stored)
+				g->store();
+			
+			check(groups.get<group::NAME, group::FOUNDER>(std::string("check intersection"), bob) == stored[1], "get() of two fields returns the only instance matching both" + names);
+			std::vector<GroupPtr> expected;
+			expected.push_back(stored[0]);
+			expected.push_back(stored[2]);
+			check(sameInstances(*groups.getList<group::NAME, group::FOUNDER>(std::string("check intersection"), alice), expected), "getList() of two fields returns every instance matching both" + names);
+			
+			bool notFound = false;
+			try
+			{
+				groups.get<group::NAME, group::FOUNDER>(std::string("check intersection other"), bob);
+			}
+			catch(const InstanceNotFoundException&)
+			{
+				notFound = true;
+			}
+			check(notFound, "get() of two fields that match separately but not together throws an InstanceNotFoundException" + names);
+			check(groups.getList<group::NAME, group::FOUNDER>(std::string("check intersection other"), bob)->empty(), "getList() of two fields that match separately but not together is empty" + names);
+			
+			BOOST_FOREACH(const GroupPtr& g, stored)
+				g->erase();
+			check(groups.size() == 0, "the group store is empty again" + names);
+		}
+		
+		groups.addIndex<group::NAME>();
+		fixture.clear();
+	}
+	
+	struct CollectIds
+	{
+		CollectIds(std::vector<Bitmap::ID>& i) : ids(i) { }
+		
+		bool operator()(Bitmap::ID id) const
+		{
+			ids.push_back(id);
+			return true;
+		}
+		
+		std::vector<Bitmap::ID>& ids;
+	};
+	
+	// whether bitmap has the ids of reference, visiting them from first on in order
+	bool sameIds(const Bitmap& bitmap, const std::set<Bitmap::ID>& reference, Bitmap::ID first = 0)
+	{
+		std::vector<Bitmap::ID> visited;
+		bitmap.forEach(CollectIds(visited), first);
+		return visited == std::vector<Bitmap::ID>(reference.lower_bound(first), reference.end()) && (first != 0 || bitmap.size() == reference.size());
+	}
+	
+	// AND, OR and NOT of bitmaps with chunks of both kinds, in several chunks, against sets with the same ids
+	void checkBitmapOperations(const Bitmap& a, const std::set<Bitmap::ID>& aIds, const Bitmap& b, const std::set<Bitmap::ID>& bIds, const std::string& what)
+	{
+		std::set<Bitmap::ID> both, either, difference;
+		std::set_intersection(aIds.begin(), aIds.end(), bIds.begin(), bIds.end(), std::inserter(both, both.end()));
+		std::set_union(aIds.begin(), aIds.end(), bIds.begin(), bIds.end(), std::inserter(either, either.end()));
+		std::set_difference(aIds.begin(), aIds.end(), bIds.begin(), bIds.end(), std::inserter(difference, difference.end()));
+		check(sameIds(a & b, both), "AND of " + what);
+		check(sameIds(a | b, either), "OR of " + what);
+		check(sameIds(a - b, difference), "NOT of " + what);
+	}
+	
+	void checkBitmapChunks()
+	{
+		// dense and sparse in the first chunk, sparse and dense in the second one, and a chunk only one of them has
+		Bitmap dense, sparse;
+		std::set<Bitmap::ID> denseIds, sparseIds;
+		for(Bitmap::ID id = 0; id < 65536; id += 3)
+		{
+			dense.insert(id);
+			denseIds.insert(id);
+		}
+		for(Bitmap::ID id = 65536; id < 70000; id += 997)
+		{
+			dense.insert(id);
+			denseIds.insert(id);
+		}
+		for(Bitmap::ID id = 5; id < 65536; id += 101)
+		{
+			sparse.insert(id);
+			sparseIds.insert(id);
+		}
+		for(Bitmap::ID id = 65536; id < 2 * 65536; id += 7)
+		{
+			sparse.insert(id);
+			sparseIds.insert(id);
+		}
+		for(Bitmap::ID id = 5 * 65536; id < 5 * 65536 + 300; id++)
+		{
+			sparse.insert(id);
+			sparseIds.insert(id);
+		}
+		check(sameIds(dense, denseIds) && sameIds(sparse, sparseIds), "a bitmap has the ids inserted in chunks above 4096 ids and below");
+		check(sameIds(dense, denseIds, 4099) && sameIds(sparse, sparseIds, 65536 + 64) && sameIds(sparse, sparseIds, 3 * 65536), "forEach() visits the ids from first on");
+		checkBitmapOperations(dense, denseIds, sparse, sparseIds, "bitmaps with chunks of both kinds");
+		checkBitmapOperations(sparse, sparseIds, dense, denseIds, "bitmaps with chunks of both kinds, the other way around");
+		
+		Bitmap denseToo;
+		std::set<Bitmap::ID> denseTooIds;
+		for(Bitmap::ID id = 0; id < 65536; id += 2)
+		{
+			denseToo.insert(id);
+			denseTooIds.insert(id);
+		}
+		checkBitmapOperations(dense, denseIds, denseToo, denseTooIds, "bitmaps with dense chunks");
+		
+		// the first chunk goes back to sorted ids once it keeps every 24th id alone, which must not lose any
+		for(Bitmap::ID id = 0; id < 65536; id += 3)
+			if(id % 24 != 0)
+			{
+				dense.erase(id);
+				denseIds.erase(id);
+			}
+		check(sameIds(dense, denseIds), "a bitmap keeps its ids when a chunk falls below 4096 ids");
+		checkBitmapOperations(dense, denseIds, denseToo, denseTooIds, "a bitmap with a chunk that fell below 4096 ids");
+		
+		BOOST_FOREACH(Bitmap::ID id, denseIds)
+			dense.erase(id);
+		check(dense.empty(), "a bitmap is empty once every id is erased");
+	}
+}
+
+unsigned int runChecks(db& database)
+{
+	PersonStore& people(database.people);
+	GroupStore& groups(database.groups);
+	failures = 0;
+	
+	// the checks of locking behavior run with every lock policy, on plain resources and on the store and its indexes
+	const LockPolicies::LockPolicy policies[] = { LockPolicies::Queue, LockPolicies::BigReader, LockPolicies::PhaseFair };
+	const char* policyNames[] = { "queue", "big reader", "phase fair" };
+	for(unsigned int p = 0; p < 3; p++)
+	{
+		lockPolicyName = policyNames[p];
+		people.setLockPolicy(policies[p]);
+		checkDeadlock(policies[p]);
+		checkExecutorWakeups(policies[p]);
+		checkConflict(people);
+		checkIndexIsolation(people);
+	}
+	people.setLockPolicy(LockPolicies::Queue);
+	lockPolicyName.clear();
+	
+	checkPhaseFair();
+	checkPriorities();
+	checkCallSiteWaits();
+	checkLockHistoryJson();
+	checkTornReads(people);
+	checkInstanceLocks(people);
+	checkIds(people);
+	checkCompaction(people);
+	checkRelationDispatch(people, groups);
+	checkVisitors(people, groups);
+	checkPages(people, false);
+	checkPages(people, true);
+	checkUnique(people);
+	checkUniqueCompound(people);
+	checkOrdered(people);
+	checkBitmaps(people);
+	checkIntersections(people, groups);
+	checkBitmapChunks();
+	
+	std::cout << (failures == 0 ? "all checks passed" : boost::lexical_cast<std::string>(failures) + " checks failed") << std::endl;
+	return failures;
+}
@@ -0,0 +1,7 @@
+
+#pragma once
+
+#include "db.h"
+
+// checks the behavior the demo only prints, returns the number of checks that failed
+unsigned int runChecks(db& database);
@@ -5,12 +5,16 @@ using namespace boost::filesystem;
 
 db* db::instance(NULL);
 
-db::db()
-	: people()
+db::db(std::size_t peopleShards)
+	: people(peopleShards)
 	, groups()
 {
 	instance = this;
 	
+	// the lock history refers to them by these names
+	people.setLockName("people");
+	groups.setLockName("groups");
+	
 	people.registerModel<person>();
 	people.addIndex<person::NAME>();
 	people.addIndex<person::NUMBER>();
@@ -29,7 +33,11 @@ db& db::getInstance()
 
 void db::load()
 {
-	TransactionPtr transaction = Transaction::startTransaction();
+	// before the first transaction, so even that one locks everything it needs up front
+	if(exists(path("lockhistory.json"))) Transaction::importLockHistory("lockhistory.json");
+	
+	static const void* site = Transaction::callSite("db::load");
+	TransactionPtr transaction = Transaction::startTransaction(site);
 	transaction->getExclusiveLock(&people);
 	transaction->getExclusiveLock(&groups);
 	
@@ -39,10 +47,12 @@ void db::load()
 
 void db::save() const
 {
-	TransactionPtr transaction = Transaction::startTransaction();
+	static const void* site = Transaction::callSite("db::save");
+	TransactionPtr transaction = Transaction::startTransaction(site);
 	transaction->getSharedLock(&people);
 	transaction->getSharedLock(&groups);
 	
 	people.exportJson("people.json");
 	groups.exportJson("groups.json");
+	Transaction::exportLockHistory("lockhistory.json");
 }
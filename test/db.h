@@ -15,7 +15,7 @@ class db
 {
 	public:
 		
-		db();
+		db(std::size_t peopleShards = 1);
 		
 		void load();
 		void save() const;
@@ -4,5 +4,5 @@
 group::group() : name(""), founder(PersonPtr()) { }
 group::group(const std::string & nam, PersonPtr f) : name(nam), founder(f) { }
 
-std::string group::getName() { return name; }
+std::string group::getName() { return name.read(); }
 void group::setName(const std::string& n) { name = n; }
@@ -16,6 +16,7 @@ class organization : public group
 		organization(const std::string & name, PersonPtr founder, PersonPtr secretary);
 		
 		void setSecretary(PersonPtr p) { secretary = p; };
+		PersonPtr getSecretary() { return secretary.read(); };
 		
 		static const FieldId SECRETARY = 10;
 		static const FieldId ACCOUNTANT = 11;
@@ -4,8 +4,8 @@
 person::person() : name(""), number(0) { }
 person::person(const std::string & nam, int num) : name(nam), number(num) { }
 
-unsigned int person::getNumber() { return number; }
+unsigned int person::getNumber() { return number.read(); }
 void person::setNumber(unsigned int n) { number = n; }
 
-std::string person::getName() { return name; }
+std::string person::getName() { return name.read(); }
 void person::setName(const std::string& n) { name = n; }
@@ -3,6 +3,8 @@
 using namespace std;
 
 #include "db.h"
+#include "benchmark.h"
+#include "checks.h"
 
 volatile bool run = true;
 
@@ -31,9 +33,25 @@ int main3()
 	return 0;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
-	db database;
+	bool benchmark = argc > 1 && string(argv[1]) == "--benchmark";
+	bool checks = argc > 1 && string(argv[1]) == "--check";
+	
+	// --benchmark [shards] and --check [shards] run on a people store split into that many shards
+	db database((benchmark || checks) && argc > 2 ? boost::lexical_cast<size_t>(argv[2]) : 1);
+	
+	if(benchmark)
+	{
+		PersonPtr p(new person("benchmark", 1));
+		p->store();
+		benchmarkTransactions(database);
+		return 0;
+	}
+	
+	// --check runs the checks on an empty database and fails if any of them does
+	if(checks)
+		return runChecks(database) == 0 ? 0 : 1;
 	
 	database.load();
 	